@@ -0,0 +1,270 @@
+/**
+ * @file Micro.c
+ * @brief In-process benchmarks of the parser and the history ring.
+ *
+ * The shell's sources are included directly, the same way Shell.c includes them, so
+ * the code being measured is exactly the code the shell runs. A parse works in place,
+ * which means every iteration first copies a fresh line into the buffer and resets the
+ * arena, as the shell does between commands; both are timed as well and are small next
+ * to tokenizing. A second case parses one line with thousands of arguments. The history
+ * is measured once the ring is full, where every add has to evict the oldest entry.
+ * $HISTFILE is emptied first so nothing is written to disk. Pathname expansion of two
+ * patterns over a directory of GLOB_BENCH_FILES files is timed with a cold cache, with
+ * the listing reused from an earlier command, and with glob(3) for comparison.
+ *
+ * Each result is printed as one 'name value unit' line.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+
+#include "../src/Message.c"
+#include "../src/Constants.c"
+#include "../src/Stats.c"
+#include "../src/Arena.c"
+#include "../src/Variables.c"
+#include "../src/CommandHash.c"
+#include "../src/Events.c"
+#include "../src/Cgroup.c"
+#include "../src/Spawn.c"
+#include "../src/History.c"
+#include "../src/HistorySearch.c"
+#include "../src/Lexer.c"
+#include "../src/Parser.c"
+#include "../src/ParseCache.c"
+#include "../src/Glob.c"
+
+#include <glob.h>
+#include <sys/stat.h>
+
+// Control.c is not included; 'unset -f' in Variables.c has no functions to remove here
+void unset_function(const char *name)
+{
+    (void)name;
+}
+
+#define BENCH_SECONDS 0.5
+#define LONG_LINE_ARGS 4096
+#define GLOB_BENCH_FILES 20000
+
+static const char *const sample_lines[] = {
+    "ls -la /usr/lib",
+    "grep -n \"needle in\" < haystack.txt | sort -k2 | uniq -c > counts.txt 2>&1",
+    "find . -name '*.c' -newer Makefile | xargs wc -l | sort -rn | head -20 &",
+    "time make -j8 CFLAGS='-O2 -g' 2> build.log",
+    "echo \"status was $?\" >> log.txt",
+};
+
+#define SAMPLE_COUNT (sizeof(sample_lines) / sizeof(sample_lines[0]))
+
+static double seconds_since(uint64_t started)
+{
+    return (stats_now() - started) / 1e9;
+}
+
+// Parse the sample lines over and over for BENCH_SECONDS with parse, reporting as name
+static void bench_parse_lines(int (*parse)(char *, struct parse_context *), const char *name)
+{
+    struct arena arena = {0};
+    struct parse_context context = {.arena = &arena};
+    char input[256];
+    size_t lengths[SAMPLE_COUNT], bytes = 0;
+    long lines = 0;
+    uint64_t started;
+
+    for (size_t i = 0; i < SAMPLE_COUNT; i++)
+        lengths[i] = strlen(sample_lines[i]) + 1;
+
+    started = stats_now();
+    do
+    {
+        for (int repeat = 0; repeat < 1000; repeat++)
+        {
+            size_t i = lines++ % SAMPLE_COUNT;
+
+            arena_reset(&arena);
+            memcpy(input, sample_lines[i], lengths[i]);
+            if (parse(input, &context) == -1)
+                exit(EXIT_FAILURE);
+            bytes += lengths[i] - 1;
+        }
+    } while (seconds_since(started) < BENCH_SECONDS);
+
+    printf("%s %.1f MB/s\n", name, bytes / seconds_since(started) / 1e6);
+    printf("%s_line %.0f ns\n", name, seconds_since(started) * 1e9 / lines);
+}
+
+// Parse a command line with LONG_LINE_ARGS file arguments
+static void bench_parse_long_line()
+{
+    struct arena arena = {0};
+    struct parse_context context = {.arena = &arena};
+    size_t size = 0;
+    char *original = malloc(LONG_LINE_ARGS * 32), *input = malloc(LONG_LINE_ARGS * 32);
+    long lines = 0;
+    uint64_t started;
+
+    if (!original || !input)
+        exit(EXIT_FAILURE);
+    size += sprintf(original, "wc -l");
+    for (int i = 0; i < LONG_LINE_ARGS; i++)
+        size += sprintf(original + size, " src/generated/file-%d.c", i);
+
+    started = stats_now();
+    do
+    {
+        arena_reset(&arena);
+        memcpy(input, original, size + 1);
+        if (parse_input(input, &context) == -1 || context.pipelines[0].commands[0].arg_count != LONG_LINE_ARGS + 2)
+            exit(EXIT_FAILURE);
+        lines++;
+    } while (seconds_since(started) < BENCH_SECONDS);
+
+    printf("parse_input_%d_args %.1f MB/s\n", LONG_LINE_ARGS, (double)size * lines / seconds_since(started) / 1e6);
+    free(original);
+    free(input);
+}
+
+// Parse one large script made of the sample lines
+static void bench_parse_script()
+{
+    size_t target = 8 * 1024 * 1024, size = 0;
+    char *original = malloc(target + 256), *text = malloc(target + 256);
+    struct script script;
+    int runs = 0;
+    uint64_t started;
+
+    if (!original || !text)
+        exit(EXIT_FAILURE);
+    for (size_t i = 0; size < target; i++)
+        size += sprintf(original + size, "%s\n", sample_lines[i % SAMPLE_COUNT]);
+
+    started = stats_now();
+    do
+    {
+        memcpy(text, original, size + 1);
+        if (parse_script(text, &script) == -1)
+            exit(EXIT_FAILURE);
+        free_script(&script);
+        runs++;
+    } while (seconds_since(started) < BENCH_SECONDS);
+
+    printf("parse_script %.1f MB/s\n", (double)size * runs / seconds_since(started) / 1e6);
+    free(original);
+    free(text);
+}
+
+// Add commands to a history ring that is already full
+static void bench_add_to_history()
+{
+    char command[64];
+    long adds = 0;
+    uint64_t started;
+
+    setenv("HISTFILE", "", 1);
+    history_init();
+    for (int i = 0; i < history_capacity; i++)
+    {
+        snprintf(command, sizeof(command), "make -j%d target-%d", i % 16, i);
+        add_to_history(command);
+    }
+
+    started = stats_now();
+    do
+    {
+        for (int repeat = 0; repeat < 1000; repeat++, adds++)
+        {
+            snprintf(command, sizeof(command), "make -j%ld target-%ld", adds % 16, adds);
+            add_to_history(command);
+        }
+    } while (seconds_since(started) < BENCH_SECONDS);
+
+    printf("add_to_history_full %.0f ns (HISTSIZE=%d)\n", seconds_since(started) * 1e9 / adds, history_capacity);
+}
+
+// Expand two patterns in one large directory, as one command would
+static void bench_glob()
+{
+    char directory[] = "/tmp/mysh-bench-XXXXXX", path[PATH_MAX], first[PATH_MAX], second[PATH_MAX];
+    struct timespec old[2] = {{0, 0}, {0, 0}};
+    struct glob_matches matches = {NULL, 0, 0};
+    const char *modes[] = {"glob_expand_cold", "glob_expand_cached", "glob(3)"};
+
+    if (!mkdtemp(directory))
+        exit(EXIT_FAILURE);
+    for (int i = 0; i < GLOB_BENCH_FILES; i++)
+    {
+        snprintf(path, sizeof(path), "%s/%c%d.%s", directory, "abcd"[i % 4], i, i % 3 ? "c" : "o");
+        close(open(path, O_WRONLY | O_CREAT, 0644));
+    }
+    old[0].tv_sec = old[1].tv_sec = time(NULL) - 3600; // Old enough for the cache to trust
+    utimensat(AT_FDCWD, directory, old, 0);
+    snprintf(first, sizeof(first), "%s/a*.c", directory);
+    snprintf(second, sizeof(second), "%s/b*.c", directory);
+
+    for (int mode = 0; mode < 3; mode++)
+    {
+        long runs = 0;
+        uint64_t started = stats_now();
+
+        do
+        {
+            size_t found = 0;
+
+            if (mode == 2)
+            {
+                glob_t results;
+
+                glob(first, 0, NULL, &results);
+                glob(second, GLOB_APPEND, NULL, &results);
+                found = results.gl_pathc;
+                globfree(&results);
+            }
+            else
+            {
+                if (mode == 0)
+                {
+                    for (int i = 0; i < GLOB_CACHE_SIZE; i++)
+                        release_directory(&glob_cache[i]);
+                }
+                glob_begin();
+                glob_expand(first, &matches);
+                glob_expand(second, &matches);
+                found = matches.count;
+                for (int i = 0; i < matches.count; i++)
+                    free(matches.paths[i]);
+                matches.count = 0;
+            }
+            if (found != GLOB_BENCH_FILES / 3 + 1)
+                exit(EXIT_FAILURE);
+            runs++;
+        } while (seconds_since(started) < BENCH_SECONDS);
+        printf("%s %.0f us (%d files)\n", modes[mode], seconds_since(started) * 1e6 / runs, GLOB_BENCH_FILES);
+    }
+
+    for (int i = 0; i < GLOB_BENCH_FILES; i++)
+    {
+        snprintf(path, sizeof(path), "%s/%c%d.%s", directory, "abcd"[i % 4], i, i % 3 ? "c" : "o");
+        unlink(path);
+    }
+    rmdir(directory);
+    free(matches.paths);
+}
+
+int main()
+{
+    bench_parse_lines(parse_input, "parse_input");
+    bench_parse_lines(parse_cached, "parse_cached");
+    bench_parse_long_line();
+    bench_parse_script();
+    bench_add_to_history();
+    bench_glob();
+    return 0;
+}
@@ -0,0 +1,78 @@
+#!/bin/sh
+# Shell-level benchmarks: mysh against bash and dash on the same generated scripts.
+#
+# Usage: bench/run.sh [path-to-mysh]   (default ./Shell)
+#
+# Each case writes a script to a temporary directory and runs it once per shell, so
+# every shell starts up the same way and pays for parsing its own input. Results are
+# printed as one row per case with a column per shell; shells that are not installed
+# are skipped. Set BENCH_SCALE to scale the iteration counts (default 1).
+
+MYSH=${1:-./Shell}
+SCALE=${BENCH_SCALE:-1}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+SHELLS="$MYSH"
+for candidate in bash dash; do
+    if command -v "$candidate" >/dev/null 2>&1; then
+        SHELLS="$SHELLS $(command -v "$candidate")"
+    fi
+done
+
+now_ns() {
+    date +%s%N
+}
+
+# repeat_line <count> <line> <file>: write <line> <count> times to <file>
+repeat_line() {
+    awk -v n="$1" -v line="$2" 'BEGIN { for (i = 0; i < n; i++) print line }' > "$3"
+}
+
+# stages <n> <command>: '<command> | <command> | ...' with n stages
+stages() {
+    awk -v n="$1" -v c="$2" 'BEGIN { s = c; for (i = 1; i < n; i++) s = s " | " c; print s }'
+}
+
+# run_case <label> <script> <count> <unit>: time every shell on <script>.
+# <unit> is 'ops' for operations per second over <count> operations, 'us' for
+# microseconds per operation, or 'MB' for <count> megabytes per second.
+run_case() {
+    label=$1 script=$2 count=$3 unit=$4
+    printf '%-28s' "$label"
+    for sh in $SHELLS; do
+        started=$(now_ns)
+        HISTFILE= "$sh" "$script" >/dev/null 2>&1 </dev/null
+        elapsed=$(( $(now_ns) - started ))
+        [ "$elapsed" -gt 0 ] || elapsed=1
+        case $unit in
+        ops) value=$(awk -v n="$count" -v t="$elapsed" 'BEGIN { printf "%.0f/s", n / (t / 1e9) }') ;;
+        us) value=$(awk -v n="$count" -v t="$elapsed" 'BEGIN { printf "%.1fus", t / 1e3 / n }') ;;
+        MB) value=$(awk -v n="$count" -v t="$elapsed" 'BEGIN { printf "%.0fMB/s", n / (t / 1e9) }') ;;
+        esac
+        printf ' %14s' "$value"
+    done
+    printf '\n'
+}
+
+printf '%-28s' "case"
+for sh in $SHELLS; do
+    printf ' %14s' "$(basename "$sh")"
+done
+printf '\n'
+
+count=$((5000 * SCALE))
+repeat_line "$count" "true" "$WORK/true.sh"
+run_case "true (commands/sec)" "$WORK/true.sh" "$count" ops
+repeat_line "$count" "/bin/true" "$WORK/bin-true.sh"
+run_case "/bin/true (commands/sec)" "$WORK/bin-true.sh" "$count" ops
+
+for n in 2 8 32; do
+    count=$((2000 * SCALE / n))
+    repeat_line "$count" "$(stages "$n" /bin/true)" "$WORK/pipe-$n.sh"
+    run_case "pipeline of $n (per pipeline)" "$WORK/pipe-$n.sh" "$count" us
+done
+
+megabytes=$((1024 * SCALE))
+echo "head -c ${megabytes}M /dev/zero | cat | cat > /dev/null" > "$WORK/throughput.sh"
+run_case "zero | cat | cat" "$WORK/throughput.sh" "$megabytes" MB
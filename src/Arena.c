@@ -0,0 +1,114 @@
+/**
+ * @file Arena.c
+ * @brief Bump allocator for the storage of one command.
+ *
+ * Everything a command line needs while it is parsed and run (its tokens, argument
+ * vectors, redirections and stages) is carved out of an arena with a pointer bump and
+ * released all at once by arena_reset() before the next line. Nothing is freed piece
+ * by piece. When the current chunk is full a new one, at least twice as large, is
+ * chained in front of it. On reset the chunks are replaced by a single chunk that
+ * can hold everything the last command needed, so a shell that keeps running
+ * commands of similar size stops calling malloc altogether.
+ */
+
+#define ARENA_MIN_CHUNK_SIZE (64 * 1024)
+#define ARENA_ALIGNMENT 16
+
+struct arena_chunk
+{
+    struct arena_chunk *previous;
+    size_t size; // Usable bytes after the header
+    size_t used;
+};
+
+struct arena
+{
+    struct arena_chunk *chunk; // The chunk being filled; NULL before the first allocation
+    size_t total;              // Bytes allocated since the last reset
+};
+
+static struct arena_chunk *arena_new_chunk(struct arena_chunk *previous, size_t size)
+{
+    struct arena_chunk *chunk = malloc(sizeof(*chunk) + size);
+
+    if (!chunk)
+        return NULL;
+    chunk->previous = previous;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+// Function to allocate size bytes from the arena; NULL when memory runs out
+void *arena_alloc(struct arena *arena, size_t size)
+{
+    struct arena_chunk *chunk = arena->chunk;
+    void *memory;
+
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    if (!chunk || chunk->size - chunk->used < size)
+    {
+        size_t chunk_size = chunk ? chunk->size * 2 : ARENA_MIN_CHUNK_SIZE;
+
+        while (chunk_size < size)
+            chunk_size *= 2;
+        chunk = arena_new_chunk(chunk, chunk_size);
+        if (!chunk)
+            return NULL;
+        arena->chunk = chunk;
+    }
+    memory = (char *)(chunk + 1) + chunk->used;
+    chunk->used += size;
+    arena->total += size;
+    return memory;
+}
+
+// Function to copy a string into the arena
+char *arena_strdup(struct arena *arena, const char *text)
+{
+    size_t length = strlen(text) + 1;
+    char *copy = arena_alloc(arena, length);
+
+    if (copy)
+        memcpy(copy, text, length);
+    return copy;
+}
+
+// Function to free every chunk of an arena that is no longer needed
+void arena_free(struct arena *arena)
+{
+    while (arena->chunk)
+    {
+        struct arena_chunk *previous = arena->chunk->previous;
+
+        free(arena->chunk);
+        arena->chunk = previous;
+    }
+    arena->total = 0;
+}
+
+// Function to release everything allocated from the arena, keeping one chunk for reuse
+void arena_reset(struct arena *arena)
+{
+    struct arena_chunk *chunk = arena->chunk;
+
+    if (chunk && chunk->previous)
+    { // Several chunks were needed; replace them by one that fits them all
+        size_t size = chunk->size;
+
+        while (size < arena->total)
+            size *= 2;
+        while (chunk)
+        {
+            struct arena_chunk *previous = chunk->previous;
+
+            free(chunk);
+            chunk = previous;
+        }
+        chunk = arena_new_chunk(NULL, size);
+        arena->chunk = chunk;
+    }
+    if (chunk)
+        chunk->used = 0;
+    arena->total = 0;
+}
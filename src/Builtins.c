@@ -0,0 +1,754 @@
+/**
+ * @file Builtins.c
+ * @brief In-process versions of echo, printf, test, [, true, false, pwd and read.
+ *
+ * These are the commands scripts run most, and each of them used to cost a fork and an
+ * exec of a tiny program. As builtins they run inside the shell with their redirections
+ * applied to the shell's own descriptors and undone afterwards (run_builtin_in_shell in
+ * Shell.c), or in a forked subshell without the exec when they are a pipeline stage.
+ * Output goes through stdio, which is flushed before the descriptors are restored.
+ *
+ * Every builtin starts from a status of 0 and sets last_status only when it has
+ * something else to report: 1 for false, a false test or a failure, and 2 for wrong usage.
+ *
+ * - echo [-neE] args: -n drops the newline, -e interprets backslash escapes, -E (the
+ *   default) does not.
+ * - printf format [args]: the C conversions %s %b %c %d %i %u %o %x %X %e %f %g %a with
+ *   flags, width and precision ('*' included). The format is reused while arguments remain.
+ * - test expr and [ expr ]: POSIX test, with -a, -o, ! and parentheses.
+ * - read [-r] [name...]: one line of standard input split into variables. It reads no
+ *   further than the newline, so the next command (or the next read from a coprocess)
+ *   gets the rest: a pipe is read a byte at a time, a seekable file a block at a time
+ *   with the offset put back after the line.
+ */
+
+#include <ctype.h>
+#include <sys/stat.h>
+
+// Call printf with the '*' widths and precisions that were taken from the arguments
+#define PRINTF_WITH_STARS(spec, star, star_count, value)   \
+    ((star_count) == 2   ? printf(spec, star[0], star[1], value) \
+     : (star_count) == 1 ? printf(spec, star[0], value)          \
+                         : printf(spec, value))
+
+// Print the character for the escape at *src (just after the backslash); returns the bytes
+// consumed, or -1 for '\c', which ends all output. Octal is \0nnn for echo and %b, and
+// \nnn in a printf format.
+static int print_escape(const char *src, FILE *out, int in_format)
+{
+    static const char escapes[] = "\\\\a\ab\be\033f\fn\nr\rt\tv\v";
+    const char *found;
+    int value = 0, length = 1;
+
+    if (*src == 'c')
+        return -1;
+    if (in_format && *src >= '0' && *src <= '7')
+    {
+        for (length = 0; length < 3 && src[length] >= '0' && src[length] <= '7'; length++)
+            value = value * 8 + src[length] - '0';
+        fputc(value, out);
+        return length;
+    }
+    if (*src == '0')
+    {
+        while (length < 4 && src[length] >= '0' && src[length] <= '7')
+            value = value * 8 + src[length++] - '0';
+        fputc(value, out);
+        return length;
+    }
+    if (*src == 'x' && isxdigit((unsigned char)src[1]))
+    {
+        while (length < 3 && isxdigit((unsigned char)src[length]))
+        {
+            char digit = tolower((unsigned char)src[length++]);
+
+            value = value * 16 + (digit <= '9' ? digit - '0' : digit - 'a' + 10);
+        }
+        fputc(value, out);
+        return length;
+    }
+    for (found = escapes; *src != '\0' && *found != '\0'; found += 2)
+    {
+        if (*found == *src)
+        {
+            fputc(found[1], out);
+            return 1;
+        }
+    }
+    fputc('\\', out);
+    return 0;
+}
+
+// Print text with backslash escapes interpreted; returns -1 when '\c' stopped it
+static int print_with_escapes(const char *text, FILE *out)
+{
+    while (*text)
+    {
+        if (*text == '\\')
+        {
+            int length = print_escape(text + 1, out, 0);
+
+            if (length == -1)
+                return -1;
+            text += length + 1;
+        }
+        else
+        {
+            fputc(*text++, out);
+        }
+    }
+    return 0;
+}
+
+// Report a failed write to stdout, which is what a builtin notices instead of SIGPIPE
+static void check_output(const char *name)
+{
+    if (fflush(stdout) == EOF || ferror(stdout))
+    {
+        fprintf(stderr, "%s: write error: %s\n", name, strerror(errno));
+        clearerr(stdout);
+        last_status = 1;
+    }
+}
+
+// Function to implement 'echo [-neE] [args...]'
+void builtin_echo(char **args)
+{
+    int newline = 1, escapes = 0, i = 1;
+
+    for (; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; i++)
+    {
+        const char *option = args[i] + 1;
+
+        if (strspn(option, "neE") != strlen(option))
+            break; // Not an option, so it is printed
+        for (; *option; option++)
+        {
+            if (*option == 'n')
+                newline = 0;
+            else
+                escapes = *option == 'e';
+        }
+    }
+
+    for (int first = i; args[i] != NULL; i++)
+    {
+        if (i > first)
+            fputc(' ', stdout);
+        if (!escapes)
+            fputs(args[i], stdout);
+        else if (print_with_escapes(args[i], stdout) == -1)
+        {
+            newline = 0;
+            break;
+        }
+    }
+    if (newline)
+        fputc('\n', stdout);
+    check_output("echo");
+}
+
+// Convert a printf argument to a number; a leading quote gives the value of the next character
+static void printf_number(const char *arg, long long *value, double *real, int floating)
+{
+    char *end;
+
+    if (arg[0] == '\'' || arg[0] == '"')
+    {
+        *value = (unsigned char)arg[1];
+        *real = *value;
+        return;
+    }
+    errno = 0;
+    if (floating)
+        *real = strtod(arg, &end);
+    else if (arg[0] == '-')
+        *value = strtoll(arg, &end, 0);
+    else
+        *value = (long long)strtoull(arg, &end, 0);
+    if (*arg == '\0')
+        return; // An empty argument counts as 0
+    if (end == arg || *end != '\0' || errno == ERANGE)
+    {
+        fprintf(stderr, "printf: %s: invalid number\n", arg);
+        last_status = 1;
+    }
+}
+
+// Print one conversion; spec holds '%', the flags, width and precision, and conversion is its letter
+static void printf_conversion(char *spec, size_t spec_length, char conversion, const char *arg, int *star, int star_count)
+{
+    long long value = 0;
+    double real = 0;
+
+    if (conversion == 's' || conversion == 'c')
+    { // %c is the first character as a string, so a missing argument prints nothing
+        char first[2] = {arg[0], '\0'};
+
+        spec[spec_length++] = 's';
+        spec[spec_length] = '\0';
+        PRINTF_WITH_STARS(spec, star, star_count, conversion == 's' ? arg : first);
+    }
+    else if (strchr("eEfFgGaA", conversion))
+    {
+        printf_number(arg, &value, &real, 1);
+        spec[spec_length++] = conversion;
+        spec[spec_length] = '\0';
+        PRINTF_WITH_STARS(spec, star, star_count, real);
+    }
+    else
+    {
+        printf_number(arg, &value, &real, 0);
+        spec[spec_length++] = 'l';
+        spec[spec_length++] = 'l';
+        spec[spec_length++] = conversion;
+        spec[spec_length] = '\0';
+        PRINTF_WITH_STARS(spec, star, star_count, value);
+    }
+}
+
+// Function to implement 'printf format [args...]'
+void builtin_printf(char **args)
+{
+    const char *format = args[1];
+    char **arg;
+
+    if (format == NULL)
+    {
+        message(stderr, PRINTF_USAGE_MESSAGE);
+        last_status = 2;
+        return;
+    }
+
+    arg = &args[2];
+    do
+    {
+        char **first_arg = arg;
+
+        for (const char *src = format; *src;)
+        {
+            char spec[64], conversion;
+            size_t spec_length = 0;
+            int star[2], star_count = 0;
+
+            if (*src == '\\')
+            {
+                int length = print_escape(src + 1, stdout, 1);
+
+                if (length == -1)
+                {
+                    check_output("printf");
+                    return;
+                }
+                src += length + 1;
+                continue;
+            }
+            if (*src != '%')
+            {
+                fputc(*src++, stdout);
+                continue;
+            }
+            if (src[1] == '%')
+            {
+                fputc('%', stdout);
+                src += 2;
+                continue;
+            }
+
+            // Copy '%', the flags, the width and the precision into spec, taking '*' from the arguments
+            spec[spec_length++] = *src++;
+            while (*src && strchr("-+ #0", *src) && spec_length < sizeof(spec) - 8)
+                spec[spec_length++] = *src++;
+            for (int part = 0; part < 2; part++)
+            {
+                if (part == 1)
+                {
+                    if (*src != '.')
+                        break;
+                    spec[spec_length++] = *src++;
+                }
+                if (*src == '*')
+                {
+                    star[star_count++] = *arg ? atoi(*arg++) : 0;
+                    spec[spec_length++] = *src++;
+                }
+                while (isdigit((unsigned char)*src) && spec_length < sizeof(spec) - 8)
+                    spec[spec_length++] = *src++;
+            }
+            conversion = *src;
+            if (conversion == '\0' || !strchr("sbcdiouxXeEfFgGaA", conversion))
+            {
+                fprintf(stderr, "printf: %%%c: invalid conversion\n", conversion ? conversion : ' ');
+                last_status = 1;
+                check_output("printf");
+                return;
+            }
+            src++;
+
+            if (conversion == 'b')
+            {
+                if (*arg && print_with_escapes(*arg, stdout) == -1)
+                {
+                    check_output("printf");
+                    return;
+                }
+                if (*arg)
+                    arg++;
+                continue;
+            }
+            printf_conversion(spec, spec_length, conversion, *arg ? *arg : "", star, star_count);
+            if (*arg)
+                arg++;
+        }
+        if (arg == first_arg)
+            break; // The format took no arguments, so using it again would not end
+    } while (*arg != NULL);
+    check_output("printf");
+}
+
+struct test_state
+{
+    char **args;
+    int count;
+    int position;
+    int error;
+};
+
+static int test_expression(struct test_state *state);
+
+static int test_integer(struct test_state *state, const char *text, long long *value)
+{
+    char *end;
+
+    errno = 0;
+    *value = strtoll(text, &end, 10);
+    while (isspace((unsigned char)*end))
+        end++;
+    if (end == text || *end != '\0' || errno == ERANGE)
+    {
+        fprintf(stderr, "test: %s: integer expression expected\n", text);
+        state->error = 1;
+        return -1;
+    }
+    return 0;
+}
+
+static int is_unary_test(const char *op)
+{
+    return op[0] == '-' && op[1] != '\0' && op[2] == '\0' && strchr("bcdefghkLnprsStuwxzOG", op[1]);
+}
+
+static int is_binary_test(const char *op)
+{
+    static const char *const operators[] = {"=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge", "-nt", "-ot", "-ef"};
+
+    for (size_t i = 0; i < sizeof(operators) / sizeof(operators[0]); i++)
+    {
+        if (strcmp(op, operators[i]) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+// Evaluate a unary file or string test
+static int test_unary(char op, const char *operand)
+{
+    struct stat st;
+
+    switch (op)
+    {
+    case 'n':
+        return operand[0] != '\0';
+    case 'z':
+        return operand[0] == '\0';
+    case 't':
+        return isatty(atoi(operand));
+    case 'r':
+        return access(operand, R_OK) == 0;
+    case 'w':
+        return access(operand, W_OK) == 0;
+    case 'x':
+        return access(operand, X_OK) == 0;
+    case 'h':
+    case 'L':
+        return lstat(operand, &st) == 0 && S_ISLNK(st.st_mode);
+    }
+    if (stat(operand, &st) != 0)
+        return 0;
+    switch (op)
+    {
+    case 'b':
+        return S_ISBLK(st.st_mode);
+    case 'c':
+        return S_ISCHR(st.st_mode);
+    case 'd':
+        return S_ISDIR(st.st_mode);
+    case 'f':
+        return S_ISREG(st.st_mode);
+    case 'p':
+        return S_ISFIFO(st.st_mode);
+    case 'S':
+        return S_ISSOCK(st.st_mode);
+    case 's':
+        return st.st_size > 0;
+    case 'g':
+        return (st.st_mode & S_ISGID) != 0;
+    case 'u':
+        return (st.st_mode & S_ISUID) != 0;
+    case 'k':
+        return (st.st_mode & S_ISVTX) != 0;
+    case 'O':
+        return st.st_uid == geteuid();
+    case 'G':
+        return st.st_gid == getegid();
+    }
+    return 1; // -e
+}
+
+// Evaluate a binary string, integer or file comparison
+static int test_binary(struct test_state *state, const char *left, const char *op, const char *right)
+{
+    long long a, b;
+    struct stat left_st, right_st;
+
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+        return strcmp(left, right) == 0;
+    if (strcmp(op, "!=") == 0)
+        return strcmp(left, right) != 0;
+    if (strcmp(op, "<") == 0)
+        return strcmp(left, right) < 0;
+    if (strcmp(op, ">") == 0)
+        return strcmp(left, right) > 0;
+
+    if (strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0 || strcmp(op, "-ef") == 0)
+    {
+        int have_left = stat(left, &left_st) == 0, have_right = stat(right, &right_st) == 0;
+
+        if (op[1] == 'e')
+            return have_left && have_right && left_st.st_dev == right_st.st_dev && left_st.st_ino == right_st.st_ino;
+        if (op[1] == 'o')
+        { // Older, or the newer one being the only one that exists
+            struct stat swap = left_st;
+            int have = have_left;
+
+            left_st = right_st;
+            right_st = swap;
+            have_left = have_right;
+            have_right = have;
+        }
+        if (!have_left)
+            return 0;
+        if (!have_right)
+            return 1;
+        return left_st.st_mtim.tv_sec > right_st.st_mtim.tv_sec ||
+               (left_st.st_mtim.tv_sec == right_st.st_mtim.tv_sec && left_st.st_mtim.tv_nsec > right_st.st_mtim.tv_nsec);
+    }
+
+    if (test_integer(state, left, &a) == -1 || test_integer(state, right, &b) == -1)
+        return 0;
+    if (strcmp(op, "-eq") == 0)
+        return a == b;
+    if (strcmp(op, "-ne") == 0)
+        return a != b;
+    if (strcmp(op, "-lt") == 0)
+        return a < b;
+    if (strcmp(op, "-le") == 0)
+        return a <= b;
+    if (strcmp(op, "-gt") == 0)
+        return a > b;
+    return a >= b;
+}
+
+static const char *test_next(struct test_state *state)
+{
+    return state->position < state->count ? state->args[state->position] : NULL;
+}
+
+// primary: '(' expression ')' | unary-op operand | operand binary-op operand | operand
+static int test_primary(struct test_state *state)
+{
+    const char *arg = test_next(state);
+    int remaining = state->count - state->position;
+
+    if (arg == NULL)
+    {
+        message(stderr, TEST_ARGUMENT_EXPECTED_MESSAGE);
+        state->error = 1;
+        return 0;
+    }
+    if (remaining >= 3 && is_binary_test(state->args[state->position + 1]))
+    {
+        state->position += 3;
+        return test_binary(state, arg, state->args[state->position - 2], state->args[state->position - 1]);
+    }
+    if (strcmp(arg, "(") == 0 && remaining >= 2)
+    {
+        int result;
+
+        state->position++;
+        result = test_expression(state);
+        if (test_next(state) == NULL || strcmp(test_next(state), ")") != 0)
+        {
+            message(stderr, TEST_MISSING_PAREN_MESSAGE);
+            state->error = 1;
+            return 0;
+        }
+        state->position++;
+        return result;
+    }
+    if (is_unary_test(arg) && remaining >= 2)
+    {
+        state->position += 2;
+        return test_unary(arg[1], state->args[state->position - 1]);
+    }
+    state->position++;
+    return arg[0] != '\0';
+}
+
+// not: '!' not | primary
+static int test_not(struct test_state *state)
+{
+    const char *arg = test_next(state);
+
+    if (arg && strcmp(arg, "!") == 0 && state->count - state->position > 1)
+    {
+        state->position++;
+        return !test_not(state);
+    }
+    return test_primary(state);
+}
+
+// and: not ('-a' not)*
+static int test_and(struct test_state *state)
+{
+    int result = test_not(state);
+
+    while (test_next(state) && strcmp(test_next(state), "-a") == 0)
+    {
+        int right;
+
+        state->position++;
+        right = test_not(state);
+        result = result && right;
+    }
+    return result;
+}
+
+// expression: and ('-o' and)*
+static int test_expression(struct test_state *state)
+{
+    int result = test_and(state);
+
+    while (test_next(state) && strcmp(test_next(state), "-o") == 0)
+    {
+        int right;
+
+        state->position++;
+        right = test_and(state);
+        result = result || right;
+    }
+    return result;
+}
+
+// Function to implement 'test expr' and '[ expr ]'
+void builtin_test(char **args)
+{
+    struct test_state state = {args + 1, 0, 0, 0};
+    int result;
+
+    while (state.args[state.count] != NULL)
+        state.count++;
+    if (strcmp(args[0], "[") == 0)
+    {
+        if (state.count == 0 || strcmp(state.args[state.count - 1], "]") != 0)
+        {
+            message(stderr, TEST_MISSING_BRACKET_MESSAGE);
+            last_status = 2;
+            return;
+        }
+        state.count--;
+    }
+
+    // POSIX decides by the number of arguments up to four, so 'test -n' and 'test !' are strings
+    if (state.count == 0)
+        result = 0;
+    else if (state.count == 1)
+        result = state.args[0][0] != '\0';
+    else if (state.count == 2 && strcmp(state.args[0], "!") == 0)
+        result = state.args[1][0] == '\0';
+    else
+    {
+        result = test_expression(&state);
+        if (!state.error && state.position < state.count)
+        {
+            fprintf(stderr, "test: %s: unexpected argument\n", state.args[state.position]);
+            state.error = 1;
+        }
+    }
+    last_status = state.error ? 2 : !result;
+}
+
+// Function to implement 'true'
+void builtin_true(char **args)
+{
+    (void)args;
+    last_status = 0;
+}
+
+// Function to implement 'false'
+void builtin_false(char **args)
+{
+    (void)args;
+    last_status = 1;
+}
+
+// Function to implement 'pwd [-LP]'; the directory is always the physical one
+void builtin_pwd(char **args)
+{
+    char *directory = getcwd(NULL, 0);
+
+    (void)args;
+    if (!directory)
+    {
+        perror("pwd");
+        last_status = 1;
+        return;
+    }
+    printf("%s\n", directory);
+    free(directory);
+    check_output("pwd");
+}
+
+#define READ_BLOCK_SIZE 4096
+
+// Read one line of standard input, without the newline, into a malloc'ed string; complete
+// tells whether the newline was there. Returns -1 at end of input or on an error.
+static int read_line(char **line, int *complete)
+{
+    size_t length = 0, capacity = READ_BLOCK_SIZE;
+    off_t offset = lseek(STDIN_FILENO, 0, SEEK_CUR);
+    size_t chunk = offset == -1 ? 1 : READ_BLOCK_SIZE; // Only a seekable input can be over-read
+    char *buffer = malloc(capacity + 1);
+    ssize_t got;
+    int ended = 0;
+
+    if (!buffer)
+        return -1;
+    while (!ended && (got = read(STDIN_FILENO, buffer + length, chunk)) != 0)
+    {
+        char *newline;
+
+        if (got == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            free(buffer);
+            return -1;
+        }
+        newline = memchr(buffer + length, '\n', got);
+        if (newline)
+        {
+            got = newline - (buffer + length);
+            ended = 1;
+            if (offset != -1)
+                lseek(STDIN_FILENO, offset + length + got + 1, SEEK_SET);
+        }
+        length += got;
+        if (!ended && capacity - length < chunk)
+        {
+            char *grown = realloc(buffer, capacity * 2 + 1);
+
+            if (!grown)
+            {
+                free(buffer);
+                return -1;
+            }
+            buffer = grown;
+            capacity *= 2;
+        }
+    }
+    if (!ended && length == 0)
+    {
+        free(buffer);
+        return -1;
+    }
+    buffer[length] = '\0';
+    *line = buffer;
+    *complete = ended;
+    return 0;
+}
+
+// Cut the field at *src in place, up to a separator or, when it is the last, to the end
+// of the line less trailing separators. Without raw a backslash makes the next character
+// part of the field. Returns the field and leaves *src at the start of the next one.
+static char *read_field(char **src, const char *separators, int last, int raw)
+{
+    char *field = *src, *dst = *src, *end = *src;
+
+    while (**src && !(!last && strchr(separators, **src)))
+    {
+        int escaped = !raw && **src == '\\' && (*src)[1] != '\0';
+
+        *src += escaped;
+        *dst++ = **src;
+        if (escaped || !strchr(separators, **src))
+            end = dst;
+        (*src)++;
+    }
+    *src += strspn(*src, separators);
+    *end = '\0'; // At or before the separator or NUL that ended the field
+    return field;
+}
+
+// Function to implement 'read [-r] [name...]'; the names default to REPLY, and the last
+// one gets the rest of the line. Fields are separated by runs of the characters in $IFS.
+void builtin_read(char **args)
+{
+    static char *default_names[] = {"REPLY", NULL};
+    const char *separators = get_variable("IFS");
+    char **names = &args[1], *line, *next;
+    int raw = 0, complete;
+
+    if (*names && strcmp(*names, "-r") == 0)
+    {
+        raw = 1;
+        names++;
+    }
+    if (!*names)
+        names = default_names;
+    for (char **name = names; *name; name++)
+    {
+        if (variable_name_length(*name) != strlen(*name))
+        {
+            fprintf(stderr, READ_INVALID_NAME_MESSAGE, *name);
+            last_status = 2;
+            return;
+        }
+    }
+
+    fflush(stdout);
+    if (read_line(&line, &complete) == -1)
+    {
+        for (char **name = names; *name; name++)
+            set_variable(*name, strlen(*name), "", 0);
+        last_status = 1;
+        return;
+    }
+    if (!complete)
+        last_status = 1; // A last line without its newline is still assigned
+    if (!separators)
+        separators = " \t\n";
+
+    next = line + strspn(line, separators);
+    for (char **name = names; *name; name++)
+    {
+        const char *field = read_field(&next, separators, name[1] == NULL, raw);
+
+        if (set_variable(*name, strlen(*name), field, 0) == -1)
+        {
+            perror("read failed");
+            last_status = 1;
+        }
+    }
+    free(line);
+}
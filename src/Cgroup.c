@@ -0,0 +1,338 @@
+/**
+ * @file Cgroup.c
+ * @brief Optional cgroup v2 leaves, one per job, for accounting and throttling.
+ *
+ * With MYSH_CGROUP exported, every job in the job table gets a cgroup of its own, so the
+ * CPU, memory and I/O of concurrent jobs can be told apart and limited one by one.
+ * MYSH_CGROUP=1 places the leaves under the shell's own cgroup (found through
+ * /proc/self/cgroup and the cgroup2 mount), and MYSH_CGROUP=<dir> under that cgroup v2
+ * directory, which should be a delegated one. At startup the shell creates mysh.<pid>
+ * there, and each job then gets a leaf job-<n> in it, removed again when the job is freed.
+ *
+ * The shell enables the cpu, memory and io controllers for the leaves where the kernel
+ * allows it. A cgroup with processes of its own cannot hand controllers to its children,
+ * so with MYSH_CGROUP=1 only cpu.stat is usually kept, unless the shell runs in a root or
+ * delegated cgroup; memory.peak, io.stat and the limits need the controllers.
+ *
+ * A process starts in its job's leaf through clone3() with CLONE_INTO_CGROUP, so it is
+ * accounted there from its first instruction. posix_spawn cannot do that, so jobs then
+ * take the fork path (Spawn.c). Where clone3() is missing, the child moves itself by
+ * writing to cgroup.procs. A forked subshell does the latter too, and then creates no
+ * leaves of its own: the jobs it starts stay in its leaf and are counted with it.
+ *
+ * 'jobs -l' shows what each leaf has used (cpu.stat, memory.peak, io.stat). 'cglimit'
+ * and the '@cpu.max=' and '@memory.max=' prefixes (Limits.c) write cpu.max and
+ * memory.max, which throttle the whole job.
+ */
+
+#include <linux/sched.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define CGROUP_PATH_MAX 4096
+#define CGROUP_CPU_PERIOD 100000 // Microseconds, the kernel's default period for cpu.max
+
+static int cgroup_base_fd = -1;    // The directory mysh.<pid> was created in
+static int cgroup_session_fd = -1; // mysh.<pid>, which holds the leaves
+static char cgroup_session_name[32];
+static pid_t cgroup_owner;
+static unsigned int cgroup_leaf_count; // Leaves created so far, which numbers the next one
+static int clone3_unsupported;
+
+int cgroup_enabled; // Jobs get a cgroup leaf of their own
+
+static const char *const cgroup_controllers[] = {"cpu", "memory", "io"};
+
+// Read the small file name of the cgroup directory fd into text; -1 when it cannot be read
+static ssize_t read_cgroup_file(int fd, const char *name, char *text, size_t size)
+{
+    int file = openat(fd, name, O_RDONLY | O_CLOEXEC);
+    ssize_t length;
+
+    if (file == -1)
+        return -1;
+    length = read(file, text, size - 1);
+    close(file);
+    if (length >= 0)
+        text[length] = '\0';
+    return length;
+}
+
+// Tell whether the space-separated list holds word
+static int has_word(const char *list, const char *word)
+{
+    size_t length = strlen(word);
+
+    for (const char *at = list; (at = strstr(at, word)) != NULL; at += length)
+    {
+        if ((at == list || at[-1] == ' ') && (at[length] == ' ' || at[length] == '\n' || at[length] == '\0'))
+            return 1;
+    }
+    return 0;
+}
+
+// Hand the controllers of cgroup_controllers that fd offers on to its children, as far
+// as the kernel allows
+static void enable_controllers(int fd)
+{
+    char available[256];
+    int control;
+
+    if (read_cgroup_file(fd, "cgroup.controllers", available, sizeof(available)) <= 0)
+        return;
+    control = openat(fd, "cgroup.subtree_control", O_WRONLY | O_CLOEXEC);
+    if (control == -1)
+        return;
+    for (size_t i = 0; i < sizeof(cgroup_controllers) / sizeof(cgroup_controllers[0]); i++)
+    {
+        char change[16];
+        int length = snprintf(change, sizeof(change), "+%s", cgroup_controllers[i]);
+
+        if (!has_word(available, cgroup_controllers[i]))
+            continue;
+        if (write(control, change, length) == -1)
+            continue; // Refused while the cgroup has processes of its own
+    }
+    close(control);
+}
+
+// Find the directory of the shell's own cgroup v2 into path; -1 when there is none
+static int own_cgroup_path(char *path, size_t size)
+{
+    char line[CGROUP_PATH_MAX], mount_point[CGROUP_PATH_MAX] = "";
+    FILE *file = fopen("/proc/self/mountinfo", "r");
+    int found = -1;
+
+    if (!file)
+        return -1;
+    while (fgets(line, sizeof(line), file))
+    {
+        if (strstr(line, " - cgroup2 ") && sscanf(line, "%*s %*s %*s %*s %4095s", mount_point) == 1)
+            break;
+    }
+    fclose(file);
+    if (mount_point[0] == '\0' || !(file = fopen("/proc/self/cgroup", "r")))
+        return -1;
+    while (fgets(line, sizeof(line), file))
+    {
+        if (strncmp(line, "0::", 3) == 0)
+        {
+            line[strcspn(line, "\n")] = '\0';
+            found = snprintf(path, size, "%s%s", mount_point, line + 3) < (int)size ? 0 : -1;
+            break;
+        }
+    }
+    fclose(file);
+    return found;
+}
+
+static void cgroup_remove_session()
+{
+    if (getpid() != cgroup_owner)
+        return; // A subshell exiting
+    close(cgroup_session_fd);
+    unlinkat(cgroup_base_fd, cgroup_session_name, AT_REMOVEDIR);
+}
+
+// Function to set up the shell's cgroup directory when $MYSH_CGROUP asks for job cgroups
+void cgroup_init()
+{
+    const char *mode = getenv("MYSH_CGROUP");
+    char base[CGROUP_PATH_MAX];
+
+    if (!mode || mode[0] == '\0' || strcmp(mode, "0") == 0)
+        return;
+    if (mode[0] == '/')
+        snprintf(base, sizeof(base), "%s", mode);
+    else if (strcmp(mode, "1") != 0 || own_cgroup_path(base, sizeof(base)) == -1)
+    {
+        fprintf(stderr, CGROUP_UNAVAILABLE_MESSAGE, mode);
+        return;
+    }
+
+    cgroup_base_fd = open(base, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    snprintf(cgroup_session_name, sizeof(cgroup_session_name), "mysh.%d", (int)getpid());
+    if (cgroup_base_fd == -1 || (mkdirat(cgroup_base_fd, cgroup_session_name, 0755) == -1 && errno != EEXIST) ||
+        (cgroup_session_fd = openat(cgroup_base_fd, cgroup_session_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1)
+    {
+        perror(base);
+        if (cgroup_base_fd != -1)
+            close(cgroup_base_fd);
+        cgroup_base_fd = -1;
+        return;
+    }
+    enable_controllers(cgroup_base_fd);
+    enable_controllers(cgroup_session_fd);
+    cgroup_owner = getpid();
+    cgroup_enabled = 1;
+    atexit(cgroup_remove_session);
+}
+
+// Function to create the cgroup leaf of a new job, numbered in *leaf. Returns its
+// directory descriptor, or -1 when job cgroups are off or it cannot be created.
+int cgroup_create_leaf(unsigned int *leaf)
+{
+    char name[32];
+    int fd;
+
+    if (!cgroup_enabled)
+        return -1;
+    *leaf = ++cgroup_leaf_count;
+    snprintf(name, sizeof(name), "job-%u", *leaf);
+    if (mkdirat(cgroup_session_fd, name, 0755) == -1 || (fd = openat(cgroup_session_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1)
+    {
+        perror("Job cgroup creation failed");
+        unlinkat(cgroup_session_fd, name, AT_REMOVEDIR);
+        return -1;
+    }
+    return fd;
+}
+
+// Function to close and remove the leaf of a job that is being freed; a leaf that still
+// holds processes is left in place
+void cgroup_remove_leaf(int fd, unsigned int leaf)
+{
+    char name[32];
+
+    if (fd == -1)
+        return;
+    close(fd);
+    if (!cgroup_enabled)
+        return; // A subshell's copy of the parent's job
+    snprintf(name, sizeof(name), "job-%u", leaf);
+    unlinkat(cgroup_session_fd, name, AT_REMOVEDIR);
+}
+
+// Function to fork a child that starts in the cgroup directory fd, through clone3().
+// Returns -1 when the kernel cannot, and the caller then forks as usual.
+pid_t cgroup_clone_into(int fd)
+{
+#if defined(CLONE_INTO_CGROUP) && defined(SYS_clone3)
+    struct clone_args args = {.flags = CLONE_INTO_CGROUP, .exit_signal = SIGCHLD, .cgroup = fd};
+    pid_t pid;
+
+    if (clone3_unsupported)
+        return -1;
+    pid = syscall(SYS_clone3, &args, sizeof(args));
+    if (pid == -1 && (errno == ENOSYS || errno == E2BIG || errno == EINVAL))
+        clone3_unsupported = 1;
+    return pid;
+#else
+    (void)fd;
+    return -1;
+#endif
+}
+
+// Function to move the calling process into the cgroup directory fd
+void cgroup_join(int fd)
+{
+    int procs = openat(fd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+
+    if (procs == -1)
+        return;
+    if (write(procs, "0", 1) == -1)
+        perror("Joining the job cgroup failed");
+    close(procs);
+}
+
+// Function to stop creating leaves in a forked subshell, whose jobs share its leaf
+void cgroup_after_fork()
+{
+    cgroup_enabled = 0;
+}
+
+// Function to tell whether name is a limit that 'cglimit' and the prefixes may set
+int cgroup_is_limit(const char *name)
+{
+    return strcmp(name, "cpu.max") == 0 || strcmp(name, "memory.max") == 0;
+}
+
+// Function to write value to the limit file name of the cgroup directory fd. cpu.max
+// also takes a share of one CPU such as '50%' or '200%', and memory.max the kernel's
+// sizes such as '512M'. Returns -1 after reporting a failure.
+int cgroup_set_limit(int fd, const char *name, const char *value)
+{
+    size_t length = strlen(value);
+    char text[64];
+    int file;
+
+    if (strcmp(name, "cpu.max") == 0 && length > 1 && value[length - 1] == '%')
+    {
+        char *end;
+        double percent = strtod(value, &end);
+
+        if (end != value + length - 1 || !(percent > 0 && percent < 1e6))
+        {
+            fprintf(stderr, CGROUP_BAD_LIMIT_MESSAGE, name, value);
+            return -1;
+        }
+        length = snprintf(text, sizeof(text), "%ld %d", (long)(percent * CGROUP_CPU_PERIOD / 100), CGROUP_CPU_PERIOD);
+        value = text;
+    }
+
+    file = openat(fd, name, O_WRONLY | O_CLOEXEC);
+    if (file == -1 || write(file, value, length) == -1)
+    {
+        if (errno == ENOENT)
+            fprintf(stderr, CGROUP_NO_CONTROLLER_MESSAGE, name);
+        else
+            perror(name);
+        if (file != -1)
+            close(file);
+        return -1;
+    }
+    close(file);
+    return 0;
+}
+
+// Read the number after 'key ' or 'key=' at the start of a line of text; 0 if there is none
+static unsigned long long stat_value(const char *text, const char *key)
+{
+    size_t length = strlen(key);
+    const char *line = text;
+
+    while (line)
+    {
+        if (strncmp(line, key, length) == 0 && (line[length] == ' ' || line[length] == '='))
+            return strtoull(line + length + 1, NULL, 10);
+        line = strchr(line, '\n');
+        if (line)
+            line++;
+    }
+    return 0;
+}
+
+// Add up key=<number> over every device line of io.stat
+static unsigned long long io_total(const char *text, const char *key)
+{
+    size_t length = strlen(key);
+    unsigned long long total = 0;
+
+    for (const char *at = text; (at = strstr(at, key)) != NULL; at += length)
+    {
+        if (at > text && at[-1] == ' ' && at[length] == '=')
+            total += strtoull(at + length + 1, NULL, 10);
+    }
+    return total;
+}
+
+// Function to print what the job in the cgroup directory fd has used, for 'jobs -l', and
+// the limits set on it. Files the enabled controllers do not provide are left out.
+void cgroup_print_usage(int fd)
+{
+    char text[4096];
+
+    printf("     ");
+    if (read_cgroup_file(fd, "cpu.stat", text, sizeof(text)) > 0)
+        printf(" cpu.stat usage=%.3fs user=%.3fs system=%.3fs", stat_value(text, "usage_usec") / 1e6,
+               stat_value(text, "user_usec") / 1e6, stat_value(text, "system_usec") / 1e6);
+    if (read_cgroup_file(fd, "memory.peak", text, sizeof(text)) > 0)
+        printf(" memory.peak=%llu", strtoull(text, NULL, 10));
+    if (read_cgroup_file(fd, "io.stat", text, sizeof(text)) >= 0)
+        printf(" io.stat rbytes=%llu wbytes=%llu", io_total(text, "rbytes"), io_total(text, "wbytes"));
+    if (read_cgroup_file(fd, "cpu.max", text, sizeof(text)) > 0 && strncmp(text, "max ", 4) != 0)
+        printf(" cpu.max=%.*s", (int)strcspn(text, "\n"), text);
+    if (read_cgroup_file(fd, "memory.max", text, sizeof(text)) > 0 && strncmp(text, "max", 3) != 0)
+        printf(" memory.max=%.*s", (int)strcspn(text, "\n"), text);
+    printf("\n");
+}
@@ -0,0 +1,232 @@
+/**
+ * @file CommandHash.c
+ * @brief Remembered command locations, in the style of the POSIX `hash` utility.
+ *
+ * execvp() finds a command by trying execve() in every $PATH directory until one
+ * succeeds. The shell resolves the name itself once, remembers the absolute path in a
+ * chained hash table keyed by command name, and later launches exec that path directly.
+ *
+ * The table is flushed when $PATH changes. An entry whose file has disappeared is
+ * dropped by forget_command_path() when the launch fails with ENOENT, and the caller
+ * looks the name up again.
+ */
+
+#include <sys/stat.h>
+
+#define COMMAND_HASH_SIZE 256
+#define DEFAULT_COMMAND_PATH "/bin:/usr/bin"
+
+struct command_hash_entry
+{
+    char *name;
+    char *path;
+    unsigned int hits;
+    struct command_hash_entry *next;
+};
+
+static struct command_hash_entry *command_hash_table[COMMAND_HASH_SIZE];
+static char *command_hash_search_path; // $PATH the table was filled against
+static char *uncached_command_path;    // Last result that was not remembered
+
+// Function to hash a NUL-terminated string (FNV-1a)
+unsigned long hash_string(const char *text)
+{
+    unsigned long hash = 2166136261UL;
+
+    while (*text)
+    {
+        hash ^= (unsigned char)*text++;
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+// Function to forget every remembered command location
+void flush_command_hash()
+{
+    for (int i = 0; i < COMMAND_HASH_SIZE; i++)
+    {
+        struct command_hash_entry *entry = command_hash_table[i];
+
+        while (entry)
+        {
+            struct command_hash_entry *next = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+            entry = next;
+        }
+        command_hash_table[i] = NULL;
+    }
+}
+
+static const char *current_search_path()
+{
+    const char *path = get_variable("PATH");
+    return path ? path : DEFAULT_COMMAND_PATH;
+}
+
+// Flush the table if $PATH no longer matches the value it was filled against
+static void check_search_path()
+{
+    const char *path = current_search_path();
+
+    if (command_hash_search_path && strcmp(command_hash_search_path, path) == 0)
+        return;
+
+    flush_command_hash();
+    free(command_hash_search_path);
+    command_hash_search_path = strdup(path);
+}
+
+// Search $PATH the same way execvp does; returns a malloc'ed path or NULL
+static char *search_command_path(const char *name)
+{
+    const char *dir = current_search_path();
+    size_t name_length = strlen(name);
+
+    while (1)
+    {
+        const char *end = strchr(dir, ':');
+        size_t dir_length = end ? (size_t)(end - dir) : strlen(dir);
+        char *candidate = malloc(dir_length + name_length + 3);
+        struct stat st;
+
+        if (!candidate)
+            return NULL;
+        if (dir_length == 0)
+        { // An empty entry means the current directory
+            sprintf(candidate, "./%s", name);
+        }
+        else
+        {
+            memcpy(candidate, dir, dir_length);
+            candidate[dir_length] = '/';
+            strcpy(candidate + dir_length + 1, name);
+        }
+        if (stat(candidate, &st) == 0 && S_ISREG(st.st_mode) && access(candidate, X_OK) == 0)
+            return candidate;
+        free(candidate);
+
+        if (!end)
+            return NULL;
+        dir = end + 1;
+    }
+}
+
+static struct command_hash_entry *find_command_entry(const char *name, unsigned long bucket)
+{
+    for (struct command_hash_entry *entry = command_hash_table[bucket]; entry; entry = entry->next)
+    {
+        if (strcmp(entry->name, name) == 0)
+            return entry;
+    }
+    return NULL;
+}
+
+// Function to resolve a command name to the path that should be exec'ed, or NULL if not found.
+// The result stays valid until the next lookup or flush.
+const char *lookup_command_path(const char *name)
+{
+    unsigned long bucket;
+    struct command_hash_entry *entry;
+    char *path;
+
+    if (strchr(name, '/'))
+        return name; // Explicit paths bypass the search
+
+    check_search_path();
+    bucket = hash_string(name) % COMMAND_HASH_SIZE;
+    entry = find_command_entry(name, bucket);
+    if (entry)
+    {
+        entry->hits++;
+        return entry->path;
+    }
+
+    path = search_command_path(name);
+    entry = path && path[0] == '/' ? malloc(sizeof(*entry)) : NULL;
+    if (!entry)
+    { // Relative $PATH entries depend on the working directory; never remember them
+        free(uncached_command_path);
+        uncached_command_path = path;
+        return path;
+    }
+    entry->name = strdup(name);
+    entry->path = path;
+    entry->hits = 1;
+    entry->next = command_hash_table[bucket];
+    command_hash_table[bucket] = entry;
+    return entry->path;
+}
+
+// Function to drop a remembered location after its file turned out to be missing
+int forget_command_path(const char *name)
+{
+    struct command_hash_entry **link = &command_hash_table[hash_string(name) % COMMAND_HASH_SIZE];
+
+    for (; *link; link = &(*link)->next)
+    {
+        if (strcmp((*link)->name, name) == 0)
+        {
+            struct command_hash_entry *entry = *link;
+            *link = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Function to implement the 'hash' builtin: list, flush (-r) or add entries
+void builtin_hash(char **args)
+{
+    if (args[1] == NULL)
+    {
+        int empty = 1;
+
+        for (int i = 0; i < COMMAND_HASH_SIZE; i++)
+        {
+            for (struct command_hash_entry *entry = command_hash_table[i]; entry; entry = entry->next)
+            {
+                if (empty)
+                    printf("hits\tcommand\n");
+                printf("%4u\t%s\n", entry->hits, entry->path);
+                empty = 0;
+            }
+        }
+        if (empty)
+            message(stderr, HASH_TABLE_EMPTY_MESSAGE);
+        return;
+    }
+
+    for (int i = 1; args[i] != NULL; i++)
+    {
+        if (strcmp(args[i], "-r") == 0)
+        {
+            flush_command_hash();
+            continue;
+        }
+
+        if (strchr(args[i], '/'))
+            continue;
+
+        check_search_path();
+        if (!find_command_entry(args[i], hash_string(args[i]) % COMMAND_HASH_SIZE))
+        {
+            struct command_hash_entry *entry;
+
+            if (!lookup_command_path(args[i]))
+            {
+                fprintf(stderr, "hash: %s: not found\n", args[i]);
+                continue;
+            }
+            // Adding a name with 'hash' does not count as a use
+            entry = find_command_entry(args[i], hash_string(args[i]) % COMMAND_HASH_SIZE);
+            if (entry)
+                entry->hits = 0;
+        }
+    }
+}
@@ -0,0 +1,362 @@
+/**
+ * @file Completion.c
+ * @brief Tab completion of command names and file names for the line editor.
+ *
+ * Command names come from a prefix trie holding the builtins and every executable in the
+ * $PATH directories the command hash resolves against (current_search_path()). The trie
+ * is not rebuilt on each Tab. Every $PATH directory remembers its device, inode and
+ * mtime together with the names it added, and a Tab only stats the directories: one
+ * whose mtime moved has its old names taken out of the trie and its new listing put in.
+ * A node counts the names below it, so names removed that way simply stop matching. A
+ * different $PATH replaces the directories altogether.
+ *
+ * File names come from the listing cache of pathname expansion (Glob.c), so completing
+ * in a directory a pattern has just read, or completing twice in a row, does not read
+ * it again.
+ *
+ * complete_word() returns the candidates for the word before the cursor, sorted; the
+ * editor inserts their longest common prefix and lists them when asked.
+ */
+
+const char *builtin_name(size_t index);
+
+#define COMPLETION_ESCAPED_CHARS " \t\n'\"\\|&;<>()$`*?[]#"
+
+struct trie_node
+{
+    unsigned char c;
+    int child;   // First child, 0 for none; siblings are sorted by c
+    int sibling; // Next sibling, 0 for none
+    int ends;    // Sources (the builtins, a $PATH directory) that have the name ending here
+    int live;    // Names ending in this subtree, counting every source
+};
+
+struct path_directory
+{
+    char *path;
+    dev_t device;
+    ino_t inode;
+    struct timespec mtime;
+    int scanned;
+    char *names; // The executables added to the trie, NUL-terminated, back to back
+    size_t names_size;
+};
+
+struct completion
+{
+    size_t typed; // Length of the part every candidate starts with, as typed without backslashes
+    char **candidates;
+    int count;
+    int capacity;
+    int is_command; // Command names get a space after a unique match
+};
+
+static struct trie_node *command_trie; // Node 0 is the root
+static int command_trie_count;
+static int command_trie_capacity;
+static struct path_directory *path_directories;
+static int path_directory_count;
+static char *completion_search_path; // $PATH path_directories were made from
+
+static int new_trie_node(unsigned char c)
+{
+    if (command_trie_count == command_trie_capacity)
+    {
+        int capacity = command_trie_capacity ? command_trie_capacity * 2 : 1024;
+        struct trie_node *grown = realloc(command_trie, capacity * sizeof(*grown));
+
+        if (!grown)
+            return -1;
+        command_trie = grown;
+        command_trie_capacity = capacity;
+    }
+    memset(&command_trie[command_trie_count], 0, sizeof(*command_trie));
+    command_trie[command_trie_count].c = c;
+    return command_trie_count++;
+}
+
+// Find the child of node for c, adding it when create is set; -1 when there is none
+static int trie_child(int node, unsigned char c, int create)
+{
+    int *link = &command_trie[node].child;
+    int child;
+
+    while (*link && command_trie[*link].c < c)
+        link = &command_trie[*link].sibling;
+    if (*link && command_trie[*link].c == c)
+        return *link;
+    if (!create)
+        return -1;
+
+    child = new_trie_node(c); // May move command_trie, so link is found again below
+    if (child == -1)
+        return -1;
+    link = &command_trie[node].child;
+    while (*link && command_trie[*link].c < c)
+        link = &command_trie[*link].sibling;
+    command_trie[child].sibling = *link;
+    *link = child;
+    return child;
+}
+
+// Add (change 1) or remove (change -1) one source of name
+static void trie_update(const char *name, int change)
+{
+    int path[NAME_MAX + 1], depth = 0, node = 0;
+
+    if (strlen(name) > NAME_MAX)
+        return;
+    for (const char *c = name; *c; c++)
+    {
+        node = trie_child(node, (unsigned char)*c, change > 0);
+        if (node == -1)
+            return;
+        path[depth++] = node;
+    }
+    if (change < 0 && command_trie[node].ends == 0)
+        return;
+    command_trie[node].ends += change;
+    command_trie[0].live += change;
+    for (int i = 0; i < depth; i++)
+        command_trie[path[i]].live += change;
+}
+
+static void forget_path_directory(struct path_directory *directory)
+{
+    for (size_t offset = 0; offset < directory->names_size; offset += strlen(directory->names + offset) + 1)
+        trie_update(directory->names + offset, -1);
+    free(directory->names);
+    directory->names = NULL;
+    directory->names_size = 0;
+    directory->scanned = 0;
+}
+
+// Put the executables of a $PATH directory into the trie, replacing what it added before
+static void scan_path_directory(struct path_directory *directory, const struct stat *status)
+{
+    struct glob_directory listing = {0};
+    const char *name;
+    int fd;
+
+    forget_path_directory(directory);
+    directory->device = status->st_dev;
+    directory->inode = status->st_ino;
+    directory->mtime = status->st_mtim;
+    directory->scanned = 1;
+    fd = open(directory->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1 || read_directory(directory->path, &listing) == -1)
+    {
+        if (fd != -1)
+            close(fd);
+        release_directory(&listing);
+        return;
+    }
+
+    directory->names = malloc(listing.names_size ? listing.names_size : 1);
+    name = listing.names;
+    for (int i = 0; directory->names && i < listing.count; i++, name += strlen(name) + 1)
+    {
+        struct stat entry;
+        size_t length = strlen(name) + 1;
+
+        if (listing.types[i] == DT_DIR || fstatat(fd, name, &entry, 0) == -1 || !S_ISREG(entry.st_mode) || !(entry.st_mode & 0111))
+            continue;
+        memcpy(directory->names + directory->names_size, name, length);
+        directory->names_size += length;
+        trie_update(name, 1);
+    }
+    close(fd);
+    release_directory(&listing);
+}
+
+// Bring the trie up to date with $PATH, scanning only the directories that changed
+static void refresh_command_trie()
+{
+    const char *search_path = current_search_path();
+    struct stat status;
+
+    if (command_trie_count == 0)
+    {
+        if (new_trie_node(0) == -1)
+            return;
+        for (size_t i = 0; builtin_name(i); i++)
+            trie_update(builtin_name(i), 1);
+    }
+
+    if (!completion_search_path || strcmp(completion_search_path, search_path) != 0)
+    {
+        for (int i = 0; i < path_directory_count; i++)
+        {
+            forget_path_directory(&path_directories[i]);
+            free(path_directories[i].path);
+        }
+        free(path_directories);
+        path_directories = NULL;
+        path_directory_count = 0;
+        free(completion_search_path);
+        completion_search_path = strdup(search_path);
+
+        for (const char *dir = search_path; dir;)
+        {
+            const char *end = strchr(dir, ':');
+            size_t length = end ? (size_t)(end - dir) : strlen(dir);
+            struct path_directory *grown;
+
+            if (length > 0 && dir[0] == '/' && (grown = realloc(path_directories, (path_directory_count + 1) * sizeof(*grown))))
+            { // Relative entries depend on the working directory and are left out
+                path_directories = grown;
+                memset(&path_directories[path_directory_count], 0, sizeof(*path_directories));
+                path_directories[path_directory_count].path = strndup(dir, length);
+                if (path_directories[path_directory_count].path)
+                    path_directory_count++;
+            }
+            dir = end ? end + 1 : NULL;
+        }
+    }
+
+    for (int i = 0; i < path_directory_count; i++)
+    {
+        struct path_directory *directory = &path_directories[i];
+
+        if (stat(directory->path, &status) == -1)
+            forget_path_directory(directory);
+        else if (!directory->scanned || status.st_dev != directory->device || status.st_ino != directory->inode ||
+                 status.st_mtim.tv_sec != directory->mtime.tv_sec || status.st_mtim.tv_nsec != directory->mtime.tv_nsec)
+            scan_path_directory(directory, &status);
+    }
+}
+
+static int add_candidate(struct completion *completion, const char *text, size_t length, int slash)
+{
+    char *copy;
+
+    if (completion->count == completion->capacity)
+    {
+        int capacity = completion->capacity ? completion->capacity * 2 : 32;
+        char **grown = realloc(completion->candidates, capacity * sizeof(*grown));
+
+        if (!grown)
+            return -1;
+        completion->candidates = grown;
+        completion->capacity = capacity;
+    }
+    copy = malloc(length + 2);
+    if (!copy)
+        return -1;
+    memcpy(copy, text, length);
+    copy[length] = '/';
+    copy[length + slash] = '\0';
+    completion->candidates[completion->count++] = copy;
+    return 0;
+}
+
+// Add every name in the subtree of node, name[0..length) leading to it, in sorted order
+static int collect_commands(struct completion *completion, int node, char *name, size_t length)
+{
+    if (command_trie[node].ends > 0 && add_candidate(completion, name, length, 0) == -1)
+        return -1;
+    for (int child = command_trie[node].child; child; child = command_trie[child].sibling)
+    {
+        if (command_trie[child].live <= 0 || length + 1 >= NAME_MAX)
+            continue;
+        name[length] = command_trie[child].c;
+        if (collect_commands(completion, child, name, length + 1) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+static int complete_command(struct completion *completion, const char *prefix)
+{
+    char name[NAME_MAX + 1];
+    int node = 0;
+
+    refresh_command_trie();
+    if (command_trie_count == 0)
+        return 0;
+    for (const char *c = prefix; *c && node != -1; c++)
+        node = trie_child(node, (unsigned char)*c, 0);
+    if (node == -1 || command_trie[node].live <= 0 || strlen(prefix) >= NAME_MAX)
+        return 0;
+    strcpy(name, prefix);
+    return collect_commands(completion, node, name, strlen(prefix));
+}
+
+static int compare_candidates(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Complete word as a path: the entries of its directory that start with its last component
+static int complete_file(struct completion *completion, const char *word)
+{
+    const char *slash = strrchr(word, '/');
+    const char *base = slash ? slash + 1 : word;
+    size_t directory_length = base - word, base_length = strlen(base);
+    char path[PATH_MAX];
+    struct glob_directory scratch = {0}, *directory;
+    const char *name;
+    int result = 0;
+
+    if (directory_length + NAME_MAX + 2 > sizeof(path))
+        return 0;
+    memcpy(path, word, directory_length);
+    path[directory_length] = '\0';
+    glob_begin();
+    directory = find_directory(directory_length ? path : ".", &scratch);
+    if (!directory)
+        return 0;
+
+    name = directory->names;
+    for (int i = 0; i < directory->count && result == 0; i++, name += strlen(name) + 1)
+    {
+        if (strncmp(name, base, base_length) != 0 || (name[0] == '.' && base[0] != '.'))
+            continue;
+        strcpy(path + directory_length, name);
+        result = add_candidate(completion, name, strlen(name), is_directory(path, directory->types[i]));
+    }
+    if (directory == &scratch)
+        release_directory(&scratch);
+    qsort(completion->candidates, completion->count, sizeof(*completion->candidates), compare_candidates);
+    return result;
+}
+
+// Function to release the candidates of a completion
+void free_completion(struct completion *completion)
+{
+    for (int i = 0; i < completion->count; i++)
+        free(completion->candidates[i]);
+    free(completion->candidates);
+    memset(completion, 0, sizeof(*completion));
+}
+
+// Function to find the candidates for the word that ends at cursor in line; returns -1 when
+// memory runs out. Candidates are whole command names or the last component of a path.
+int complete_word(const char *line, size_t cursor, struct completion *completion)
+{
+    char word[PATH_MAX];
+    size_t start = cursor, length = 0, previous;
+    const char *slash;
+
+    memset(completion, 0, sizeof(*completion));
+    while (start > 0 && !(strchr(" \t|&;<>()", line[start - 1]) && (start < 2 || line[start - 2] != '\\')))
+        start--;
+    for (size_t i = start; i < cursor && length + 1 < sizeof(word); i++)
+    {
+        if (line[i] == '\\' && i + 1 < cursor)
+            i++;
+        word[length++] = line[i];
+    }
+    word[length] = '\0';
+
+    previous = start;
+    while (previous > 0 && (line[previous - 1] == ' ' || line[previous - 1] == '\t'))
+        previous--;
+    completion->is_command = !strchr(word, '/') && (previous == 0 || strchr("|&;(", line[previous - 1]));
+
+    slash = strrchr(word, '/');
+    completion->typed = slash ? strlen(slash + 1) : length;
+    if (completion->is_command)
+        return complete_command(completion, word);
+    return complete_file(completion, word);
+}
@@ -3,5 +3,39 @@
 
 const char *SYNTAX_ERROR_LESS_THAN_MESSAGE = "Syntax error: expected input file after '<'\n";
 const char *SYNTAX_ERROR_GREATER_THAN_MESSAGE = "Syntax error: expected output file after '>'\n";
+const char *SYNTAX_ERROR_UNEXPECTED_TOKEN_MESSAGE = "Syntax error: unexpected '%s'\n";
+const char *SYNTAX_ERROR_UNEXPECTED_WORD_MESSAGE = "Syntax error: unexpected '%.*s'\n";
+const char *SYNTAX_ERROR_UNTERMINATED_QUOTE_MESSAGE = "Syntax error: unterminated quote or substitution\n";
+const char *SYNTAX_ERROR_BAD_FD_MESSAGE = "Syntax error: '%s' is not a file descriptor\n";
+const char *TOO_MANY_REDIRECTIONS_MESSAGE = "Too many redirections\n";
 const char *MISSING_ARGUMENT_MESSAGE = "cd: missing argument\n";
 const char *No_COMMAND_FOUND_MESSAGE = "No such command in history\n";
+const char *HASH_TABLE_EMPTY_MESSAGE = "hash: hash table empty\n";
+const char *HISTORY_SEARCH_MISSING_ARGUMENT_MESSAGE = "history: -s: missing search text\n";
+const char *PRINTF_USAGE_MESSAGE = "printf: usage: printf format [arguments]\n";
+const char *TEST_ARGUMENT_EXPECTED_MESSAGE = "test: argument expected\n";
+const char *TEST_MISSING_PAREN_MESSAGE = "test: missing ')'\n";
+const char *TEST_MISSING_BRACKET_MESSAGE = "[: missing ']'\n";
+const char *PARALLEL_USAGE_MESSAGE = "parallel: usage: parallel [-j N] [-g] [-k] command [args...] [::: inputs...]\n";
+const char *COPROC_USAGE_MESSAGE = "coproc: usage: coproc [-n NAME] command [args...] | coproc -c NAME\n";
+const char *COPROC_RUNNING_MESSAGE = "coproc: %s is already running\n";
+const char *COPROC_NOT_FOUND_MESSAGE = "coproc: %s: no such coprocess\n";
+const char *REDIRECT_BAD_TARGET_MESSAGE = "%s: not a file descriptor or an open coprocess\n";
+const char *READ_INVALID_NAME_MESSAGE = "read: '%s': not a valid identifier\n";
+const char *EXPORT_INVALID_NAME_MESSAGE = "export: '%s': not a valid identifier\n";
+const char *UNSET_INVALID_NAME_MESSAGE = "unset: '%s': not a valid identifier\n";
+const char *KILL_USAGE_MESSAGE = "kill: usage: kill [-SIGNAL] %job|pid...\n";
+const char *NUMERIC_ARGUMENT_MESSAGE = "%s: %s: numeric argument required\n";
+const char *LOOP_ONLY_MESSAGE = "%s: only meaningful in a loop\n";
+const char *LOOP_COUNT_MESSAGE = "%s: loop count out of range\n";
+const char *RETURN_OUTSIDE_FUNCTION_MESSAGE = "return: can only return from a function\n";
+const char *SHIFT_COUNT_MESSAGE = "shift: %ld: shift count out of range\n";
+const char *FUNCTION_NESTING_MESSAGE = "%s: maximum function nesting level exceeded\n";
+const char *SCRIPT_SYNTAX_ERROR_LINE_MESSAGE = "%s: line %d: syntax error\n";
+const char *LIMIT_BAD_VALUE_MESSAGE = "%s: invalid CPU list, nice value or size\n";
+const char *CGROUP_UNAVAILABLE_MESSAGE = "MYSH_CGROUP=%s: no cgroup v2 directory to create job cgroups in\n";
+const char *CGROUP_BAD_LIMIT_MESSAGE = "%s: invalid limit '%s'\n";
+const char *CGROUP_NO_CONTROLLER_MESSAGE = "%s: its controller is not enabled for job cgroups\n";
+const char *CGROUP_OFF_MESSAGE = "%s: job cgroups are off; export MYSH_CGROUP to use them\n";
+const char *CGLIMIT_USAGE_MESSAGE = "cglimit: usage: cglimit [%job] cpu.max=VALUE|memory.max=VALUE...\n";
+const char *USAGE_MESSAGE = "Usage: mysh [-e] [-c command [name [args...]] | script [args...]]\n";
@@ -0,0 +1,424 @@
+/**
+ * @file Control.c
+ * @brief Compound commands and functions, run by walking their AST inside the shell.
+ *
+ * execute_compound() runs what Parser.c builds for 'if', 'while', 'until', 'for', '{ ... }',
+ * '( ... )' and 'name() command'. It walks the tree and runs each part with execute_list(),
+ * exactly as a line is run, so a loop has no process of its own: a body made of builtins,
+ * assignments, function calls and other compound commands runs entirely in the shell, with
+ * no fork per iteration, and only external commands start processes. Words are expanded
+ * each time they are reached, so a loop sees the variables its body sets. Only '( ... )'
+ * forks, once, for the subshell it asks for.
+ *
+ * 'break [n]', 'continue [n]' and 'return [n]' unwind nothing themselves. They set
+ * pending_control, which stops execute_list(), and each loop uses up the levels that are
+ * its own on the way out (loop_must_stop()). A 'break' outside a loop, or a 'return'
+ * outside a function, is reported and does nothing. A loop in a function cannot be left
+ * by a 'break' in the function it calls.
+ *
+ * Defining a function copies its body out of the line's arena into a block of its own,
+ * laid out by ParseCache.c, since the function outlives the line. A call runs the body with
+ * the arguments as the positional parameters and then puts the caller's back. A function
+ * redefined or unset while it runs is freed when its last call returns. Functions are
+ * found before builtins, as in other shells, and calls nest at most FUNCTION_MAX_DEPTH deep.
+ *
+ * In an interactive shell, CTRL+C during a loop of builtins reaches the shell rather than a
+ * job. Loops look for it through the signalfd after every iteration and stop the line.
+ */
+
+#define FUNCTION_BUCKETS 64
+#define FUNCTION_MAX_DEPTH 1000
+
+enum control_flow
+{
+    CONTROL_NONE,
+    CONTROL_BREAK,
+    CONTROL_CONTINUE,
+    CONTROL_RETURN
+};
+
+struct function
+{
+    char *name;
+    struct command_list body; // Inside block
+    void *block;
+    int calls;   // Calls running, which the block must outlive
+    int defined; // Still in the table; cleared once it is redefined or unset
+    struct function *next;
+};
+
+static struct function *function_table[FUNCTION_BUCKETS];
+static int function_count;
+static int function_depth; // Function calls running
+static int loop_depth;     // Loops running in the innermost function call, or outside any
+static int control_levels; // Loops a pending 'break' or 'continue' still has to leave
+
+enum control_flow pending_control; // Set by 'break', 'continue' and 'return' until it is used up
+
+static struct function **find_function_slot(const char *name)
+{
+    struct function **slot = &function_table[hash_name(name, strlen(name)) & (FUNCTION_BUCKETS - 1)];
+
+    while (*slot && strcmp((*slot)->name, name) != 0)
+        slot = &(*slot)->next;
+    return slot;
+}
+
+// Function to find the function called name; NULL if there is none
+struct function *find_function(const char *name)
+{
+    return function_count > 0 ? *find_function_slot(name) : NULL;
+}
+
+// Take a function out of use, freeing it unless a call of it is still running
+static void retire_function(struct function *function)
+{
+    function->defined = 0;
+    if (function->calls > 0)
+        return;
+    free(function->name);
+    free(function->block);
+    free(function);
+}
+
+// Function to remove the function called name; nothing happens when there is none
+void unset_function(const char *name)
+{
+    struct function **slot = find_function_slot(name);
+    struct function *function = *slot;
+
+    if (!function)
+        return;
+    *slot = function->next;
+    function_count--;
+    retire_function(function);
+}
+
+static void define_function(const struct compound *compound)
+{
+    struct function *function = calloc(1, sizeof(*function));
+    size_t aligned, size = pipelines_size(compound->body.pipelines, compound->body.count, &aligned);
+    struct function **slot;
+
+    if (function)
+    {
+        function->name = strdup(compound->name);
+        function->block = malloc(size);
+    }
+    if (!function || !function->name || !function->block)
+    {
+        perror("Function definition failed");
+        if (function)
+        {
+            free(function->name);
+            free(function->block);
+        }
+        free(function);
+        last_status = 1;
+        return;
+    }
+    function->body.pipelines = copy_pipelines(compound->body.pipelines, compound->body.count, function->block, aligned);
+    function->body.count = compound->body.count;
+    function->defined = 1;
+
+    slot = find_function_slot(compound->name);
+    if (*slot)
+    {
+        struct function *old = *slot;
+
+        function->next = old->next;
+        *slot = function;
+        retire_function(old);
+    }
+    else
+    {
+        *slot = function;
+        function_count++;
+    }
+    last_status = 0;
+}
+
+// Function to run the function named args[0], if there is one, with args[1...] as its
+// positional parameters; returns 0 when there is no such function
+int call_function(char **args)
+{
+    struct function *function = find_function(args[0]);
+    char **saved_parameters = positional_parameters;
+    int saved_count = positional_count, saved_loops = loop_depth;
+
+    if (!function)
+        return 0;
+    if (function_depth >= FUNCTION_MAX_DEPTH)
+    {
+        fprintf(stderr, FUNCTION_NESTING_MESSAGE, args[0]);
+        last_status = 1;
+        return 1;
+    }
+
+    positional_parameters = args + 1;
+    for (positional_count = 0; args[positional_count + 1]; positional_count++)
+        ;
+    loop_depth = 0;
+    function_depth++;
+    function->calls++;
+    execute_list(function->body.pipelines, function->body.count);
+    if (pending_control == CONTROL_RETURN)
+        pending_control = CONTROL_NONE;
+    function->calls--;
+    function_depth--;
+    loop_depth = saved_loops;
+    positional_parameters = saved_parameters;
+    positional_count = saved_count;
+    if (!function->defined)
+        retire_function(function);
+    return 1;
+}
+
+// Run the condition of an 'if', 'while' or 'until'. Its failure is an answer, not an
+// error, so '-e' does not apply to it.
+static void run_condition(const struct command_list *condition)
+{
+    int saved = exit_on_error;
+
+    exit_on_error = 0;
+    execute_list(condition->pipelines, condition->count);
+    exit_on_error = saved;
+}
+
+// Tell whether a loop must stop after one of its lists ran: '-e' stopped it (failed), a
+// 'break', a 'continue' for an outer loop or a 'return' is pending, or CTRL+C was pressed.
+// A 'continue' for this loop is used up.
+static int loop_must_stop(int failed)
+{
+    if (failed || interrupted())
+        return 1;
+    if (pending_control != CONTROL_NONE)
+    {
+        int was_break = pending_control == CONTROL_BREAK;
+
+        if (pending_control == CONTROL_RETURN || --control_levels > 0)
+            return 1;
+        pending_control = CONTROL_NONE;
+        return was_break;
+    }
+    if (job_control && events_poll_signals() == 0 && interrupt_pending)
+    { // Only builtins ran, so the shell itself got the CTRL+C
+        interrupt_pending = 0;
+        last_status = 128 + SIGINT;
+        printf("\n"); // Leave the '^C' line, as after a command killed by it
+        return 1;
+    }
+    return 0;
+}
+
+static void run_if(struct compound *compound)
+{
+    for (; compound && compound->kind == COMPOUND_IF; compound = compound->otherwise)
+    {
+        run_condition(&compound->condition);
+        if (pending_control != CONTROL_NONE || interrupted())
+            return;
+        if (last_status == 0)
+        {
+            execute_list(compound->body.pipelines, compound->body.count);
+            return;
+        }
+    }
+    if (compound) // 'else'
+        execute_list(compound->body.pipelines, compound->body.count);
+    else
+        last_status = 0;
+}
+
+// Run a 'while' or 'until' loop; its status is that of the last body run, 0 if none ran
+static void run_while(struct compound *compound)
+{
+    int status = 0;
+
+    loop_depth++;
+    while (1)
+    {
+        run_condition(&compound->condition);
+        if (loop_must_stop(0))
+            break;
+        if ((last_status == 0) != (compound->kind == COMPOUND_WHILE))
+        {
+            last_status = status;
+            break;
+        }
+        if (loop_must_stop(execute_list(compound->body.pipelines, compound->body.count) == -1))
+            break;
+        status = last_status;
+    }
+    loop_depth--;
+}
+
+// Run a 'for' loop over its words, expanded once before the first iteration, or over "$@"
+static void run_for(struct compound *compound)
+{
+    struct pipeline words = {&compound->words, 1, 0, 0, LIST_SEQUENCE, 0};
+    struct expansion expansion = {0};
+    char **values = positional_parameters;
+    int count = positional_count;
+    size_t name_length = strlen(compound->name);
+
+    if (compound->has_words)
+    {
+        struct pipeline *expanded = expand_pipeline(&words, &expansion);
+
+        if (!expanded)
+            return;
+        values = expanded->commands[0].args;
+        count = expanded->commands[0].arg_count;
+    }
+
+    last_status = 0;
+    loop_depth++;
+    for (int i = 0; i < count; i++)
+    {
+        if (set_variable(compound->name, name_length, values[i], 0) == -1)
+        {
+            perror("Assignment failed");
+            last_status = 1;
+            break;
+        }
+        if (loop_must_stop(execute_list(compound->body.pipelines, compound->body.count) == -1))
+            break;
+    }
+    loop_depth--;
+    free_expansion(&expansion);
+}
+
+// Run a list in the foreground; the body of a '( ... )' subshell
+static int run_list_call(void *data)
+{
+    const struct command_list *list = data;
+
+    job_control = 0; // The subshell's group has the terminal; its commands stay in it
+    execute_list(list->pipelines, list->count);
+    return last_status;
+}
+
+static void run_subshell(struct compound *compound)
+{
+    struct job *job = job_create(compound_text(compound), 0);
+    struct spawn_plan plan;
+    uint64_t started;
+    pid_t pid = -1;
+
+    if (job)
+    {
+        spawn_plan_init(&plan);
+        job_plan_group(job, &plan);
+        pid = spawn_subshell(&plan, run_list_call, &compound->body);
+    }
+    if (pid == -1 || job_add_process(job, pid, "(subshell)") == -1)
+    {
+        if (!job)
+            perror("Job allocation failed");
+        else
+            job_free(job);
+        last_status = 1;
+        return;
+    }
+    started = stats_now();
+    job_wait_foreground(job);
+    stats_record(PHASE_WAIT, started);
+}
+
+// Function to run a compound command in the shell, once its redirections are applied
+void execute_compound(struct compound *compound)
+{
+    switch (compound->kind)
+    {
+    case COMPOUND_IF:
+        run_if(compound);
+        break;
+    case COMPOUND_WHILE:
+    case COMPOUND_UNTIL:
+        run_while(compound);
+        break;
+    case COMPOUND_FOR:
+        run_for(compound);
+        break;
+    case COMPOUND_GROUP:
+        execute_list(compound->body.pipelines, compound->body.count);
+        break;
+    case COMPOUND_SUBSHELL:
+        run_subshell(compound);
+        break;
+    case COMPOUND_FUNCTION:
+        define_function(compound);
+        break;
+    }
+}
+
+// Read the optional count argument of 'break', 'continue', 'return' and 'shift' into *n;
+// returns -1 after reporting one that is not a number
+static int count_argument(char **args, long *n)
+{
+    char *end;
+
+    if (args[1] == NULL)
+        return 0;
+    errno = 0;
+    *n = strtol(args[1], &end, 10);
+    if (args[1][0] == '\0' || *end != '\0' || errno != 0)
+    {
+        fprintf(stderr, NUMERIC_ARGUMENT_MESSAGE, args[0], args[1]);
+        last_status = 2;
+        return -1;
+    }
+    return 0;
+}
+
+// Function to implement 'break [n]' and 'continue [n]'
+void builtin_break(char **args)
+{
+    long n = 1;
+
+    if (count_argument(args, &n) == -1)
+        return;
+    if (loop_depth == 0 || n < 1)
+    {
+        fprintf(stderr, loop_depth == 0 ? LOOP_ONLY_MESSAGE : LOOP_COUNT_MESSAGE, args[0]);
+        last_status = 1;
+        return;
+    }
+    pending_control = args[0][0] == 'b' ? CONTROL_BREAK : CONTROL_CONTINUE;
+    control_levels = n < loop_depth ? n : loop_depth;
+}
+
+// Function to implement 'return [n]'
+void builtin_return(char **args)
+{
+    long n = previous_status;
+
+    if (count_argument(args, &n) == -1)
+        return;
+    if (function_depth == 0)
+    {
+        message(stderr, RETURN_OUTSIDE_FUNCTION_MESSAGE);
+        last_status = 1;
+        return;
+    }
+    pending_control = CONTROL_RETURN;
+    last_status = n & 0xff;
+}
+
+// Function to implement 'shift [n]'
+void builtin_shift(char **args)
+{
+    long n = 1;
+
+    if (count_argument(args, &n) == -1)
+        return;
+    if (n < 0 || n > positional_count)
+    {
+        fprintf(stderr, SHIFT_COUNT_MESSAGE, n);
+        last_status = 1;
+        return;
+    }
+    positional_parameters += n;
+    positional_count -= n;
+}
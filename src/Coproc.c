@@ -0,0 +1,266 @@
+/**
+ * @file Coproc.c
+ * @brief The 'coproc' builtin: a long-lived command the shell talks to through pipes.
+ *
+ * 'coproc [-n NAME] command [args...]' starts the command in the background with its
+ * standard input and output connected to pipes whose other ends the shell keeps, and
+ * makes it a job in the job table like any other background command. NAME (COPROC by
+ * default) then names those ends: '>&NAME' redirects to the command's standard input,
+ * '<&NAME' from its standard output, and $NAME_PID holds its pid. A stream of requests
+ * can so be sent to one warm process instead of starting a new one for each:
+ *
+ *     coproc -n CALC bc -l
+ *     echo '4*a(1)' >&CALC; read pi <&CALC
+ *
+ * The shell's ends are close-on-exec and moved to COPROC_MIN_FD or above, so a command
+ * only gets them through a redirection, and the low descriptors scripts use stay free.
+ * 'coproc -c NAME' closes the write end, which lets the command see the end of its
+ * input. When its job leaves the job table (it was reported finished, or waited for) the
+ * read end is closed too and $NAME_PID is unset.
+ *
+ * Once a coprocess has started, the shell ignores SIGPIPE, so writing to one that has
+ * exited fails with EPIPE instead of killing the shell. Commands still get the default.
+ */
+
+#define COPROC_MIN_FD 10
+#define COPROC_DEFAULT_NAME "COPROC"
+
+struct coproc
+{
+    char *name;
+    struct job *job;
+    int write_fd; // To the command's standard input; -1 after 'coproc -c'
+    int read_fd;  // From its standard output
+    struct coproc *next;
+};
+
+static struct coproc *coprocs;
+
+static struct coproc *find_coproc(const char *name)
+{
+    struct coproc *coproc = coprocs;
+
+    while (coproc && strcmp(coproc->name, name) != 0)
+        coproc = coproc->next;
+    return coproc;
+}
+
+// Close the shell's ends of a coprocess that has been unlinked, and free it
+static void release_coproc(struct coproc *coproc)
+{
+    char name[256];
+
+    if (coproc->write_fd != -1)
+        close(coproc->write_fd);
+    if (coproc->read_fd != -1)
+        close(coproc->read_fd);
+    if (snprintf(name, sizeof(name), "%s_PID", coproc->name) < (int)sizeof(name))
+        unset_variable(name);
+    free(coproc->name);
+    free(coproc);
+}
+
+static void unlink_coproc(struct coproc *coproc)
+{
+    struct coproc **link = &coprocs;
+
+    while (*link != coproc)
+        link = &(*link)->next;
+    *link = coproc->next;
+    release_coproc(coproc);
+}
+
+// Function to drop the coprocess of a job that is leaving the job table
+void coproc_job_freed(const struct job *job)
+{
+    for (struct coproc *coproc = coprocs; coproc; coproc = coproc->next)
+    {
+        if (coproc->job == job)
+        {
+            unlink_coproc(coproc);
+            return;
+        }
+    }
+}
+
+// Function to find the descriptor copied by a DUP redirection whose target is only known
+// when the command runs: a '$' word that expanded to a number, or a coprocess name.
+// Reports the target and returns -1 when it is neither.
+int redirect_source_fd(const struct redirect *redirect)
+{
+    const char *target = redirect->target;
+    const struct coproc *coproc;
+    int fd = -1;
+
+    if (target[0] != '\0' && strspn(target, "0123456789") == strlen(target))
+        return atoi(target);
+    coproc = find_coproc(target);
+    if (coproc)
+        fd = redirect->reads ? coproc->read_fd : coproc->write_fd;
+    if (fd == -1)
+        fprintf(stderr, REDIRECT_BAD_TARGET_MESSAGE, target);
+    return fd;
+}
+
+// Move a pipe end to COPROC_MIN_FD or above, keeping it close-on-exec
+static int move_coproc_fd(int fd)
+{
+    int moved = fcntl(fd, F_DUPFD_CLOEXEC, COPROC_MIN_FD);
+
+    if (moved == -1)
+        return fd;
+    close(fd);
+    return moved;
+}
+
+// The job's text: the command line as 'jobs' shows it
+static char *coproc_job_text(char **args)
+{
+    size_t length = sizeof("coproc");
+    char *text;
+
+    for (int i = 0; args[i] != NULL; i++)
+        length += strlen(args[i]) + 1;
+    text = malloc(length);
+    if (!text)
+        return NULL;
+    strcpy(text, "coproc");
+    for (int i = 0; args[i] != NULL; i++)
+    {
+        strcat(text, " ");
+        strcat(text, args[i]);
+    }
+    return text;
+}
+
+static void start_coproc(const char *name, char **args)
+{
+    struct coproc *coproc = find_coproc(name);
+    int to_command[2], from_command[2];
+    struct spawn_plan plan;
+    struct job *job = NULL;
+    char *text, pid_name[256], pid_text[16];
+    pid_t pid = -1;
+
+    reap_jobs();
+    if (coproc && coproc->job->state != JOB_DONE)
+    {
+        fprintf(stderr, COPROC_RUNNING_MESSAGE, name);
+        last_status = 1;
+        return;
+    }
+    if (coproc)
+        unlink_coproc(coproc); // Finished but not yet reported; the name is free again
+    if (snprintf(pid_name, sizeof(pid_name), "%s_PID", name) >= (int)sizeof(pid_name))
+    {
+        fprintf(stderr, COPROC_NOT_FOUND_MESSAGE, name);
+        last_status = 2;
+        return;
+    }
+    if (pipe2(to_command, O_CLOEXEC) == -1)
+    {
+        perror("coproc: pipe failed");
+        last_status = 1;
+        return;
+    }
+    if (pipe2(from_command, O_CLOEXEC) == -1)
+    {
+        perror("coproc: pipe failed");
+        close(to_command[0]);
+        close(to_command[1]);
+        last_status = 1;
+        return;
+    }
+
+    if (!sigismember(&spawn_default_signals, SIGPIPE))
+    {
+        signal(SIGPIPE, SIG_IGN);
+        sigaddset(&spawn_default_signals, SIGPIPE);
+    }
+    coproc = calloc(1, sizeof(*coproc));
+    text = coproc_job_text(args);
+    if (coproc && text && (coproc->name = strdup(name)) && (job = job_create(text, 1)))
+    {
+        spawn_plan_init(&plan);
+        spawn_plan_dup2(&plan, to_command[0], STDIN_FILENO);
+        spawn_plan_dup2(&plan, from_command[1], STDOUT_FILENO);
+        job_plan_group(job, &plan);
+        pid = spawn_command(args, &plan);
+    }
+    free(text);
+    close(to_command[0]);
+    close(from_command[1]);
+
+    if (pid == -1 || job_add_process(job, pid, args[0]) == -1)
+    {
+        if (!job)
+            perror("coproc: allocation failed"); // spawn_command reports its own failures
+        if (job)
+            job_free(job);
+        close(to_command[1]);
+        close(from_command[0]);
+        if (coproc)
+            free(coproc->name);
+        free(coproc);
+        last_status = 1;
+        return;
+    }
+
+    coproc->job = job;
+    coproc->write_fd = move_coproc_fd(to_command[1]);
+    coproc->read_fd = move_coproc_fd(from_command[0]);
+    coproc->next = coprocs;
+    coprocs = coproc;
+    snprintf(pid_text, sizeof(pid_text), "%d", (int)pid);
+    set_variable(pid_name, strlen(pid_name), pid_text, 0);
+    job_announce_background(job);
+}
+
+// Function to implement 'coproc [-n NAME] command [args...]', 'coproc -c NAME' and 'coproc'
+void builtin_coproc(char **args)
+{
+    const char *name = COPROC_DEFAULT_NAME;
+    int i = 1;
+
+    if (args[1] == NULL)
+    {
+        for (const struct coproc *coproc = coprocs; coproc; coproc = coproc->next)
+            printf("%s %d%s\n", coproc->name, (int)coproc->job->processes[0].pid, coproc->write_fd == -1 ? " (input closed)" : "");
+        return;
+    }
+    if (strcmp(args[1], "-c") == 0 || strcmp(args[1], "-n") == 0)
+    {
+        if (args[2] == NULL || variable_name_length(args[2]) != strlen(args[2]) || (args[1][1] == 'n' && args[3] == NULL))
+        {
+            message(stderr, COPROC_USAGE_MESSAGE);
+            last_status = 2;
+            return;
+        }
+        name = args[2];
+        i = 3;
+    }
+
+    if (strcmp(args[1], "-c") == 0)
+    {
+        struct coproc *coproc = find_coproc(name);
+
+        if (!coproc)
+        {
+            fprintf(stderr, COPROC_NOT_FOUND_MESSAGE, name);
+            last_status = 1;
+        }
+        else if (coproc->write_fd != -1)
+        {
+            close(coproc->write_fd);
+            coproc->write_fd = -1;
+        }
+        return;
+    }
+    if (args[i][0] == '-')
+    {
+        message(stderr, COPROC_USAGE_MESSAGE);
+        last_status = 2;
+        return;
+    }
+    start_coproc(name, &args[i]);
+}
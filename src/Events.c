@@ -0,0 +1,197 @@
+/**
+ * @file Events.c
+ * @brief The shell's event loop: one epoll instance over descriptors and signals.
+ *
+ * Whatever the shell waits on while it is idle is a descriptor in a single epoll
+ * instance: the terminal while the line editor waits for a key (LineEdit.c), and a
+ * signalfd for the signals the shell handles, SIGCHLD (Jobs.c) and SIGWINCH. Those
+ * signals are blocked and only ever read from the signalfd, so no handler interrupts the
+ * shell in the middle of a system call, and a signal that arrives just before the shell
+ * goes to sleep still wakes it.
+ *
+ * event_wait() sleeps in epoll_wait() and calls the handler of every descriptor that is
+ * ready; the signalfd's handler calls the function registered for each signal it reads.
+ * events_poll_signals() reads the signalfd without sleeping, for code that only needs to
+ * learn whether a signal came (reap_jobs()).
+ *
+ * Commands start with the signal mask the shell had before it blocked anything
+ * (events_command_mask, given to posix_spawn and restored before exec). A forked
+ * subshell keeps the signals blocked, but builds an epoll instance of its own with
+ * events_after_fork(): the parent's would report readiness for the parent, while the
+ * inherited signalfd reads the signals of whichever process reads it.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+
+#define EVENT_MAX_WATCHES 8
+#define EVENT_BATCH_SIZE 8
+
+struct event_watch
+{
+    int fd; // -1 when the slot is free
+    void (*handler)(void *data);
+    void *data;
+};
+
+static int event_epoll_fd = -1;
+static int event_signal_fd = -1;
+static sigset_t event_signals; // Blocked and read from event_signal_fd
+static void (*event_signal_handlers[NSIG])(void);
+static struct event_watch event_watches[EVENT_MAX_WATCHES];
+static struct event_watch event_signal_watch = {-1, NULL, NULL};
+
+sigset_t events_command_mask; // The signal mask commands start with
+
+// Read every signal queued on the signalfd and call its handler
+static void dispatch_signals(void *data)
+{
+    struct signalfd_siginfo info[8];
+    ssize_t size;
+
+    (void)data;
+    while ((size = read(event_signal_fd, info, sizeof(info))) > 0)
+    {
+        for (size_t i = 0; i < (size_t)size / sizeof(info[0]); i++)
+        {
+            if (info[i].ssi_signo < NSIG && event_signal_handlers[info[i].ssi_signo])
+                event_signal_handlers[info[i].ssi_signo]();
+        }
+    }
+}
+
+static int add_to_epoll(struct event_watch *watch)
+{
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = watch};
+
+    return epoll_ctl(event_epoll_fd, EPOLL_CTL_ADD, watch->fd, &event);
+}
+
+// Function to create the epoll instance; the shell runs without one if this fails
+void events_init()
+{
+    sigemptyset(&event_signals);
+    sigprocmask(SIG_BLOCK, &event_signals, &events_command_mask);
+    for (int i = 0; i < EVENT_MAX_WATCHES; i++)
+        event_watches[i].fd = -1;
+    event_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+}
+
+// Function to have handler called from the event loop whenever sig arrives, instead of
+// the signal being delivered. Returns -1 when the shell has no event loop.
+int events_on_signal(int sig, void (*handler)(void))
+{
+    sigset_t blocked;
+    int fd;
+
+    if (event_epoll_fd == -1)
+        return -1;
+    sigaddset(&event_signals, sig);
+    fd = signalfd(event_signal_fd, &event_signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd == -1)
+    {
+        sigdelset(&event_signals, sig);
+        return -1;
+    }
+    if (event_signal_fd == -1)
+    {
+        event_signal_fd = event_signal_watch.fd = fd;
+        event_signal_watch.handler = dispatch_signals;
+        if (add_to_epoll(&event_signal_watch) == -1)
+        {
+            close(fd);
+            event_signal_fd = event_signal_watch.fd = -1;
+            sigdelset(&event_signals, sig);
+            return -1;
+        }
+    }
+    event_signal_handlers[sig] = handler;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, sig);
+    sigprocmask(SIG_BLOCK, &blocked, NULL);
+    return 0;
+}
+
+// Function to have handler called from the event loop while fd is readable; -1 on failure
+int event_watch_fd(int fd, void (*handler)(void *data), void *data)
+{
+    for (int i = 0; i < EVENT_MAX_WATCHES && event_epoll_fd != -1; i++)
+    {
+        struct event_watch *watch = &event_watches[i];
+
+        if (watch->fd != -1)
+            continue;
+        watch->fd = fd;
+        watch->handler = handler;
+        watch->data = data;
+        if (add_to_epoll(watch) == 0)
+            return 0;
+        watch->fd = -1;
+        break;
+    }
+    return -1;
+}
+
+// Function to stop watching fd
+void event_unwatch_fd(int fd)
+{
+    for (int i = 0; i < EVENT_MAX_WATCHES; i++)
+    {
+        if (event_watches[i].fd == fd)
+        {
+            epoll_ctl(event_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+            event_watches[i].fd = -1;
+        }
+    }
+}
+
+// Function to sleep until a watched descriptor is ready or a signal comes, at most
+// timeout_ms milliseconds (-1 for no limit), and call the handlers. Returns how many
+// descriptors were ready, 0 on a timeout, or -1 when there is no event loop.
+int event_wait(int timeout_ms)
+{
+    struct epoll_event events[EVENT_BATCH_SIZE];
+    int count;
+
+    if (event_epoll_fd == -1)
+        return -1;
+    count = epoll_wait(event_epoll_fd, events, EVENT_BATCH_SIZE, timeout_ms);
+    if (count == -1)
+        return errno == EINTR ? 0 : -1; // Only a stop and continue interrupts it
+    for (int i = 0; i < count; i++)
+    {
+        struct event_watch *watch = events[i].data.ptr;
+
+        if (watch->fd != -1) // An earlier handler may have stopped watching it
+            watch->handler(watch->data);
+    }
+    return count;
+}
+
+// Function to run the handlers of the signals that came, without sleeping; returns -1
+// when signals are not read from a signalfd, so the caller cannot learn of them this way
+int events_poll_signals()
+{
+    if (event_signal_fd == -1)
+        return -1;
+    dispatch_signals(NULL);
+    return 0;
+}
+
+// Function to give a forked subshell an epoll instance of its own, watching only signals
+void events_after_fork()
+{
+    if (event_epoll_fd == -1)
+        return;
+    close(event_epoll_fd);
+    for (int i = 0; i < EVENT_MAX_WATCHES; i++)
+        event_watches[i].fd = -1;
+    event_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (event_epoll_fd != -1 && event_signal_fd != -1 && add_to_epoll(&event_signal_watch) == -1)
+    {
+        close(event_epoll_fd);
+        event_epoll_fd = -1;
+    }
+}
@@ -0,0 +1,563 @@
+/**
+ * @file Expand.c
+ * @brief Expansion of '$' words at the time a pipeline runs.
+ *
+ * The parser leaves words that contain '$' with their quotes in place and flags them
+ * ARG_EXPAND (Parser.c). Just before a pipeline runs, expand_pipeline() builds a copy
+ * in which those words are expanded and stripped of their quotes. The copy shares every
+ * other word with the parsed pipeline, and a pipeline without such words is returned
+ * as it is. Words are expanded on every run, so a script line sees the status of the
+ * command before it, not the status at parse time.
+ *
+ * Expanded: $? (the status of the last foreground command), $$ (the shell's process ID),
+ * $NAME and ${NAME} (shell variables, Variables.c; empty when unset), and the positional
+ * parameters: $0 to $9, ${10} and up, $# (how many there are) and $@ or $* (all of them,
+ * joined by spaces). Nothing is expanded inside single quotes, a '$' that starts nothing
+ * is kept, and results are not split into fields, except that a word that is only $@ or
+ * "$@" becomes one word per parameter, and no word when there are none.
+ *
+ * '$(command)' and '`command`' are replaced by the output of the command, less its trailing
+ * newlines (capture_output(), Substitution.c). An argument that is only a substitution,
+ * unquoted, is split at the characters of $IFS into one word per field, which point into
+ * the buffer the output was read into; quoted, it becomes one word, that buffer itself.
+ * Elsewhere in a word the output is read straight into the word being built.
+ *
+ * The body of a here-document is expanded like the inside of double quotes, except that
+ * quotes in it are kept as they are: '$' expands, and a backslash only quotes '$', '`',
+ * another backslash, or the newline it then removes.
+ *
+ * An argument flagged ARG_GLOB is then a pathname pattern. Its quoted parts and the
+ * results of '$' expansions are escaped with backslashes, so only the unquoted '*', '?'
+ * and '[...]' written on the command line match, and glob_expand() (Glob.c) replaces the
+ * word by the sorted matches. A pattern that matches nothing is kept as a word.
+ *
+ * When a word cannot be expanded in full, for want of memory, the pipeline does not run:
+ * its raw words, quotes and '$' included, could name paths nobody meant.
+ */
+
+struct string_builder
+{
+    char *text;
+    size_t length;
+    size_t capacity;
+    int failed; // Set when the text could not grow, and so is incomplete
+};
+
+int substitution_status = -1; // Status of the last substitution in the pipeline being expanded, -1 if none
+
+void capture_output(const char *text, size_t length, struct string_builder *output);
+
+struct expansion
+{
+    struct pipeline pipeline;
+    struct command *commands;
+    char **words;
+    int word_count;
+    int word_capacity;
+    struct redirect *redirects;
+    char **strings; // Expanded texts, freed with the expansion
+    int string_count;
+    int string_capacity;
+};
+
+// Make room for length more bytes and a NUL, doubling the capacity as needed
+static int builder_reserve(struct string_builder *builder, size_t length)
+{
+    if (builder->length + length + 1 > builder->capacity)
+    {
+        size_t capacity = builder->capacity ? builder->capacity * 2 : 64;
+        char *grown;
+
+        while (capacity < builder->length + length + 1)
+            capacity *= 2;
+        grown = realloc(builder->text, capacity);
+        if (!grown)
+        {
+            builder->failed = 1;
+            return -1;
+        }
+        builder->text = grown;
+        builder->capacity = capacity;
+    }
+    return 0;
+}
+
+static int builder_append(struct string_builder *builder, const char *text, size_t length)
+{
+    if (builder_reserve(builder, length) == -1)
+        return -1;
+    memcpy(builder->text + builder->length, text, length);
+    builder->length += length;
+    builder->text[builder->length] = '\0';
+    return 0;
+}
+
+// Return the text of builder, or NULL, freeing it, when it is incomplete
+static char *builder_finish(struct string_builder *builder)
+{
+    if (!builder->failed)
+        return builder->text;
+    free(builder->text);
+    errno = ENOMEM;
+    return NULL;
+}
+
+// Append text, escaping the characters glob_expand() treats as special when pattern is set
+static void builder_append_quoted(struct string_builder *builder, const char *text, size_t length, int pattern)
+{
+    size_t start = 0;
+
+    for (size_t i = 0; pattern && i < length; i++)
+    {
+        if (strchr("*?[]\\", text[i]))
+        {
+            builder_append(builder, text + start, i - start);
+            builder_append(builder, "\\", 1);
+            start = i;
+        }
+    }
+    builder_append(builder, text + start, length - start);
+}
+
+// The positional parameter $n, $0 being the name of the shell or script; NULL when unset
+static const char *positional_parameter(long n)
+{
+    if (n == 0)
+        return shell_name;
+    return n <= positional_count ? positional_parameters[n - 1] : NULL;
+}
+
+// Expand the parameter at *src (just after '$') into builder; returns the bytes consumed
+static size_t expand_parameter(const char *src, struct string_builder *builder, int pattern)
+{
+    char number[16];
+    const char *value;
+    size_t length;
+
+    if (*src == '?' || *src == '$' || *src == '#')
+    {
+        int n = *src == '?' ? last_status : *src == '$' ? (int)shell_pid : positional_count;
+
+        builder_append(builder, number, snprintf(number, sizeof(number), "%d", n));
+        return 1;
+    }
+    if (*src == '@' || *src == '*')
+    {
+        for (int i = 0; i < positional_count; i++)
+        {
+            if (i > 0)
+                builder_append(builder, " ", 1);
+            builder_append_quoted(builder, positional_parameters[i], strlen(positional_parameters[i]), pattern);
+        }
+        return 1;
+    }
+    if (isdigit((unsigned char)*src) || (*src == '{' && isdigit((unsigned char)src[1]) && src[1 + strspn(src + 1, "0123456789")] == '}'))
+    {
+        int braced = *src == '{';
+
+        length = braced ? strspn(src + 1, "0123456789") + 2 : 1;
+        value = positional_parameter(braced ? atol(src + 1) : *src - '0');
+        if (value)
+            builder_append_quoted(builder, value, strlen(value), pattern);
+        return length;
+    }
+    if (*src == '{' && (length = variable_name_length(src + 1)) > 0 && src[length + 1] == '}')
+    {
+        value = find_variable(src + 1, length);
+        if (value)
+            builder_append_quoted(builder, value, strlen(value), pattern);
+        return length + 2;
+    }
+    if ((length = variable_name_length(src)) > 0)
+    {
+        value = find_variable(src, length);
+        if (value)
+            builder_append_quoted(builder, value, strlen(value), pattern);
+        return length;
+    }
+    builder_append(builder, "$", 1);
+    return 0;
+}
+
+// Run the '$(...)' or '`...`' substitution at src, appending its output to output; returns
+// its length in src, or 0 when it is not terminated
+static size_t run_substitution(const char *src, struct string_builder *output)
+{
+    int backquoted = *src == '`';
+    size_t end = backquoted ? scan_backquote(src, 1) : scan_substitution(src, 2);
+    const char *command = src + (backquoted ? 1 : 2);
+    struct string_builder text = {NULL, 0, 0, 0};
+    char *unquoted;
+    size_t length;
+
+    if (end == (size_t)-1)
+        return 0;
+    length = src + end - 1 - command;
+    if (!backquoted)
+    {
+        capture_output(command, length, output);
+        return end;
+    }
+    builder_append(&text, "", 0);
+    for (size_t i = 0; i < length; i++)
+    { // Inside backquotes, a backslash quotes '\\', '`' and '$'
+        if (command[i] == '\\' && i + 1 < length && strchr("\\`$", command[i + 1]))
+            i++;
+        builder_append(&text, command + i, 1);
+    }
+    unquoted = builder_finish(&text);
+    if (unquoted)
+        capture_output(unquoted, text.length, output);
+    else
+        output->failed = 1;
+    free(unquoted);
+    return end;
+}
+
+// Expand the substitution at src into builder; returns the bytes consumed. One that is not
+// terminated is kept as it is.
+static size_t expand_substitution(const char *src, struct string_builder *builder, int pattern)
+{
+    struct string_builder output = {NULL, 0, 0, 0};
+    size_t used;
+
+    if (!pattern)
+    {
+        used = run_substitution(src, builder);
+    }
+    else
+    {
+        used = run_substitution(src, &output);
+        if (output.text)
+            builder_append_quoted(builder, output.text, output.length, 1);
+        builder->failed |= output.failed;
+        free(output.text);
+    }
+    if (used == 0)
+    {
+        builder_append(builder, src, 1);
+        used = 1;
+    }
+    return used;
+}
+
+static int starts_substitution(const char *src)
+{
+    return (src[0] == '$' && src[1] == '(') || src[0] == '`';
+}
+
+// Expand a raw word and remove its quotes; with pattern set, quoted characters are escaped
+static char *expand_word_as(const char *raw, int pattern)
+{
+    struct string_builder builder = {NULL, 0, 0, 0};
+    const char *src = raw;
+
+    builder_append(&builder, "", 0);
+    while (*src)
+    {
+        if (*src == '\\')
+        {
+            src++;
+            if (*src)
+                builder_append_quoted(&builder, src++, 1, pattern);
+        }
+        else if (*src == '\'')
+        {
+            const char *end = strchr(src + 1, '\'');
+
+            builder_append_quoted(&builder, src + 1, end - src - 1, pattern);
+            src = end + 1;
+        }
+        else if (*src == '"')
+        {
+            for (src++; *src != '"'; src++)
+            {
+                if (*src == '\\' && strchr("\\\"$`", src[1]))
+                    builder_append_quoted(&builder, ++src, 1, pattern);
+                else if (starts_substitution(src))
+                    src += expand_substitution(src, &builder, pattern) - 1;
+                else if (*src == '$')
+                    src += expand_parameter(src + 1, &builder, pattern);
+                else
+                    builder_append_quoted(&builder, src, 1, pattern);
+            }
+            src++;
+        }
+        else if (starts_substitution(src))
+        {
+            src += expand_substitution(src, &builder, pattern);
+        }
+        else if (*src == '$')
+        {
+            src += 1 + expand_parameter(src + 1, &builder, pattern);
+        }
+        else
+        {
+            builder_append(&builder, src++, 1);
+        }
+    }
+    return builder_finish(&builder);
+}
+
+// Function to expand a raw word and remove its quotes; returns a malloc'ed string or NULL
+char *expand_word(const char *raw)
+{
+    return expand_word_as(raw, 0);
+}
+
+// Function to expand the body of a here-document; returns a malloc'ed string or NULL
+char *expand_here_document(const char *body)
+{
+    struct string_builder builder = {NULL, 0, 0, 0};
+    const char *src = body;
+
+    builder_append(&builder, "", 0);
+    while (*src)
+    {
+        if (*src == '\\' && src[1] == '\n')
+        {
+            src += 2;
+        }
+        else if (*src == '\\' && src[1] != '\0' && strchr("\\$`", src[1]))
+        {
+            builder_append(&builder, src + 1, 1);
+            src += 2;
+        }
+        else if (starts_substitution(src))
+        {
+            src += expand_substitution(src, &builder, 0);
+        }
+        else if (*src == '$')
+        {
+            src += 1 + expand_parameter(src + 1, &builder, 0);
+        }
+        else
+        {
+            builder_append(&builder, src++, 1);
+        }
+    }
+    return builder_finish(&builder);
+}
+
+// Remember a malloc'ed text for free_expansion; frees it and returns NULL when out of memory
+static char *keep_string(struct expansion *expansion, char *text)
+{
+    if (text && expansion->string_count == expansion->string_capacity)
+    {
+        int capacity = expansion->string_capacity ? expansion->string_capacity * 2 : 16;
+        char **grown = realloc(expansion->strings, capacity * sizeof(*grown));
+
+        if (!grown)
+        {
+            free(text);
+            return NULL;
+        }
+        expansion->strings = grown;
+        expansion->string_capacity = capacity;
+    }
+    if (text)
+        expansion->strings[expansion->string_count++] = text;
+    return text;
+}
+
+static int add_word(struct expansion *expansion, char *word)
+{
+    if (expansion->word_count == expansion->word_capacity)
+    {
+        int capacity = expansion->word_capacity * 2;
+        char **grown = realloc(expansion->words, capacity * sizeof(*grown));
+
+        if (!grown)
+            return -1;
+        expansion->words = grown;
+        expansion->word_capacity = capacity;
+    }
+    expansion->words[expansion->word_count++] = word;
+    return 0;
+}
+
+// Tell whether raw is a single substitution, quoted (*quoted set) or not
+static int is_whole_substitution(const char *raw, int *quoted)
+{
+    size_t length = strlen(raw), end;
+
+    *quoted = raw[0] == '"' && length > 2 && raw[length - 1] == '"';
+    if (*quoted)
+    {
+        raw++;
+        length -= 2;
+    }
+    if (!starts_substitution(raw))
+        return 0;
+    end = raw[0] == '`' ? scan_backquote(raw, 1) : scan_substitution(raw, 2);
+    return end == length;
+}
+
+// Add the words of an argument that is only a substitution: its output as one word when
+// quoted, or else one word per field, split in place and pointing into the output
+static int add_substitution_words(struct expansion *expansion, const char *raw, int quoted)
+{
+    struct string_builder output = {NULL, 0, 0, 0};
+    const char *separators = find_variable("IFS", 3);
+    char *field;
+    int count = 0;
+
+    builder_append(&output, "", 0);
+    run_substitution(raw + quoted, &output);
+    if (!keep_string(expansion, builder_finish(&output)))
+        return -1;
+    if (quoted)
+        return add_word(expansion, output.text) == -1 ? -1 : 1;
+
+    if (!separators)
+        separators = " \t\n";
+    field = output.text + strspn(output.text, separators);
+    while (*field)
+    {
+        size_t length = strcspn(field, separators);
+        char *next = field + length;
+
+        if (*next)
+            *next++ = '\0';
+        if (add_word(expansion, field) == -1)
+            return -1;
+        count++;
+        field = next + strspn(next, separators);
+    }
+    return count;
+}
+
+// Add the words one flagged argument expands to; returns how many, or -1 when out of memory
+static int expand_argument(struct expansion *expansion, const char *raw, int flags, struct glob_matches *matches)
+{
+    char *text;
+    int quoted;
+
+    if (strcmp(raw, "$@") == 0 || strcmp(raw, "\"$@\"") == 0)
+    {
+        for (int i = 0; i < positional_count; i++)
+        {
+            if (add_word(expansion, positional_parameters[i]) == -1)
+                return -1;
+        }
+        return positional_count;
+    }
+    if (is_whole_substitution(raw, &quoted))
+        return add_substitution_words(expansion, raw, quoted);
+    if (flags & ARG_GLOB)
+    {
+        char *pattern = expand_word_as(raw, 1);
+        int count = pattern ? glob_expand(pattern, matches) : -1;
+
+        free(pattern);
+        for (int i = 0; i < count; i++)
+        {
+            if (!keep_string(expansion, matches->paths[i]) || add_word(expansion, matches->paths[i]) == -1)
+            {
+                for (int j = i + 1; j < count; j++)
+                    free(matches->paths[j]);
+                count = -1;
+                break;
+            }
+        }
+        matches->count = 0;
+        if (count != 0)
+            return count;
+    }
+    text = keep_string(expansion, expand_word(raw));
+    return text && add_word(expansion, text) == 0 ? 1 : -1;
+}
+
+// Function to release what expand_pipeline() allocated
+void free_expansion(struct expansion *expansion)
+{
+    for (int i = 0; i < expansion->string_count; i++)
+        free(expansion->strings[i]);
+    free(expansion->strings);
+    free(expansion->commands);
+    free(expansion->words);
+    free(expansion->redirects);
+    memset(expansion, 0, sizeof(*expansion));
+}
+
+// Function to return pipeline with its '$' words and patterns expanded, as a copy kept in
+// expansion when anything needed expanding. free_expansion() releases the copy. Returns
+// NULL, with the status set to 1, when a word could not be expanded: the caller must not
+// run the pipeline then.
+struct pipeline *expand_pipeline(struct pipeline *pipeline, struct expansion *expansion)
+{
+    struct glob_matches matches = {NULL, 0, 0};
+    int word_count = 0, redirect_count = 0, redirects = 0, needed = 0, failed = 0;
+
+    memset(expansion, 0, sizeof(*expansion));
+    substitution_status = -1;
+    for (int i = 0; i < pipeline->command_count; i++)
+    {
+        word_count += pipeline->commands[i].arg_count + 1;
+        redirect_count += pipeline->commands[i].redirect_count;
+        needed |= pipeline->commands[i].needs_expansion;
+    }
+    if (!needed)
+        return pipeline;
+
+    glob_begin();
+    expansion->commands = malloc(pipeline->command_count * sizeof(*expansion->commands));
+    expansion->words = malloc(word_count * sizeof(*expansion->words));
+    expansion->word_capacity = word_count;
+    expansion->redirects = malloc((redirect_count + 1) * sizeof(*expansion->redirects));
+    failed = !expansion->commands || !expansion->words || !expansion->redirects;
+
+    expansion->pipeline = *pipeline;
+    expansion->pipeline.commands = expansion->commands;
+    for (int i = 0; i < pipeline->command_count && !failed; i++)
+    {
+        const struct command *original = &pipeline->commands[i];
+        struct command *command = &expansion->commands[i];
+
+        *command = *original;
+        command->needs_expansion = 0;
+        command->arg_flags = NULL; // The words no longer line up with the parsed ones
+        command->arg_count = 0;
+        command->redirects = &expansion->redirects[redirects];
+        for (int j = 0; j < original->arg_count && !failed; j++)
+        {
+            int added = 1;
+
+            if (original->arg_flags[j] & ARG_EXPAND)
+                added = expand_argument(expansion, original->args[j], original->arg_flags[j], &matches);
+            else
+                failed = add_word(expansion, original->args[j]) == -1;
+            failed |= added == -1;
+            command->arg_count += added;
+        }
+        failed |= add_word(expansion, NULL) == -1;
+        for (int j = 0; j < original->redirect_count && !failed; j++)
+        {
+            command->redirects[j] = original->redirects[j];
+            if (original->redirects[j].target_flags & ARG_EXPAND)
+            {
+                const char *raw = original->redirects[j].target;
+                char *text = original->redirects[j].kind == REDIRECT_HERE_DOCUMENT ? expand_here_document(raw) : expand_word(raw);
+
+                command->redirects[j].target = keep_string(expansion, text);
+                failed = command->redirects[j].target == NULL;
+            }
+        }
+        redirects += original->redirect_count;
+    }
+    free(matches.paths);
+    if (failed)
+    {
+        perror("Expansion failed");
+        free_expansion(expansion);
+        last_status = 1;
+        return NULL;
+    }
+
+    for (int i = 0, words = 0; i < pipeline->command_count; i++)
+    { // The word array may have moved while it grew
+        expansion->commands[i].args = &expansion->words[words];
+        words += expansion->commands[i].arg_count + 1;
+    }
+    return &expansion->pipeline;
+}
@@ -0,0 +1,344 @@
+/**
+ * @file Glob.c
+ * @brief Pathname expansion over a cache of directory listings.
+ *
+ * glob_expand() matches a pattern one '/'-separated component at a time. A component
+ * without '*', '?' or '[...]' is taken as it is; any other is matched with fnmatch()
+ * against the entries of the directory reached so far. Names starting with '.' only
+ * match a pattern that starts with '.', and '.' and '..' never match. The matches of a
+ * pattern are sorted with strcmp(); a pattern that matches nothing is left to the caller.
+ *
+ * Directories are read with getdents64() into a 64 KiB buffer, and the names are kept
+ * in a small cache keyed by the directory's path. During one expansion (glob_begin()
+ * starts it, once per command) a listing is reused without even a stat, so
+ * 'cmd a*.c b*.c' reads the directory once. A later command reuses it when the directory
+ * still has the same device, inode and mtime, but only if the listing was taken at least
+ * a second after that mtime. A directory changed within the same timestamp tick as the
+ * listing would otherwise look unchanged, so such a listing is read again.
+ */
+
+#include <dirent.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define GLOB_CACHE_SIZE 8
+#define GLOB_DENTS_BUFFER_SIZE (64 * 1024)
+#define GLOB_RACY_NANOSECONDS 1000000000LL
+
+struct glob_directory
+{
+    char *path; // As written in the pattern, with its trailing '/'; "." for the current directory
+    dev_t device;
+    ino_t inode;
+    struct timespec mtime;
+    int trusted;              // Listed long enough after mtime to be reused by later commands
+    unsigned long generation; // The expansion that last used it
+    int in_use;               // Being walked; must not be evicted
+    char *names;              // Each entry's name, NUL-terminated, back to back
+    size_t names_size;
+    size_t names_capacity;
+    unsigned char *types; // d_type of each entry
+    int count;
+    int types_capacity;
+};
+
+struct glob_matches
+{
+    char **paths; // malloc'ed, owned by the caller once returned
+    int count;
+    int capacity;
+};
+
+static struct glob_directory glob_cache[GLOB_CACHE_SIZE];
+static unsigned long glob_generation;
+static char *glob_dents_buffer;
+
+// Function to start the expansions of one command; listings read from now on are trusted for it
+void glob_begin()
+{
+    glob_generation++;
+}
+
+// Function to tell whether a pattern component has an unescaped '*', '?' or '[...]'
+int has_glob_chars(const char *pattern, size_t length)
+{
+    int bracket = 0;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        if (pattern[i] == '\\')
+            i++;
+        else if (pattern[i] == '*' || pattern[i] == '?')
+            return 1;
+        else if (pattern[i] == '[')
+            bracket = 1;
+        else if (pattern[i] == ']' && bracket)
+            return 1;
+    }
+    return 0;
+}
+
+static void release_directory(struct glob_directory *directory)
+{
+    free(directory->path);
+    free(directory->names);
+    free(directory->types);
+    memset(directory, 0, sizeof(*directory));
+}
+
+static int add_directory_entry(struct glob_directory *directory, const char *name, unsigned char type)
+{
+    size_t length = strlen(name) + 1;
+
+    if (directory->names_size + length > directory->names_capacity)
+    {
+        size_t capacity = directory->names_capacity ? directory->names_capacity * 2 : 4096;
+        char *grown;
+
+        while (capacity < directory->names_size + length)
+            capacity *= 2;
+        grown = realloc(directory->names, capacity);
+        if (!grown)
+            return -1;
+        directory->names = grown;
+        directory->names_capacity = capacity;
+    }
+    if (directory->count == directory->types_capacity)
+    {
+        int capacity = directory->types_capacity ? directory->types_capacity * 2 : 256;
+        unsigned char *grown = realloc(directory->types, capacity);
+
+        if (!grown)
+            return -1;
+        directory->types = grown;
+        directory->types_capacity = capacity;
+    }
+    memcpy(directory->names + directory->names_size, name, length);
+    directory->names_size += length;
+    directory->types[directory->count++] = type;
+    return 0;
+}
+
+// Read the entries of the directory at path into an empty directory record
+static int read_directory(const char *path, struct glob_directory *directory)
+{
+    struct timespec now;
+    struct stat status;
+    ssize_t size;
+    int fd;
+
+    if (!glob_dents_buffer && !(glob_dents_buffer = malloc(GLOB_DENTS_BUFFER_SIZE)))
+        return -1;
+    fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    clock_gettime(CLOCK_REALTIME, &now);
+    if (fstat(fd, &status) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+    directory->device = status.st_dev;
+    directory->inode = status.st_ino;
+    directory->mtime = status.st_mtim;
+    directory->trusted = (now.tv_sec - status.st_mtim.tv_sec) * 1000000000LL + (now.tv_nsec - status.st_mtim.tv_nsec) >= GLOB_RACY_NANOSECONDS;
+
+    while ((size = getdents64(fd, glob_dents_buffer, GLOB_DENTS_BUFFER_SIZE)) > 0)
+    {
+        for (ssize_t offset = 0; offset < size;)
+        {
+            const struct dirent64 *entry = (const struct dirent64 *)(glob_dents_buffer + offset);
+            const char *name = entry->d_name;
+
+            offset += entry->d_reclen;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+                continue;
+            if (add_directory_entry(directory, name, entry->d_type) == -1)
+            {
+                close(fd);
+                return -1;
+            }
+        }
+    }
+    close(fd);
+    return size == -1 ? -1 : 0;
+}
+
+// Return the listing of path, from the cache when it is still valid. scratch holds the
+// listing when every cache slot is being walked; NULL when the directory cannot be read.
+static struct glob_directory *find_directory(const char *path, struct glob_directory *scratch)
+{
+    struct glob_directory *directory = NULL, *victim = NULL;
+    struct stat status;
+
+    for (int i = 0; i < GLOB_CACHE_SIZE; i++)
+    {
+        struct glob_directory *slot = &glob_cache[i];
+
+        if (slot->path && strcmp(slot->path, path) == 0)
+            directory = slot;
+        else if (!slot->in_use && (!victim || slot->generation < victim->generation))
+            victim = slot;
+    }
+
+    if (directory && directory->generation == glob_generation)
+        return directory;
+    if (directory && directory->trusted && stat(path, &status) == 0 && status.st_dev == directory->device &&
+        status.st_ino == directory->inode && status.st_mtim.tv_sec == directory->mtime.tv_sec &&
+        status.st_mtim.tv_nsec == directory->mtime.tv_nsec)
+    {
+        directory->generation = glob_generation;
+        return directory;
+    }
+
+    if (directory && directory->in_use)
+        directory = NULL; // Stale but still being walked; list it into scratch
+    if (!directory)
+        directory = victim ? victim : scratch;
+    release_directory(directory);
+    if (read_directory(path, directory) == -1 || !(directory->path = strdup(path)))
+    {
+        release_directory(directory);
+        return NULL;
+    }
+    directory->generation = glob_generation;
+    return directory;
+}
+
+static int add_match(struct glob_matches *matches, const char *path)
+{
+    char *copy;
+
+    if (matches->count == matches->capacity)
+    {
+        int capacity = matches->capacity ? matches->capacity * 2 : 16;
+        char **grown = realloc(matches->paths, capacity * sizeof(*grown));
+
+        if (!grown)
+            return -1;
+        matches->paths = grown;
+        matches->capacity = capacity;
+    }
+    copy = strdup(path);
+    if (!copy)
+        return -1;
+    matches->paths[matches->count++] = copy;
+    return 0;
+}
+
+// Tell whether the entry at path, of type d_type, is a directory or a link to one
+static int is_directory(const char *path, unsigned char type)
+{
+    struct stat status;
+
+    if (type == DT_DIR)
+        return 1;
+    if (type != DT_LNK && type != DT_UNKNOWN)
+        return 0;
+    return stat(path, &status) == 0 && S_ISDIR(status.st_mode);
+}
+
+static int glob_walk(char *path, size_t length, const char *pattern, struct glob_matches *matches);
+
+// Continue after path[0..length) has matched a component; rest follows its '/' or is NULL
+static int glob_matched(char *path, size_t length, unsigned char type, const char *rest, struct glob_matches *matches)
+{
+    if (!rest)
+        return add_match(matches, path);
+    if (!is_directory(path, type) || length + 2 > PATH_MAX)
+        return 0;
+    path[length++] = '/';
+    path[length] = '\0';
+    if (*rest == '\0') // The pattern ends in '/': only directories match
+        return add_match(matches, path);
+    return glob_walk(path, length, rest, matches);
+}
+
+// Match pattern against the entries under path[0..length), which is empty or ends in '/'
+static int glob_walk(char *path, size_t length, const char *pattern, struct glob_matches *matches)
+{
+    const char *end = strchr(pattern, '/');
+    size_t component_length = end ? (size_t)(end - pattern) : strlen(pattern);
+    const char *rest = end;
+    char component[PATH_MAX];
+    struct glob_directory scratch = {0}, *directory;
+    const char *name;
+    int result = 0;
+
+    if (component_length >= sizeof(component))
+        return 0;
+    while (rest && rest[1] == '/')
+        rest++;
+    if (rest)
+        rest++;
+
+    if (!has_glob_chars(pattern, component_length))
+    { // A literal component: no directory to read
+        struct stat status;
+
+        for (size_t i = 0; i < component_length; i++)
+        {
+            if (pattern[i] == '\\' && i + 1 < component_length)
+                i++;
+            if (length + 1 >= PATH_MAX)
+                return 0;
+            path[length++] = pattern[i];
+        }
+        path[length] = '\0';
+        if (lstat(path, &status) == -1)
+            return 0;
+        return glob_matched(path, length, S_ISLNK(status.st_mode) ? DT_LNK : S_ISDIR(status.st_mode) ? DT_DIR : DT_REG, rest, matches);
+    }
+
+    memcpy(component, pattern, component_length);
+    component[component_length] = '\0';
+    directory = find_directory(length ? path : ".", &scratch);
+    if (!directory)
+        return 0;
+
+    directory->in_use++;
+    name = directory->names;
+    for (int i = 0; i < directory->count && result == 0; i++, name += strlen(name) + 1)
+    {
+        size_t name_length = strlen(name);
+
+        if (fnmatch(component, name, FNM_PERIOD) != 0 || length + name_length + 1 >= PATH_MAX)
+            continue;
+        memcpy(path + length, name, name_length + 1);
+        result = glob_matched(path, length + name_length, directory->types[i], rest, matches);
+    }
+    directory->in_use--;
+    path[length] = '\0';
+    if (directory == &scratch)
+        release_directory(&scratch);
+    return result;
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Function to add the paths matching pattern to matches, sorted; returns how many were
+// added, or -1 when memory ran out. Backslashes in pattern quote the next character.
+int glob_expand(const char *pattern, struct glob_matches *matches)
+{
+    char path[PATH_MAX];
+    size_t length = 0;
+    int first = matches->count;
+
+    while (*pattern == '/')
+    {
+        path[0] = '/';
+        length = 1;
+        pattern++;
+    }
+    path[length] = '\0';
+    if (*pattern == '\0' || glob_walk(path, length, pattern, matches) == -1)
+        return *pattern == '\0' ? 0 : -1;
+    if (matches->count > first) // paths is still NULL when nothing has matched
+        qsort(matches->paths + first, matches->count - first, sizeof(*matches->paths), compare_paths);
+    return matches->count - first;
+}
@@ -0,0 +1,81 @@
+/**
+ * @file HereDocument.c
+ * @brief The descriptors that here-documents and here-strings are read from.
+ *
+ * '<<word', '<<-word' and '<<< word' never touch the filesystem. When the redirection is
+ * applied, open_here_document() puts the text into a descriptor of its own, and that
+ * descriptor is dup'ed onto the command's input like an opened file, so it works for any
+ * stage of a pipeline and for builtins run in the shell.
+ *
+ * A text that fits in a pipe's buffer is written into a new pipe whose write end is then
+ * closed: the write cannot block, and the reader sees the end of the input after the
+ * text. A larger one would fill the pipe before the command starts reading, so it goes
+ * into an anonymous file from memfd_create() instead, rewound to its start. Both are
+ * close-on-exec, like every descriptor the shell opens for a redirection.
+ */
+
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#define HERE_PIPE_MAX 65536 // The default pipe capacity; larger texts go straight to a memfd
+
+// Write length bytes of text, then a newline if newline is set; -1 on failure
+static int write_here_text(int fd, const char *text, size_t length, int newline)
+{
+    struct iovec parts[2] = {{(void *)text, length}, {"\n", newline ? 1 : 0}};
+    int first = 0;
+
+    while (first < 2)
+    {
+        ssize_t written = writev(fd, parts + first, 2 - first);
+
+        if (written == -1)
+            return -1;
+        while (first < 2 && (size_t)written >= parts[first].iov_len)
+            written -= parts[first++].iov_len;
+        if (first < 2)
+        {
+            parts[first].iov_base = (char *)parts[first].iov_base + written;
+            parts[first].iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+// A pipe holding the text, or -1 when it does not fit in the pipe's buffer
+static int here_pipe(const char *text, size_t length, int newline)
+{
+    int fds[2];
+
+    if (length + newline > HERE_PIPE_MAX || pipe2(fds, O_CLOEXEC) == -1)
+        return -1;
+    if (fcntl(fds[1], F_GETPIPE_SZ) < (int)(length + newline) || write_here_text(fds[1], text, length, newline) == -1)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    close(fds[1]);
+    return fds[0];
+}
+
+// Function to open a descriptor that reads the text of a HERE_DOCUMENT or HERE_STRING
+// redirection; a here-string gets a newline after its word. Returns -1 after reporting a failure.
+int open_here_document(const struct redirect *redirect)
+{
+    int newline = redirect->kind == REDIRECT_HERE_STRING;
+    size_t length = strlen(redirect->target);
+    int fd = here_pipe(redirect->target, length, newline);
+
+    if (fd != -1)
+        return fd;
+    fd = memfd_create("here-document", MFD_CLOEXEC);
+    if (fd == -1 || write_here_text(fd, redirect->target, length, newline) == -1 || lseek(fd, 0, SEEK_SET) == -1)
+    {
+        perror("Here-document failed");
+        if (fd != -1)
+            close(fd);
+        return -1;
+    }
+    return fd;
+}
@@ -0,0 +1,425 @@
+/**
+ * @file History.c
+ * @brief Command history kept as a ring of variable-length entries.
+ *
+ * Entry texts live in one circular string pool and the entries themselves in a ring of
+ * (offset, length) slots, so appending a command is O(1): once the ring is full the
+ * oldest slot is reused and its bytes in the pool are handed to the new text. The pool
+ * only grows when it cannot hold HISTSIZE entries, so memory follows the commands that are
+ * actually stored rather than a fixed-size row per entry.
+ *
+ * Every entry has an event number. Numbers keep increasing after the ring wraps, so
+ * '!<number>' refers to the same command for as long as it remains in the history.
+ *
+ * The history is persisted in $HISTFILE (default ~/.mysh_history), one command per line.
+ * Each command is appended with a single O_APPEND writev, so lines from concurrent
+ * shells never interleave. At startup the file is mmap'ed and scanned backwards, and
+ * only its last HISTSIZE lines are copied into the ring. Once the file grows past
+ * $MYSH_HISTFILE_LIMIT bytes, a background child rewrites it in place down to its last
+ * HISTSIZE lines. Keeping the same inode means other shells' descriptors stay valid.
+ *
+ * Each append holds a shared flock() on the file, and the child holds it exclusively
+ * from its fstat() to its ftruncate(), so no shell can append a line that the truncation
+ * would then cut off. An append that comes during a compaction waits for it, which takes
+ * no longer than reading and writing half of $MYSH_HISTFILE_LIMIT. A child that finds
+ * the lock taken gives up, and the next append starts another.
+ */
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#define DEFAULT_HISTSIZE 100
+#define MIN_HISTORY_POOL_SIZE 4096
+#define DEFAULT_HISTFILE_LIMIT (1024 * 1024)
+#define COMPACTION_LOCKED 2 // Exit status of a compaction child that found the file locked
+#define HISTFILE_NAME ".mysh_history"
+
+struct history_entry
+{
+    size_t offset; // Start of the text in history_pool
+    size_t length; // Length including the terminating NUL
+};
+
+static struct history_entry *history_entries; // Ring of history_capacity slots
+static int history_capacity;
+static int history_count;      // Entries currently stored
+static int history_oldest;     // Ring slot of the oldest entry
+static long history_base = 1;  // Event number of the oldest entry
+
+static char *history_pool;
+static size_t history_pool_size;
+static size_t history_pool_head; // Offset where the next text is written
+
+static int history_file_fd = -1;
+static char *history_file_path;
+static off_t history_file_size;     // Lower bound; other shells may have appended too
+static off_t history_file_limit;
+static pid_t history_compaction_pid;
+
+static void history_store(const char *text, size_t length);
+void history_index_add(long event, const char *text, size_t length);
+
+// Return the start of the last `count` lines of data; data itself if it holds fewer
+static const char *find_last_lines(const char *data, size_t size, int count)
+{
+    const char *cursor = data + size;
+    int lines = 0;
+
+    if (size > 0 && cursor[-1] == '\n')
+        cursor--; // The final newline does not start another line
+    while (cursor > data)
+    {
+        if (cursor[-1] == '\n' && ++lines == count)
+            return cursor;
+        cursor--;
+    }
+    return data;
+}
+
+// Open $HISTFILE for appending and load its last history_capacity lines
+static void history_load_file()
+{
+    const char *histfile = getenv("HISTFILE");
+    const char *limit = getenv("MYSH_HISTFILE_LIMIT");
+    char default_path[4096];
+    struct stat st;
+
+    if (!histfile)
+    {
+        const char *home = getenv("HOME");
+
+        if (!home)
+            return;
+        snprintf(default_path, sizeof(default_path), "%s/%s", home, HISTFILE_NAME);
+        histfile = default_path;
+    }
+    if (histfile[0] == '\0')
+        return; // An empty HISTFILE turns persistence off
+
+    history_file_limit = limit ? atoll(limit) : 0;
+    if (history_file_limit <= 0)
+        history_file_limit = DEFAULT_HISTFILE_LIMIT;
+
+    history_file_fd = open(histfile, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (history_file_fd == -1)
+    {
+        perror("Error opening history file");
+        return;
+    }
+    history_file_path = strdup(histfile);
+    if (fstat(history_file_fd, &st) == -1 || st.st_size == 0)
+        return;
+    history_file_size = st.st_size;
+
+    int read_fd = open(histfile, O_RDONLY | O_CLOEXEC);
+    char *map = read_fd == -1 ? MAP_FAILED : mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, read_fd, 0);
+    if (read_fd != -1)
+        close(read_fd);
+    if (map == MAP_FAILED)
+    {
+        perror("Error mapping history file");
+        return;
+    }
+
+    const char *start = find_last_lines(map, st.st_size, history_capacity);
+
+    // Index only the lines that were found
+    const char *end = map + st.st_size;
+    while (start < end)
+    {
+        const char *newline = memchr(start, '\n', end - start);
+        size_t length = newline ? (size_t)(newline - start) : (size_t)(end - start);
+
+        if (length > 0)
+            history_store(start, length);
+        start += length + 1;
+    }
+    munmap(map, st.st_size);
+}
+
+// Function to size the history from $HISTSIZE and load the history file
+void history_init()
+{
+    const char *histsize = getenv("HISTSIZE");
+
+    history_capacity = histsize ? atoi(histsize) : 0;
+    if (history_capacity <= 0)
+        history_capacity = DEFAULT_HISTSIZE;
+
+    history_entries = calloc(history_capacity, sizeof(*history_entries));
+    history_pool_size = (size_t)history_capacity * 64;
+    if (history_pool_size < MIN_HISTORY_POOL_SIZE)
+        history_pool_size = MIN_HISTORY_POOL_SIZE;
+    history_pool = malloc(history_pool_size);
+    if (!history_entries || !history_pool)
+    {
+        perror("history allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    history_load_file();
+}
+
+static struct history_entry *history_slot(int index)
+{
+    return &history_entries[(history_oldest + index) % history_capacity];
+}
+
+static void drop_oldest_history_entry()
+{
+    history_oldest = (history_oldest + 1) % history_capacity;
+    history_base++;
+    if (--history_count == 0)
+        history_pool_head = 0;
+}
+
+// Move every stored text to the front of a larger pool
+static int grow_history_pool(size_t min_size)
+{
+    size_t new_size = history_pool_size * 2;
+    size_t offset = 0;
+    char *new_pool;
+
+    while (new_size < min_size)
+        new_size *= 2;
+    new_pool = malloc(new_size);
+    if (!new_pool)
+        return -1;
+
+    for (int i = 0; i < history_count; i++)
+    {
+        struct history_entry *entry = history_slot(i);
+        memcpy(new_pool + offset, history_pool + entry->offset, entry->length);
+        entry->offset = offset;
+        offset += entry->length;
+    }
+    free(history_pool);
+    history_pool = new_pool;
+    history_pool_size = new_size;
+    history_pool_head = offset;
+    return 0;
+}
+
+// Find room for `needed` contiguous bytes, evicting or growing as required; returns the offset
+static size_t reserve_history_space(size_t needed)
+{
+    if (needed * 2 > history_pool_size && grow_history_pool(needed * 2) == -1)
+        return (size_t)-1;
+
+    while (1)
+    {
+        size_t tail;
+
+        if (history_count == 0)
+            return 0;
+
+        tail = history_slot(0)->offset;
+        if (history_pool_head > tail)
+        { // Used bytes are [tail, head): try the end, then wrap to the start
+            if (history_pool_size - history_pool_head >= needed)
+                return history_pool_head;
+            if (tail > needed)
+                return 0;
+        }
+        else if (tail - history_pool_head > needed)
+        { // Used bytes wrap around: the gap is [head, tail)
+            return history_pool_head;
+        }
+
+        // No gap is large enough. Only discard entries once HISTSIZE of them are kept.
+        if (history_count < history_capacity)
+        {
+            if (grow_history_pool(history_pool_size * 2) == -1)
+                return (size_t)-1;
+            continue;
+        }
+        drop_oldest_history_entry();
+    }
+}
+
+// Add length bytes of text to the ring as one entry
+static void history_store(const char *text, size_t length)
+{
+    size_t offset;
+    struct history_entry *entry;
+
+    if (history_count == history_capacity)
+        drop_oldest_history_entry();
+
+    offset = reserve_history_space(length + 1);
+    if (offset == (size_t)-1)
+    {
+        perror("history allocation failed");
+        return;
+    }
+
+    memcpy(history_pool + offset, text, length);
+    history_pool[offset + length] = '\0';
+    history_pool_head = offset + length + 1;
+
+    entry = history_slot(history_count);
+    entry->offset = offset;
+    entry->length = length + 1;
+    history_count++;
+
+    history_index_add(history_base + history_count - 1, history_pool + offset, length);
+}
+
+// Function to note that pid exited with status, when it is the compaction child, whichever
+// of history_reap_compaction() and reap_jobs() collected it. A child that found the file
+// locked is tried again on the next append.
+void history_compaction_exited(pid_t pid, int status)
+{
+    if (pid != history_compaction_pid || !(WIFEXITED(status) || WIFSIGNALED(status)))
+        return;
+    history_compaction_pid = 0;
+    if (WIFEXITED(status) && WEXITSTATUS(status) == COMPACTION_LOCKED)
+        history_file_size = history_file_limit + 1; // Still too large, as far as we know
+}
+
+// Collect a finished compaction child
+static void history_reap_compaction()
+{
+    int status;
+    pid_t pid;
+
+    if (history_compaction_pid <= 0)
+        return;
+    pid = waitpid(history_compaction_pid, &status, WNOHANG);
+    if (pid == history_compaction_pid)
+        history_compaction_exited(pid, status);
+    else if (pid == -1)
+        history_compaction_pid = 0;
+}
+
+// Rewrite the history file in place so that only its last history_capacity lines remain.
+// Runs in a child process and never keeps more than half the size limit, so the work
+// per compaction is bounded and the file does not cross the limit again right away.
+// Returns COMPACTION_LOCKED when an append or another compaction held the lock.
+static int compact_history_file()
+{
+    struct stat st;
+    char *tail;
+    off_t start;
+    ssize_t length;
+    // pwrite() ignores the offset on O_APPEND descriptors, so use a separate one
+    int fd = open(history_file_path, O_RDWR | O_CLOEXEC);
+
+    if (fd == -1)
+        return 0;
+    if (flock(fd, LOCK_EX | LOCK_NB) == -1)
+    {
+        int locked = errno == EWOULDBLOCK;
+
+        close(fd);
+        return locked ? COMPACTION_LOCKED : 0;
+    }
+    if (fstat(fd, &st) == -1 || st.st_size <= history_file_limit)
+    {
+        close(fd);
+        return 0;
+    }
+
+    start = st.st_size - history_file_limit / 2;
+    tail = malloc(st.st_size - start);
+    length = tail ? pread(fd, tail, st.st_size - start, start) : -1;
+    if (length <= 0)
+    {
+        free(tail);
+        close(fd);
+        return 0;
+    }
+
+    const char *keep_start = find_last_lines(tail, length, history_capacity);
+    if (keep_start == tail && start > 0)
+    { // The window starts mid-line; drop the partial line
+        const char *newline = memchr(tail, '\n', length);
+        keep_start = newline ? newline + 1 : tail + length;
+    }
+    ssize_t keep = keep_start - tail;
+
+    if (pwrite(fd, tail + keep, length - keep, 0) != length - keep ||
+        ftruncate(fd, length - keep) == -1)
+        perror("History compaction failed");
+    free(tail);
+    close(fd); // Releases the lock
+    return 0;
+}
+
+// Start a background compaction once the file has grown past its limit
+static void history_maybe_compact()
+{
+    struct stat st;
+    pid_t pid;
+
+    history_reap_compaction();
+    if (history_file_size <= history_file_limit || history_compaction_pid > 0)
+        return;
+    if (fstat(history_file_fd, &st) == -1)
+        return;
+    history_file_size = st.st_size;
+    if (st.st_size <= history_file_limit)
+        return;
+
+    pid = fork();
+    if (pid == 0)
+    {
+        _exit(compact_history_file());
+    }
+    else if (pid > 0)
+    {
+        history_compaction_pid = pid;
+        history_file_size = 0; // Unknown until the next check
+    }
+}
+
+// Function to save commands in history
+void add_to_history(const char *input)
+{
+    size_t length = strlen(input);
+
+    history_store(input, length);
+
+    if (history_file_fd != -1)
+    {
+        struct iovec line[2] = {{(void *)input, length}, {"\n", 1}};
+
+        // A single O_APPEND write keeps lines from concurrent shells intact. The shared lock
+        // keeps it out of a compaction's rewrite, and so may wait for one to finish.
+        flock(history_file_fd, LOCK_SH);
+        if (writev(history_file_fd, line, 2) > 0)
+            history_file_size += length + 1;
+        flock(history_file_fd, LOCK_UN);
+        history_maybe_compact();
+    }
+}
+
+// Function to return the event number of the oldest stored command
+long history_first_event()
+{
+    return history_base;
+}
+
+// Function to return the event number of the newest stored command (first - 1 when empty)
+long history_last_event()
+{
+    return history_base + history_count - 1;
+}
+
+// Function to fetch the command with the given event number, or NULL if it is not stored
+const char *history_lookup(long event)
+{
+    if (event < history_base || event >= history_base + history_count)
+        return NULL;
+    return history_pool + history_slot((int)(event - history_base))->offset;
+}
+
+// Function to display command history
+void print_history()
+{
+    for (int i = 0; i < history_count; i++)
+    {
+        printf("[%ld] %s\n", history_base + i, history_pool + history_slot(i)->offset);
+    }
+}
@@ -0,0 +1,239 @@
+/**
+ * @file HistorySearch.c
+ * @brief Incremental reverse search over the command history.
+ *
+ * Every stored command is indexed by the trigrams (3-byte substrings) it contains.
+ * A trigram maps to one of TRIGRAM_BUCKETS posting lists of event numbers, in the
+ * order they were added. Events that have left the history stay in the lists until
+ * they are trimmed, which happens lazily from the front as new events are appended.
+ *
+ * A search keeps one result set per query length, newest match first. Queries shorter
+ * than a trigram match almost everything, so they are not materialised: the current
+ * match is found by scanning back from the newest entry, which stops at the first hit.
+ * At three bytes the set is built from the query's posting list. Every later character
+ * filters the previous set, or the posting list of the newest trigram if that is
+ * smaller, rather than starting again. Removing a character goes back to the set one
+ * level down.
+ */
+
+#include <stdint.h>
+
+#define TRIGRAM_BUCKETS 65536
+#define MAX_SEARCH_QUERY 256
+
+struct posting_list
+{
+    uint32_t *events;
+    int start; // Entries before start are known to be evicted
+    int count;
+    int capacity;
+};
+
+struct history_search
+{
+    char query[MAX_SEARCH_QUERY + 1];
+    int length;
+    long *matches;                        // Result sets for every query length, stacked
+    int level_start[MAX_SEARCH_QUERY + 2]; // matches[level_start[n] .. level_start[n + 1]) match query[0..n)
+    int capacity;
+    int position;     // Index of the current match within the deepest set
+    long scan_event;  // Current match while the query is shorter than a trigram
+};
+
+static struct posting_list trigram_index[TRIGRAM_BUCKETS];
+
+static unsigned int trigram_bucket(const char *text)
+{
+    const unsigned char *bytes = (const unsigned char *)text;
+    return ((bytes[0] << 10) ^ (bytes[1] << 5) ^ bytes[2]) & (TRIGRAM_BUCKETS - 1);
+}
+
+// Function to add a newly stored history entry to the trigram index
+void history_index_add(long event, const char *text, size_t length)
+{
+    long oldest = history_first_event();
+
+    for (size_t i = 0; i + 3 <= length; i++)
+    {
+        struct posting_list *list = &trigram_index[trigram_bucket(text + i)];
+
+        if (list->count > list->start && list->events[list->count - 1] == (uint32_t)event)
+            continue; // Already listed for this entry
+
+        while (list->start < list->count && list->events[list->start] < oldest)
+            list->start++;
+        if (list->count == list->capacity && list->start > 0)
+        { // Reclaim the evicted prefix before growing
+            memmove(list->events, list->events + list->start, (list->count - list->start) * sizeof(uint32_t));
+            list->count -= list->start;
+            list->start = 0;
+        }
+        if (list->count == list->capacity)
+        {
+            int capacity = list->capacity ? list->capacity * 2 : 8;
+            uint32_t *events = realloc(list->events, capacity * sizeof(uint32_t));
+
+            if (!events)
+                return;
+            list->events = events;
+            list->capacity = capacity;
+        }
+        list->events[list->count++] = (uint32_t)event;
+    }
+}
+
+static int search_push(struct history_search *search, long event)
+{
+    int used = search->level_start[search->length + 1];
+
+    if (used == search->capacity)
+    {
+        int capacity = search->capacity ? search->capacity * 2 : 64;
+        long *matches = realloc(search->matches, capacity * sizeof(long));
+
+        if (!matches)
+            return -1;
+        search->matches = matches;
+        search->capacity = capacity;
+    }
+    search->matches[used] = event;
+    search->level_start[search->length + 1] = used + 1;
+    return 0;
+}
+
+// Function to start a new search with an empty query
+void history_search_begin(struct history_search *search)
+{
+    search->query[0] = '\0';
+    search->length = 0;
+    search->level_start[0] = 0;
+    search->level_start[1] = 0;
+    search->position = 0;
+    search->scan_event = -1;
+}
+
+void history_search_end(struct history_search *search)
+{
+    free(search->matches);
+    search->matches = NULL;
+    search->capacity = 0;
+}
+
+// Scan back from event for the newest entry containing the query
+static long search_scan(const struct history_search *search, long event)
+{
+    for (; event >= history_first_event(); event--)
+    {
+        if (strstr(history_lookup(event), search->query))
+            return event;
+    }
+    return -1;
+}
+
+// Function to extend the query by one character and narrow the result set
+int history_search_append(struct history_search *search, char c)
+{
+    int previous = search->length;
+    int from = search->level_start[previous], to = search->level_start[previous + 1];
+    const struct posting_list *list;
+
+    if (search->length == MAX_SEARCH_QUERY)
+        return -1;
+    search->query[search->length++] = c;
+    search->query[search->length] = '\0';
+    search->level_start[search->length + 1] = search->level_start[search->length];
+    search->position = 0;
+
+    if (search->length < 3)
+    {
+        search->scan_event = search_scan(search, history_last_event());
+        return 0;
+    }
+
+    list = &trigram_index[trigram_bucket(search->query + search->length - 3)];
+    if (search->length == 3 || list->count - list->start < to - from)
+    { // The posting list is the smaller candidate set
+        long oldest = history_first_event();
+
+        for (int i = list->count - 1; i >= list->start && list->events[i] >= oldest; i--)
+        {
+            const char *text = history_lookup(list->events[i]);
+
+            if (text && strstr(text, search->query) && search_push(search, list->events[i]) == -1)
+                return -1;
+        }
+        return 0;
+    }
+
+    for (int i = from; i < to; i++)
+    {
+        const char *text = history_lookup(search->matches[i]);
+
+        if (text && strstr(text, search->query) && search_push(search, search->matches[i]) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+// Function to drop the last query character, returning to the previous result set
+void history_search_backspace(struct history_search *search)
+{
+    if (search->length == 0)
+        return;
+    search->query[--search->length] = '\0';
+    search->position = 0;
+    if (search->length > 0 && search->length < 3)
+        search->scan_event = search_scan(search, history_last_event());
+}
+
+// Function to return the event number of the current match, or -1 if nothing matches
+long history_search_current(const struct history_search *search)
+{
+    int from = search->level_start[search->length], to = search->level_start[search->length + 1];
+
+    if (search->length < 3)
+        return search->length == 0 ? -1 : search->scan_event;
+    if (search->position >= to - from)
+        return -1;
+    return search->matches[from + search->position];
+}
+
+// Function to move to the next older match; returns 0 when there is none
+int history_search_older(struct history_search *search)
+{
+    int count = search->level_start[search->length + 1] - search->level_start[search->length];
+
+    if (search->length < 3)
+    {
+        long older = search->scan_event > 0 ? search_scan(search, search->scan_event - 1) : -1;
+
+        if (older == -1)
+            return 0;
+        search->scan_event = older;
+        return 1;
+    }
+    if (search->position + 1 >= count)
+        return 0;
+    search->position++;
+    return 1;
+}
+
+// Function to print every history entry containing text, newest first ('history -s')
+void print_history_matches(const char *text)
+{
+    struct history_search search = {0};
+
+    history_search_begin(&search);
+    for (const char *c = text; *c; c++)
+    {
+        if (history_search_append(&search, *c) == -1)
+            break;
+    }
+    for (long event = history_search_current(&search); event != -1; event = history_search_current(&search))
+    {
+        printf("[%ld] %s\n", event, history_lookup(event));
+        if (!history_search_older(&search))
+            break;
+    }
+    history_search_end(&search);
+}
@@ -0,0 +1,886 @@
+/**
+ * @file Jobs.c
+ * @brief Job table, SIGCHLD reaping and the job-control builtins.
+ *
+ * Every launched command or pipeline becomes a job with an ID, a process group and
+ * one job_process per stage. Processes are also linked into a hash table keyed by pid,
+ * so a status change reported by wait4() is matched to its job in O(1). The resource
+ * usage reported with an exit is kept per process for the 'time' keyword (Timing.c).
+ *
+ * SIGCHLD is read from the event loop's signalfd (Events.c), where it only sets a flag.
+ * The children are reaped from the main context by reap_jobs() with wait4(-1, WNOHANG),
+ * one call per event. wait_for_children() sleeps in the event loop, and the line editor
+ * sleeps there too, so a background job that finishes while the prompt is waiting for
+ * a key is reported at once.
+ *
+ * Free job IDs are kept in a list, so a new job gets one in O(1) and the table only grows
+ * to the most jobs alive at once. Without job control, finished background jobs are kept
+ * for 'wait' in the order they finished, and the oldest are dropped beyond MAX_KEPT_JOBS.
+ *
+ * Waiting for a job only waits for that job's own pids. Other children that exit in the
+ * meantime are left for reap_jobs(), so status is never collected for the wrong job.
+ *
+ * When the shell runs interactively on a terminal it does job control: it runs in its
+ * own process group, ignores the terminal stop/interrupt signals, and hands the terminal
+ * to whichever job is in the foreground. Background jobs always get a process group of
+ * their own, so 'kill %n' reaches every stage of a pipeline.
+ *
+ * With MYSH_CGROUP exported, each job also gets a cgroup v2 leaf (Cgroup.c) that its
+ * processes start in. 'jobs -l' then shows what the leaf has used, and 'cglimit' sets
+ * its cpu.max and memory.max while the job runs.
+ */
+
+#include <signal.h>
+#include <termios.h>
+#include <sys/resource.h>
+
+#define JOB_PID_BUCKETS 1024
+#define MAX_KEPT_JOBS 128 // Finished background jobs kept for 'wait' without job control
+
+enum job_state
+{
+    JOB_RUNNING,
+    JOB_STOPPED,
+    JOB_DONE
+};
+
+struct job;
+
+struct job_process
+{
+    pid_t pid;
+    int status; // Raw wait status once the process has stopped or exited
+    enum job_state state;
+    char name[16];        // Command name, cut short like /proc/<pid>/comm
+    struct rusage usage;  // Filled in when the process exits
+    struct job *job;
+    struct job_process *hash_next;
+};
+
+struct job
+{
+    int id;
+    pid_t pgid;    // Leader of the job's group; 0 until its first process starts
+    int own_group; // Non-zero when the job's processes get their own process group
+    char *command;
+    struct job_process *processes;
+    int process_count;
+    int process_capacity;
+    enum job_state state;
+    int is_background;
+    struct termios terminal_modes; // Saved when the job stops, restored by 'fg'
+    int has_terminal_modes;
+    int cgroup_fd; // The job's cgroup leaf, -1 without one
+    unsigned int cgroup_leaf;
+    int is_kept; // Finished, and in the queue of jobs kept for 'wait'
+    struct job *kept_prev, *kept_next;
+};
+
+void timing_record_job(const struct job *job);
+void coproc_job_freed(const struct job *job);
+void job_free(struct job *job);
+void reap_jobs();
+
+static struct job **job_table; // Indexed by job ID; slot 0 is unused
+static int *job_free_next;     // For each free ID, the next free one; 0 ends the list
+static int job_table_size;
+static int job_free_head;
+static struct job *kept_oldest, *kept_newest; // Queue of finished jobs kept for 'wait'
+static int kept_count;
+static int current_job, previous_job; // %+ and %-
+static struct job_process *job_pid_table[JOB_PID_BUCKETS];
+
+static int sigchld_pending;
+int interrupt_pending; // CTRL+C reached the shell itself, which only happens while it runs builtins
+
+int job_control;        // Non-zero when the shell controls a terminal
+int terminal_fd = -1;
+static pid_t shell_pgid;
+static struct termios shell_terminal_modes;
+
+static void note_sigchld()
+{
+    sigchld_pending = 1;
+}
+
+static void note_sigint()
+{
+    interrupt_pending = 1;
+}
+
+// Function to watch for SIGCHLD and, in an interactive shell on a terminal, take over job control
+void jobs_init(int interactive)
+{
+    events_on_signal(SIGCHLD, note_sigchld);
+
+    if (!interactive || !isatty(STDIN_FILENO))
+        return;
+
+    terminal_fd = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+    if (terminal_fd == -1)
+        return;
+
+    // Wait until the shell is in the foreground before taking the terminal
+    while (tcgetpgrp(terminal_fd) != (shell_pgid = getpgrp()))
+        kill(-shell_pgid, SIGTTIN);
+
+    int ignored[] = {SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU};
+    for (size_t i = 0; i < sizeof(ignored) / sizeof(ignored[0]); i++)
+    {
+        signal(ignored[i], SIG_IGN);
+        sigaddset(&spawn_default_signals, ignored[i]);
+    }
+    // A loop of builtins runs without a job, so CTRL+C must be able to stop the shell's own
+    // work. Blocked and read from the signalfd, SIGINT still never interrupts a system call.
+    if (events_on_signal(SIGINT, note_sigint) == 0)
+        signal(SIGINT, SIG_DFL);
+
+    shell_pgid = getpid();
+    if (setpgid(shell_pgid, shell_pgid) == -1 && errno != EPERM)
+    { // EPERM means the shell already leads its session
+        perror("setpgid failed");
+    }
+    shell_pgid = getpgrp();
+    tcsetpgrp(terminal_fd, shell_pgid);
+    tcgetattr(terminal_fd, &shell_terminal_modes);
+    job_control = 1;
+}
+
+static unsigned int job_pid_bucket(pid_t pid)
+{
+    return (unsigned int)pid % JOB_PID_BUCKETS;
+}
+
+// Function to create an empty job for a command line
+struct job *job_create(const char *command, int is_background)
+{
+    struct job *job = calloc(1, sizeof(*job));
+    int id;
+
+    if (!job)
+        return NULL;
+    reap_jobs();
+    while (kept_count >= MAX_KEPT_JOBS)
+        job_free(kept_oldest); // Its status is the one 'wait' is least likely to ask for
+    if (job_free_head == 0)
+    {
+        int size = job_table_size ? job_table_size * 2 : 16;
+        struct job **table = realloc(job_table, size * sizeof(*table));
+        int *free_next = table ? realloc(job_free_next, size * sizeof(*free_next)) : NULL;
+
+        if (table)
+            job_table = table;
+        if (!free_next)
+        {
+            free(job);
+            return NULL;
+        }
+        memset(table + job_table_size, 0, (size - job_table_size) * sizeof(*table));
+        for (int free_id = size - 1; free_id >= job_table_size && free_id > 0; free_id--)
+        { // The lowest new ID comes first
+            free_next[free_id] = job_free_head;
+            job_free_head = free_id;
+        }
+        job_free_next = free_next;
+        job_table_size = size;
+    }
+    id = job_free_head;
+    job_free_head = job_free_next[id];
+    job->id = id;
+    job->command = strdup(command);
+    job->state = JOB_RUNNING;
+    job->is_background = is_background;
+    job->own_group = job_control || is_background;
+    job->cgroup_fd = cgroup_create_leaf(&job->cgroup_leaf);
+    job_table[id] = job;
+    return job;
+}
+
+// Function to create a job whose text is the pipelines joined by '&&' or '||', with
+// the stages of each joined by '|'
+struct job *job_create_for_list(const struct pipeline *pipelines, int count)
+{
+    struct job *job;
+    size_t size = 1, used = 0;
+    char *text;
+
+    for (int p = 0; p < count; p++)
+    {
+        size += 4;
+        for (int stage = 0; stage < pipelines[p].command_count; stage++)
+        {
+            const struct command *command = &pipelines[p].commands[stage];
+
+            size += 3 + (command->compound ? strlen(compound_text(command->compound)) + 1 : 0);
+            for (int i = 0; command->args[i] != NULL; i++)
+                size += strlen(command->args[i]) + 1;
+        }
+    }
+    text = malloc(size);
+    if (!text)
+        return NULL;
+
+    text[0] = '\0';
+    for (int p = 0; p < count; p++)
+    {
+        if (p > 0)
+            used += snprintf(text + used, size - used, pipelines[p - 1].connector == LIST_AND ? " && " : " || ");
+        for (int stage = 0; stage < pipelines[p].command_count; stage++)
+        {
+            const struct command *command = &pipelines[p].commands[stage];
+
+            if (stage > 0)
+                used += snprintf(text + used, size - used, " | ");
+            if (command->compound)
+                used += snprintf(text + used, size - used, "%s", compound_text(command->compound));
+            for (int i = 0; command->args[i] != NULL; i++)
+                used += snprintf(text + used, size - used, i ? " %s" : "%s", command->args[i]);
+        }
+    }
+    job = job_create(text, pipelines[count - 1].is_background);
+    free(text);
+    return job;
+}
+
+// Function to create a job whose text is the pipeline's stages joined by '|'
+struct job *job_create_for_pipeline(const struct pipeline *pipeline)
+{
+    return job_create_for_list(pipeline, 1);
+}
+
+// Function to place the next process of a job in the job's process group and cgroup
+void job_plan_group(const struct job *job, struct spawn_plan *plan)
+{
+    if (job->cgroup_fd != -1)
+        spawn_plan_set_cgroup(plan, job->cgroup_fd);
+    if (!job->own_group)
+        return;
+    // Only the group leader needs to take the terminal
+    spawn_plan_set_group(plan, job->pgid, job_control && !job->is_background && job->pgid == 0 ? terminal_fd : -1);
+}
+
+static void job_link_processes(struct job *job)
+{
+    for (int i = 0; i < job->process_count; i++)
+    {
+        struct job_process *process = &job->processes[i];
+
+        process->hash_next = job_pid_table[job_pid_bucket(process->pid)];
+        job_pid_table[job_pid_bucket(process->pid)] = process;
+    }
+}
+
+static void job_unlink_processes(struct job *job)
+{
+    for (int i = 0; i < job->process_count; i++)
+    {
+        struct job_process **link = &job_pid_table[job_pid_bucket(job->processes[i].pid)];
+
+        while (*link && *link != &job->processes[i])
+            link = &(*link)->hash_next;
+        if (*link)
+            *link = job->processes[i].hash_next;
+    }
+}
+
+// Function to register a started process, running the command `name`, with its job
+int job_add_process(struct job *job, pid_t pid, const char *name)
+{
+    struct job_process *process;
+
+    if (job->process_count == job->process_capacity)
+    {
+        int capacity = job->process_capacity ? job->process_capacity * 2 : 4;
+        struct job_process *processes;
+
+        // The pid table points into the array, so take the processes out while it moves
+        job_unlink_processes(job);
+        processes = realloc(job->processes, capacity * sizeof(*processes));
+        if (processes)
+        {
+            job->processes = processes;
+            job->process_capacity = capacity;
+        }
+        job_link_processes(job);
+        if (!processes)
+            return -1;
+    }
+
+    process = &job->processes[job->process_count++];
+    process->pid = pid;
+    process->status = 0;
+    process->state = JOB_RUNNING;
+    snprintf(process->name, sizeof(process->name), "%s", name);
+    memset(&process->usage, 0, sizeof(process->usage));
+    process->job = job;
+    process->hash_next = job_pid_table[job_pid_bucket(pid)];
+    job_pid_table[job_pid_bucket(pid)] = process;
+
+    if (job->pgid == 0 && job->own_group)
+        job->pgid = pid;
+    return 0;
+}
+
+// Function to remove a job from the table and free it
+void job_free(struct job *job)
+{
+    coproc_job_freed(job);
+    job_unlink_processes(job);
+    if (current_job == job->id)
+    {
+        current_job = previous_job;
+        previous_job = 0;
+    }
+    else if (previous_job == job->id)
+    {
+        previous_job = 0;
+    }
+    if (job->is_kept)
+    {
+        *(job->kept_prev ? &job->kept_prev->kept_next : &kept_oldest) = job->kept_next;
+        *(job->kept_next ? &job->kept_next->kept_prev : &kept_newest) = job->kept_prev;
+        kept_count--;
+    }
+    job_table[job->id] = NULL;
+    job_free_next[job->id] = job_free_head; // Reused first, so IDs stay low
+    job_free_head = job->id;
+    cgroup_remove_leaf(job->cgroup_fd, job->cgroup_leaf);
+    free(job->processes);
+    free(job->command);
+    free(job);
+}
+
+// Make job the current job (%+)
+static void job_make_current(struct job *job)
+{
+    if (current_job != job->id)
+    {
+        previous_job = current_job;
+        current_job = job->id;
+    }
+}
+
+// Recompute a job's state from its processes
+static void job_update_state(struct job *job)
+{
+    int running = 0, stopped = 0;
+
+    for (int i = 0; i < job->process_count; i++)
+    {
+        if (job->processes[i].state == JOB_RUNNING)
+            running++;
+        else if (job->processes[i].state == JOB_STOPPED)
+            stopped++;
+    }
+    job->state = running ? JOB_RUNNING : stopped ? JOB_STOPPED : JOB_DONE;
+    if (job->state == JOB_DONE && job->is_background && !job_control && !job->is_kept)
+    { // Queued for 'wait', newest last
+        job->is_kept = 1;
+        job->kept_prev = kept_newest;
+        *(kept_newest ? &kept_newest->kept_next : &kept_oldest) = job;
+        kept_newest = job;
+        kept_count++;
+    }
+}
+
+// Function to record a status and resource usage reported by wait4() for pid
+void job_record_status(pid_t pid, int status, const struct rusage *usage)
+{
+    struct job_process *process = job_pid_table[job_pid_bucket(pid)];
+
+    while (process && process->pid != pid)
+        process = process->hash_next;
+    if (!process)
+    { // Not a job process (e.g. the history compaction child)
+        history_compaction_exited(pid, status);
+        return;
+    }
+
+    if (WIFSTOPPED(status))
+    {
+        process->state = JOB_STOPPED;
+        process->status = status;
+    }
+    else if (WIFCONTINUED(status))
+    {
+        process->state = JOB_RUNNING;
+    }
+    else
+    {
+        process->state = JOB_DONE;
+        process->status = status;
+        process->usage = *usage;
+    }
+    job_update_state(process->job);
+}
+
+// Function to collect every child whose state changed, without blocking
+void reap_jobs()
+{
+    struct rusage usage;
+    int status;
+    pid_t pid;
+
+    if (!sigchld_pending && events_poll_signals() == -1)
+        sigchld_pending = 1; // SIGCHLD is not being read, so look every time
+    if (!sigchld_pending)
+        return;
+    sigchld_pending = 0;
+    while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage)) > 0)
+        job_record_status(pid, status, &usage);
+}
+
+// Function to block until SIGCHLD reports a child, then collect every child that changed state
+void wait_for_children()
+{
+    siginfo_t info;
+
+    while (!sigchld_pending)
+    {
+        if (event_wait(-1) == -1)
+        { // No event loop: sleep in waitid() instead, leaving the child for reap_jobs()
+            if (waitid(P_ALL, 0, &info, WEXITED | WSTOPPED | WCONTINUED | WNOWAIT) == 0 || errno != EINTR)
+                sigchld_pending = 1;
+        }
+    }
+    reap_jobs();
+}
+
+// Describe how a job finished or why it is not running
+static void describe_job_state(const struct job *job, char *text, size_t size)
+{
+    const struct job_process *last = &job->processes[job->process_count - 1];
+
+    if (job->state == JOB_RUNNING)
+        snprintf(text, size, "Running");
+    else if (job->state == JOB_STOPPED)
+        snprintf(text, size, "Stopped");
+    else if (WIFSIGNALED(last->status))
+        snprintf(text, size, "%s", strsignal(WTERMSIG(last->status)));
+    else if (WEXITSTATUS(last->status) != 0)
+        snprintf(text, size, "Exit %d", WEXITSTATUS(last->status));
+    else
+        snprintf(text, size, "Done");
+}
+
+static void print_job(const struct job *job, int with_pids)
+{
+    char state[64];
+    char marker = job->id == current_job ? '+' : job->id == previous_job ? '-' : ' ';
+
+    describe_job_state(job, state, sizeof(state));
+    if (with_pids)
+    {
+        printf("[%d]%c %d %-22s%s\n", job->id, marker, (int)job->processes[0].pid, state, job->command);
+        for (int i = 1; i < job->process_count; i++)
+            printf("      %d\n", (int)job->processes[i].pid);
+        if (job->cgroup_fd != -1)
+            cgroup_print_usage(job->cgroup_fd);
+    }
+    else
+    {
+        printf("[%d]%c  %-24s%s\n", job->id, marker, state, job->command);
+    }
+}
+
+// Function to tell whether notify_finished_jobs() has anything to report
+int finished_jobs_pending()
+{
+    reap_jobs();
+    for (int id = 1; id < job_table_size && job_control; id++)
+    {
+        if (job_table[id] && job_table[id]->state == JOB_DONE && job_table[id]->is_background)
+            return 1;
+    }
+    return 0;
+}
+
+// Function to report and drop background jobs that finished since the last prompt. Without
+// job control they are neither reported nor dropped, so that 'wait' still gets their status
+// (but job_create() drops the oldest beyond MAX_KEPT_JOBS).
+void notify_finished_jobs()
+{
+    reap_jobs();
+    for (int id = 1; id < job_table_size; id++)
+    {
+        struct job *job = job_table[id];
+
+        if (job && job->state == JOB_DONE)
+        {
+            if (job->is_background && !job_control)
+                continue; // Kept, as in other shells, until 'wait' or 'jobs' collects it
+            if (job->is_background)
+                print_job(job, 0);
+            job_free(job);
+        }
+    }
+}
+
+// Function to announce a job that was just started in the background
+void job_announce_background(struct job *job)
+{
+    job_make_current(job);
+    if (job_control)
+        printf("[%d] %d\n", job->id, (int)job->processes[job->process_count - 1].pid);
+}
+
+// Send a signal to every process of a job
+static int signal_job(struct job *job, int sig)
+{
+    if (job->pgid > 0)
+        return kill(-job->pgid, sig);
+    for (int i = 0; i < job->process_count; i++)
+    {
+        if (job->processes[i].state != JOB_DONE && kill(job->processes[i].pid, sig) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+// Block until the job is no longer running, waiting only on the job's own pids
+static void wait_for_job(struct job *job)
+{
+    for (int i = 0; i < job->process_count && job->state == JOB_RUNNING; i++)
+    {
+        struct job_process *process = &job->processes[i];
+        struct rusage usage;
+        int status;
+        pid_t pid;
+
+        if (process->state != JOB_RUNNING)
+            continue;
+        do
+            pid = wait4(process->pid, &status, WUNTRACED, &usage);
+        while (pid == -1 && errno == EINTR);
+
+        if (pid == -1)
+        { // Already collected elsewhere; count it as finished
+            process->state = JOB_DONE;
+            job_update_state(job);
+            continue;
+        }
+        job_record_status(pid, status, &usage);
+    }
+}
+
+// Function to convert a raw wait status to a shell exit status
+int exit_status_of(int status)
+{
+    if (WIFEXITED(status))
+        return WEXITSTATUS(status);
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    if (WIFSTOPPED(status))
+        return 128 + WSTOPSIG(status);
+    return 0;
+}
+
+// Function to run a job in the foreground until it finishes or stops.
+// Returns 0 once the job has finished (and been freed), 1 if it stopped.
+int job_wait_foreground(struct job *job)
+{
+    job->is_background = 0;
+    wait_for_job(job);
+
+    if (job_control)
+    {
+        if (job->state == JOB_STOPPED)
+        {
+            tcgetattr(terminal_fd, &job->terminal_modes);
+            job->has_terminal_modes = 1;
+        }
+        tcsetpgrp(terminal_fd, shell_pgid);
+        tcsetattr(terminal_fd, TCSADRAIN, &shell_terminal_modes);
+    }
+
+    last_status = exit_status_of(job->processes[job->process_count - 1].status);
+    if (job->state == JOB_STOPPED)
+    {
+        job->is_background = 1;
+        job_make_current(job);
+        printf("\n");
+        print_job(job, 0);
+        return 1;
+    }
+    else
+    {
+        const struct job_process *last = &job->processes[job->process_count - 1];
+
+        if (WIFSIGNALED(last->status) && WTERMSIG(last->status) == SIGINT)
+            printf("\n"); // Keep the prompt off the ^C line
+        timing_record_job(job);
+        job_free(job);
+    }
+    return 0;
+}
+
+// Resolve a job specification (%n, %%, %+, %-, %prefix); NULL selects the current job
+static struct job *find_job(const char *spec)
+{
+    int id;
+
+    if (spec == NULL || strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0 || strcmp(spec, "%") == 0)
+        id = current_job;
+    else if (strcmp(spec, "%-") == 0)
+        id = previous_job;
+    else if (spec[0] == '%' && spec[1] >= '0' && spec[1] <= '9')
+        id = atoi(spec + 1);
+    else
+    {
+        const char *prefix = spec[0] == '%' ? spec + 1 : spec;
+        size_t length = strlen(prefix);
+
+        for (id = job_table_size - 1; id > 0; id--)
+        {
+            if (job_table[id] && strncmp(job_table[id]->command, prefix, length) == 0)
+                break;
+        }
+    }
+
+    if (id <= 0 || id >= job_table_size || job_table[id] == NULL)
+    {
+        fprintf(stderr, "%s: no such job\n", spec ? spec : "current");
+        last_status = 1;
+        return NULL;
+    }
+    return job_table[id];
+}
+
+// Function to implement 'jobs [-l]'
+void builtin_jobs(char **args)
+{
+    int with_pids = args[1] != NULL && strcmp(args[1], "-l") == 0;
+
+    reap_jobs();
+    for (int id = 1; id < job_table_size; id++)
+    {
+        struct job *job = job_table[id];
+
+        if (job)
+        {
+            print_job(job, with_pids);
+            if (job->state == JOB_DONE)
+                job_free(job);
+        }
+    }
+}
+
+// Function to implement 'cglimit [%job] name=value...', setting cpu.max or memory.max of a
+// job's cgroup while it runs
+void builtin_cglimit(char **args)
+{
+    int i = args[1] != NULL && args[1][0] == '%' ? 2 : 1;
+    struct job *job;
+
+    if (args[i] == NULL)
+    {
+        message(stderr, CGLIMIT_USAGE_MESSAGE);
+        last_status = 2;
+        return;
+    }
+    job = find_job(i == 2 ? args[1] : NULL);
+    if (!job)
+        return;
+    if (job->cgroup_fd == -1)
+    {
+        fprintf(stderr, CGROUP_OFF_MESSAGE, "cglimit");
+        last_status = 1;
+        return;
+    }
+    for (; args[i] != NULL; i++)
+    {
+        char *equals = strchr(args[i], '=');
+        char name[16];
+
+        if (!equals || equals - args[i] >= (int)sizeof(name))
+        {
+            message(stderr, CGLIMIT_USAGE_MESSAGE);
+            last_status = 2;
+            return;
+        }
+        snprintf(name, sizeof(name), "%.*s", (int)(equals - args[i]), args[i]);
+        if (!cgroup_is_limit(name))
+        {
+            message(stderr, CGLIMIT_USAGE_MESSAGE);
+            last_status = 2;
+            return;
+        }
+        if (cgroup_set_limit(job->cgroup_fd, name, equals + 1) == -1)
+            last_status = 1;
+    }
+}
+
+// Function to implement 'fg [%job]'
+void builtin_fg(char **args)
+{
+    struct job *job = find_job(args[1]);
+
+    if (!job)
+        return;
+    printf("%s\n", job->command);
+    job_make_current(job);
+    if (job_control)
+    {
+        if (job->has_terminal_modes)
+            tcsetattr(terminal_fd, TCSADRAIN, &job->terminal_modes);
+        tcsetpgrp(terminal_fd, job->pgid);
+    }
+    if (job->state == JOB_STOPPED)
+    {
+        for (int i = 0; i < job->process_count; i++)
+        {
+            if (job->processes[i].state == JOB_STOPPED)
+                job->processes[i].state = JOB_RUNNING;
+        }
+        job->state = JOB_RUNNING;
+        signal_job(job, SIGCONT);
+    }
+    job_wait_foreground(job);
+}
+
+// Function to implement 'bg [%job]'
+void builtin_bg(char **args)
+{
+    struct job *job = find_job(args[1]);
+
+    if (!job)
+        return;
+    job->is_background = 1;
+    job_make_current(job);
+    if (job->state == JOB_STOPPED)
+    {
+        for (int i = 0; i < job->process_count; i++)
+        {
+            if (job->processes[i].state == JOB_STOPPED)
+                job->processes[i].state = JOB_RUNNING;
+        }
+        job->state = JOB_RUNNING;
+        signal_job(job, SIGCONT);
+    }
+    printf("[%d]+ %s &\n", job->id, job->command);
+}
+
+// Function to implement 'wait [%job|pid...]': without arguments, wait for every job
+void builtin_wait(char **args)
+{
+    if (args[1] == NULL)
+    {
+        for (int id = 1; id < job_table_size; id++)
+        {
+            if (job_table[id] && job_table[id]->state == JOB_RUNNING)
+                wait_for_job(job_table[id]);
+        }
+        notify_finished_jobs();
+        for (int id = 1; id < job_table_size; id++)
+        {
+            if (job_table[id] && job_table[id]->state == JOB_DONE)
+                job_free(job_table[id]);
+        }
+        return;
+    }
+
+    for (int i = 1; args[i] != NULL; i++)
+    {
+        struct job *job = NULL;
+        struct job_process *process = NULL;
+
+        if (args[i][0] == '%')
+        {
+            job = find_job(args[i]);
+        }
+        else
+        {
+            process = job_pid_table[job_pid_bucket(atoi(args[i]))];
+            while (process && process->pid != atoi(args[i]))
+                process = process->hash_next;
+            if (process)
+                job = process->job;
+            else
+            {
+                fprintf(stderr, "wait: pid %s is not a child of this shell\n", args[i]);
+                last_status = 127;
+            }
+        }
+        if (job)
+        { // The status of the pid waited for, or of the job's last process
+            wait_for_job(job);
+            if (!process && job->process_count > 0)
+                process = &job->processes[job->process_count - 1];
+            if (process)
+                last_status = exit_status_of(process->status);
+            if (job->state == JOB_DONE)
+                job_free(job);
+        }
+    }
+    notify_finished_jobs();
+}
+
+static const struct
+{
+    const char *name;
+    int number;
+} signal_names[] = {
+    {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"KILL", SIGKILL}, {"USR1", SIGUSR1},
+    {"USR2", SIGUSR2}, {"TERM", SIGTERM}, {"CONT", SIGCONT}, {"STOP", SIGSTOP}, {"TSTP", SIGTSTP},
+};
+
+static int parse_signal(const char *name)
+{
+    if (name[0] >= '0' && name[0] <= '9')
+        return atoi(name);
+    if (strncmp(name, "SIG", 3) == 0)
+        name += 3;
+    for (size_t i = 0; i < sizeof(signal_names) / sizeof(signal_names[0]); i++)
+    {
+        if (strcmp(signal_names[i].name, name) == 0)
+            return signal_names[i].number;
+    }
+    return -1;
+}
+
+// Function to implement 'kill [-SIGNAL] %job|pid...'
+void builtin_kill(char **args)
+{
+    int sig = SIGTERM, i = 1;
+
+    if (args[1] != NULL && args[1][0] == '-')
+    {
+        sig = parse_signal(args[1] + 1);
+        if (sig <= 0)
+        {
+            fprintf(stderr, "kill: %s: invalid signal specification\n", args[1] + 1);
+            last_status = 1;
+            return;
+        }
+        i = 2;
+    }
+    if (args[i] == NULL)
+    {
+        message(stderr, KILL_USAGE_MESSAGE);
+        last_status = 2;
+        return;
+    }
+
+    for (; args[i] != NULL; i++)
+    {
+        if (args[i][0] == '%')
+        {
+            struct job *job = find_job(args[i]);
+
+            if (!job)
+                last_status = 1;
+            else if (signal_job(job, sig) == -1)
+            {
+                perror("kill");
+                last_status = 1;
+            }
+            else if (job->state == JOB_STOPPED && sig != SIGCONT && sig != SIGSTOP && sig != SIGTSTP)
+                signal_job(job, SIGCONT); // A stopped job would only see the signal once continued
+        }
+        else if (kill(atoi(args[i]), sig) == -1)
+        {
+            perror("kill");
+            last_status = 1;
+        }
+    }
+}
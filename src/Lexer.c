@@ -0,0 +1,456 @@
+/**
+ * @file Lexer.c
+ * @brief Single-pass tokenizer for shell input.
+ *
+ * tokenize() walks the input once and records each token as an (offset, length, kind)
+ * view into the input buffer; nothing is copied. The tokens go into a list provided by
+ * the caller, which doubles as needed: inside the command's arena (Arena.c) for a line,
+ * or with realloc for a whole script, so there is no limit on the number of tokens. Word tokens
+ * keep their quotes and backslashes in the view, and WORD_QUOTED marks the ones that need
+ * quote removal, which is done later in place by the parser. WORD_DOLLAR marks words
+ * that contain a '$', and WORD_GLOB those with an unquoted '*', '?' or '[...]' pattern;
+ * both are expanded when they run. A command substitution, '$(...)' or '`...`', is part
+ * of the word it appears in, whatever operators, blanks and quotes it holds, and also
+ * sets WORD_DOLLAR. The lexer keeps no global
+ * state, so any number of inputs can be tokenized at once.
+ *
+ * Recognised operators: | || & && ; < > >> <& >& << <<- <<< ( ) and newline. A word made
+ * only of digits directly followed by '<' or '>' is an IO_NUMBER naming the redirected
+ * descriptor, as in 2> or 2>&1. A '#' at the start of a word starts a comment that
+ * runs to the end of the line.
+ *
+ * The body of a here-document is not tokenized. The delimiter word after '<<' or '<<-' is
+ * followed by a TOKEN_HEREDOC whose view is filled in at the end of the line: the lines
+ * that follow, up to the one that is the delimiter, are the body, and tokenizing resumes
+ * after it. WORD_DOLLAR marks a body that needs expansion, which only an unquoted
+ * delimiter allows, and the number of lines it took is kept in the upper flag bits
+ * (HEREDOC_LINES), since they hold no NEWLINE tokens. Input that ends before a delimiter
+ * sets `incomplete` in the list.
+ */
+
+enum token_kind
+{
+    TOKEN_WORD,
+    TOKEN_PIPE,      // |
+    TOKEN_OR_IF,     // ||
+    TOKEN_AMP,       // &
+    TOKEN_AND_IF,    // &&
+    TOKEN_SEMI,      // ;
+    TOKEN_LESS,      // <
+    TOKEN_GREAT,     // >
+    TOKEN_DGREAT,    // >>
+    TOKEN_LESSAND,   // <&
+    TOKEN_GREATAND,  // >&
+    TOKEN_DLESS,     // <<
+    TOKEN_DLESSDASH, // <<-
+    TOKEN_TLESS,     // <<<
+    TOKEN_LPAREN,    // (
+    TOKEN_RPAREN,    // )
+    TOKEN_IO_NUMBER, // The 2 in 2>
+    TOKEN_NEWLINE,   // \n
+    TOKEN_HEREDOC,   // A here-document's body, after the delimiter word
+    TOKEN_END
+};
+
+#define WORD_QUOTED 0x1 // The word contains quotes or backslashes
+#define WORD_DOLLAR 0x2 // The word contains '$' and may need expansion
+#define WORD_GLOB 0x4   // The word contains an unquoted '*', '?' or '[...]'
+#define HEREDOC_LINE_SHIFT 8
+#define HEREDOC_LINES(token) ((token)->flags >> HEREDOC_LINE_SHIFT) // Lines a TOKEN_HEREDOC spans
+
+struct token
+{
+    size_t offset;
+    size_t length;
+    enum token_kind kind;
+    int flags;
+};
+
+struct token_list
+{
+    struct token *tokens;
+    int count; // Excluding the closing TOKEN_END
+    int capacity;
+    struct arena *arena; // Where the list grows; NULL for heap storage grown with realloc
+    int incomplete;      // The input ended inside a here-document
+};
+
+static const char *const token_names[] = {"word", "|", "||", "&", "&&", ";", "<", ">", ">>", "<&", ">&", "<<", "<<-", "<<<", "(", ")", "number", "newline", "here-document", "end of input"};
+
+// Function to return a printable name for a token kind
+const char *token_name(enum token_kind kind)
+{
+    return token_names[kind];
+}
+
+static int is_blank(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+static int is_operator_char(char c)
+{
+    return c == '|' || c == '&' || c == ';' || c == '<' || c == '>' || c == '(' || c == ')' || c == '\n';
+}
+
+// Make sure there is room for one more token besides the closing TOKEN_END
+static int reserve_token(struct token_list *list)
+{
+    if (list->count >= list->capacity - 1)
+    {
+        int capacity = list->capacity ? list->capacity * 2 : 64;
+        struct token *tokens;
+
+        if (list->arena)
+        { // The old array stays in the arena until it is reset
+            tokens = arena_alloc(list->arena, capacity * sizeof(*tokens));
+            if (tokens && list->count > 0)
+                memcpy(tokens, list->tokens, list->count * sizeof(*tokens));
+        }
+        else
+        {
+            tokens = realloc(list->tokens, capacity * sizeof(*tokens));
+        }
+        if (!tokens)
+        {
+            perror("Token allocation failed");
+            return -1;
+        }
+        list->tokens = tokens;
+        list->capacity = capacity;
+    }
+    return 0;
+}
+
+static int add_token(struct token_list *list, size_t offset, size_t length, enum token_kind kind, int flags)
+{
+    if (reserve_token(list) == -1)
+        return -1;
+    list->tokens[list->count].offset = offset;
+    list->tokens[list->count].length = length;
+    list->tokens[list->count].kind = kind;
+    list->tokens[list->count].flags = flags;
+    list->count++;
+    return 0;
+}
+
+// Scan an operator at input[i]; returns its length
+static size_t scan_operator(const char *input, size_t i, enum token_kind *kind)
+{
+    char c = input[i], next = input[i + 1];
+
+    switch (c)
+    {
+    case '|':
+        *kind = next == '|' ? TOKEN_OR_IF : TOKEN_PIPE;
+        return next == '|' ? 2 : 1;
+    case '&':
+        *kind = next == '&' ? TOKEN_AND_IF : TOKEN_AMP;
+        return next == '&' ? 2 : 1;
+    case '>':
+        *kind = next == '>' ? TOKEN_DGREAT : next == '&' ? TOKEN_GREATAND : TOKEN_GREAT;
+        return next == '>' || next == '&' ? 2 : 1;
+    case '<':
+        if (next == '<')
+        {
+            *kind = input[i + 2] == '<' ? TOKEN_TLESS : input[i + 2] == '-' ? TOKEN_DLESSDASH : TOKEN_DLESS;
+            return *kind == TOKEN_DLESS ? 2 : 3;
+        }
+        *kind = next == '&' ? TOKEN_LESSAND : TOKEN_LESS;
+        return next == '&' ? 2 : 1;
+    case ';':
+        *kind = TOKEN_SEMI;
+        return 1;
+    case '(':
+        *kind = TOKEN_LPAREN;
+        return 1;
+    case ')':
+        *kind = TOKEN_RPAREN;
+        return 1;
+    default:
+        *kind = TOKEN_NEWLINE;
+        return 1;
+    }
+}
+
+size_t scan_substitution(const char *input, size_t i);
+
+// Function to find the end of a '`...`' substitution whose text starts at input[i]; returns
+// the offset after the closing '`', or (size_t)-1 when there is none
+size_t scan_backquote(const char *input, size_t i)
+{
+    while (input[i] != '`')
+    {
+        if (input[i] == '\0')
+            return (size_t)-1;
+        i += input[i] == '\\' && input[i + 1] != '\0' ? 2 : 1;
+    }
+    return i + 1;
+}
+
+// Skip a "..." string whose text starts at input[i], with the substitutions it holds;
+// returns the offset after the closing quote, or (size_t)-1 when there is none
+static size_t scan_double_quotes(const char *input, size_t i, int *flags)
+{
+    while (input[i] != '"')
+    {
+        if (input[i] == '\0')
+            return (size_t)-1;
+        if (input[i] == '$' || input[i] == '`')
+            *flags |= WORD_DOLLAR;
+        if (input[i] == '$' && input[i + 1] == '(')
+            i = scan_substitution(input, i + 2);
+        else if (input[i] == '`')
+            i = scan_backquote(input, i + 1);
+        else
+            i += input[i] == '\\' && input[i + 1] != '\0' ? 2 : 1;
+        if (i == (size_t)-1)
+            return i;
+    }
+    return i + 1;
+}
+
+// Function to find the end of a '$(...)' substitution whose command starts at input[i];
+// returns the offset after the closing ')', or (size_t)-1 when there is none
+size_t scan_substitution(const char *input, size_t i)
+{
+    int depth = 0, flags = 0;
+
+    while (input[i] != ')' || depth > 0)
+    {
+        char c = input[i];
+
+        if (c == '\0')
+            return (size_t)-1;
+        if (c == '\\')
+        {
+            i += input[i + 1] != '\0' ? 2 : 1;
+            continue;
+        }
+        if (c == '\'')
+        {
+            const char *end = strchr(input + i + 1, '\'');
+
+            if (!end)
+                return (size_t)-1;
+            i = end - input + 1;
+            continue;
+        }
+        if (c == '"')
+            i = scan_double_quotes(input, i + 1, &flags);
+        else if (c == '`')
+            i = scan_backquote(input, i + 1);
+        else if (c == '$' && input[i + 1] == '(')
+            i = scan_substitution(input, i + 2);
+        else
+        {
+            depth += c == '(' ? 1 : c == ')' ? -1 : 0;
+            i++;
+        }
+        if (i == (size_t)-1)
+            return i;
+    }
+    return i + 1;
+}
+
+// Scan a word starting at input[i]; returns its end offset or (size_t)-1 on an unterminated
+// quote or substitution
+static size_t scan_word(const char *input, size_t i, int *flags)
+{
+    int bracket = 0;
+    size_t parameter = (size_t)-1; // Just after an unquoted '$', where '*' and '?' are parameters
+
+    *flags = 0;
+    while (input[i] != '\0' && !is_blank(input[i]) && !is_operator_char(input[i]))
+    {
+        char c = input[i];
+
+        if ((c == '$' && input[i + 1] == '(') || c == '`')
+        {
+            *flags |= WORD_DOLLAR;
+            i = c == '`' ? scan_backquote(input, i + 1) : scan_substitution(input, i + 2);
+            if (i == (size_t)-1)
+                return i;
+        }
+        else if (c == '"')
+        {
+            *flags |= WORD_QUOTED;
+            i = scan_double_quotes(input, i + 1, flags);
+            if (i == (size_t)-1)
+                return i;
+        }
+        else if (c == '\\')
+        {
+            *flags |= WORD_QUOTED;
+            i += input[i + 1] != '\0' ? 2 : 1;
+        }
+        else if (c == '\'')
+        {
+            *flags |= WORD_QUOTED;
+            i++;
+            while (input[i] != c)
+            {
+                if (input[i] == '\0')
+                    return (size_t)-1;
+                if (input[i] == '$')
+                    *flags |= WORD_DOLLAR;
+                i++;
+            }
+            i++;
+        }
+        else
+        {
+            if (c == '$')
+            {
+                *flags |= WORD_DOLLAR;
+                parameter = i == parameter ? (size_t)-1 : i + 1; // '$$' is the whole parameter
+            }
+            else if (c == '*' || c == '?' || (c == ']' && bracket))
+            {
+                if (i != parameter) // '$*' and '$?' are parameters, not patterns
+                    *flags |= WORD_GLOB;
+            }
+            else if (c == '[')
+                bracket = 1;
+            i++;
+        }
+    }
+    return i;
+}
+
+// Tell whether a line of length bytes is the here-document delimiter word, once the word's
+// quotes are removed
+static int is_delimiter(const char *line, size_t length, const char *word, size_t word_length)
+{
+    size_t matched = 0;
+
+    for (size_t k = 0; k < word_length; k++)
+    {
+        if (word[k] == '\'' || word[k] == '"')
+            continue;
+        if (word[k] == '\\' && k + 1 < word_length)
+            k++;
+        if (matched == length || line[matched] != word[k])
+            return 0;
+        matched++;
+    }
+    return matched == length;
+}
+
+// Read the bodies of the here-documents among tokens[from...], which start at input[i] after
+// the newline ending their line; returns the offset after the last delimiter line, or
+// (size_t)-1 when the input ends first
+static size_t scan_here_documents(const char *input, size_t i, struct token_list *list, int from)
+{
+    for (int k = from; k < list->count; k++)
+    {
+        struct token *body = &list->tokens[k];
+        const struct token *word;
+        int strip, lines = 0, expands = 0;
+
+        if (body->kind != TOKEN_HEREDOC)
+            continue;
+        word = &list->tokens[k - 1]; // A body always follows its operator and word
+        strip = list->tokens[k - 2].kind == TOKEN_DLESSDASH;
+        body->offset = i;
+        while (1)
+        {
+            size_t start = i, end = i + strcspn(input + i, "\n");
+
+            while (strip && input[start] == '\t')
+                start++;
+            lines++;
+            if (is_delimiter(input + start, end - start, input + word->offset, word->length))
+            {
+                body->length = i - body->offset;
+                i = input[end] == '\n' ? end + 1 : end;
+                break;
+            }
+            if (input[end] == '\0')
+                return (size_t)-1;
+            for (size_t c = start; c < end && !expands; c++)
+                expands = input[c] == '$' || input[c] == '\\' || input[c] == '`';
+            i = end + 1;
+        }
+        body->flags = (lines << HEREDOC_LINE_SHIFT) | (expands && !(word->flags & WORD_QUOTED) ? WORD_DOLLAR : 0);
+    }
+    return i;
+}
+
+// Function to split input into tokens in one pass; returns 0 on success, -1 on a syntax error
+int tokenize(const char *input, struct token_list *list)
+{
+    size_t i = 0;
+    int line_start = 0, here_documents = 0; // The line's first token, and its '<<' bodies to read
+
+    list->count = 0;
+    list->incomplete = 0;
+    if (list->capacity == 0 && reserve_token(list) == -1)
+        return -1;
+    while (input[i] != '\0')
+    {
+        if (is_blank(input[i]))
+        {
+            i++;
+        }
+        else if (input[i] == '#')
+        { // Comment up to the end of the line
+            while (input[i] != '\0' && input[i] != '\n')
+                i++;
+        }
+        else if (is_operator_char(input[i]))
+        {
+            enum token_kind kind;
+            size_t length = scan_operator(input, i, &kind);
+
+            if (add_token(list, i, length, kind, 0) == -1)
+                return -1;
+            i += length;
+            if (kind == TOKEN_NEWLINE && here_documents > 0)
+            {
+                i = scan_here_documents(input, i, list, line_start);
+                if (i == (size_t)-1)
+                {
+                    list->incomplete = 1;
+                    return -1;
+                }
+                here_documents = 0;
+            }
+            if (kind == TOKEN_NEWLINE)
+                line_start = list->count;
+        }
+        else
+        {
+            int flags;
+            size_t end = scan_word(input, i, &flags);
+            enum token_kind kind = TOKEN_WORD;
+
+            if (end == (size_t)-1)
+            {
+                message(stderr, SYNTAX_ERROR_UNTERMINATED_QUOTE_MESSAGE);
+                return -1;
+            }
+            if ((input[end] == '<' || input[end] == '>') && flags == 0 && strspn(input + i, "0123456789") == end - i)
+                kind = TOKEN_IO_NUMBER;
+            if (add_token(list, i, end - i, kind, flags) == -1)
+                return -1;
+            i = end;
+            if (list->count >= 2 && (list->tokens[list->count - 2].kind == TOKEN_DLESS || list->tokens[list->count - 2].kind == TOKEN_DLESSDASH))
+            { // The delimiter word: its body is read once the line has ended
+                if (add_token(list, i, 0, TOKEN_HEREDOC, 0) == -1)
+                    return -1;
+                here_documents++;
+            }
+        }
+    }
+    if (here_documents > 0)
+    {
+        list->incomplete = 1;
+        return -1;
+    }
+    list->tokens[list->count].offset = i;
+    list->tokens[list->count].length = 0;
+    list->tokens[list->count].kind = TOKEN_END;
+    list->tokens[list->count].flags = 0;
+    return 0;
+}
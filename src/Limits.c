@@ -0,0 +1,187 @@
+/**
+ * @file Limits.c
+ * @brief '@cpu=', '@nice=' and '@mem=' prefixes, which launch a command pinned and limited.
+ *
+ * Words such as '@cpu=0-3 @nice=5 @mem=2G' in front of a command are not part of it:
+ * plan_limit_prefixes() takes them off the expanded arguments into the limits of the
+ * command's spawn plan, and the child applies them itself between fork and exec
+ * (Spawn.c). This replaces 'taskset', 'nice' and 'prlimit', and the extra exec each of
+ * them costs. '@cpu=' takes a list of CPUs and ranges such as '0-3,8', '@nice=' a nice
+ * value from -20 to 19, and '@mem=' the limit of the address space (RLIMIT_AS) in bytes,
+ * with an optional K, M, G or T suffix.
+ *
+ * '@cpu.max=' and '@memory.max=' throttle the whole job instead, through the cpu.max and
+ * memory.max files of its cgroup, and so need job cgroups (MYSH_CGROUP, Cgroup.c). The
+ * child of the stage that carries them writes them before it execs.
+ *
+ * The prefixes are for programs: the name after them is looked up on $PATH even when a
+ * builtin or function has it, since those run in the shell, which must not be limited.
+ *
+ * When MYSH_PIN_STAGES is exported as a CPU list, every stage of a pipeline that gets a
+ * process of its own is pinned to one CPU of that list, stage i to the i-th CPU (wrapping
+ * around), so that each stage keeps its caches warm while data moves down the pipes. A
+ * stage with '@cpu=' of its own keeps it.
+ */
+
+#include <ctype.h>
+
+static int pin_cpus[CPU_SETSIZE]; // The CPUs of $MYSH_PIN_STAGES, in order
+static int pin_cpu_count;
+
+// Read a CPU list such as '0-3,8' into cpus, and its CPUs in order into order unless it is
+// NULL; returns how many CPUs it names, or -1 when the list is malformed
+static int parse_cpu_list(const char *text, cpu_set_t *cpus, int *order)
+{
+    int count = 0;
+
+    CPU_ZERO(cpus);
+    while (1)
+    {
+        char *end;
+        long first, last;
+
+        if (!isdigit((unsigned char)*text))
+            return -1;
+        first = last = strtol(text, &end, 10);
+        if (*end == '-')
+        {
+            if (!isdigit((unsigned char)end[1]))
+                return -1;
+            last = strtol(end + 1, &end, 10);
+        }
+        if (last < first || last >= CPU_SETSIZE)
+            return -1;
+        for (long cpu = first; cpu <= last; cpu++)
+        {
+            if (CPU_ISSET(cpu, cpus))
+                continue;
+            CPU_SET(cpu, cpus);
+            if (order)
+                order[count] = cpu;
+            count++;
+        }
+        if (*end == '\0')
+            return count;
+        if (*end != ',')
+            return -1;
+        text = end + 1;
+    }
+}
+
+// Read a size such as '512M' in bytes; 0 when it is malformed or zero
+static rlim_t parse_size(const char *text)
+{
+    const char *units = "KMGT";
+    unsigned long long size;
+    char *end;
+
+    if (!isdigit((unsigned char)*text))
+        return 0;
+    errno = 0;
+    size = strtoull(text, &end, 10);
+    if (errno != 0)
+        return 0;
+    if (*end != '\0')
+    {
+        const char *unit = strchr(units, toupper((unsigned char)*end));
+
+        if (!unit || end[1] != '\0')
+            return 0;
+        for (const char *u = units; u <= unit; u++)
+        {
+            if (size > (RLIM_INFINITY - 1) / 1024)
+                return 0;
+            size *= 1024;
+        }
+    }
+    return size < RLIM_INFINITY ? size : 0;
+}
+
+// Read a nice value into *nice; -1 when it is not a number from -20 to 19
+static int parse_nice(const char *text, int *nice)
+{
+    char *end;
+    long value;
+
+    errno = 0;
+    value = strtol(text, &end, 10);
+    if (text[0] == '\0' || *end != '\0' || errno != 0 || value < -20 || value > 19)
+        return -1;
+    *nice = value;
+    return 0;
+}
+
+// Function to read $MYSH_PIN_STAGES, the CPUs that pipeline stages are pinned to
+void limits_init()
+{
+    const char *list = getenv("MYSH_PIN_STAGES");
+    cpu_set_t cpus;
+
+    pin_cpu_count = 0;
+    if (list && *list && (pin_cpu_count = parse_cpu_list(list, &cpus, pin_cpus)) == -1)
+    {
+        fprintf(stderr, LIMIT_BAD_VALUE_MESSAGE, list);
+        pin_cpu_count = 0;
+    }
+}
+
+// Function to take the '@cpu=', '@nice=' and '@mem=' words at the start of *args into the
+// limits of plan, leaving *args at the command itself. Returns -1 after reporting a bad value.
+int plan_limit_prefixes(struct spawn_plan *plan, char ***args)
+{
+    struct spawn_limits *limits = &plan->limits;
+    char **word;
+
+    for (word = *args; *word && (*word)[0] == '@'; word++)
+    {
+        int bad;
+
+        if (strncmp(*word, "@cpu=", 5) == 0)
+        {
+            limits->has_cpus = 1;
+            bad = parse_cpu_list(*word + 5, &limits->cpus, NULL) <= 0;
+        }
+        else if (strncmp(*word, "@nice=", 6) == 0)
+        {
+            limits->has_nice = 1;
+            bad = parse_nice(*word + 6, &limits->nice) == -1;
+        }
+        else if (strncmp(*word, "@mem=", 5) == 0)
+            bad = (limits->memory = parse_size(*word + 5)) == 0;
+        else if (strncmp(*word, "@cpu.max=", 9) == 0 || strncmp(*word, "@memory.max=", 12) == 0)
+        {
+            if (!cgroup_enabled)
+            {
+                fprintf(stderr, CGROUP_OFF_MESSAGE, *word);
+                return -1;
+            }
+            if ((*word)[1] == 'c')
+                limits->cpu_max = *word + 9;
+            else
+                limits->memory_max = *word + 12;
+            bad = (*word)[strcspn(*word, "=") + 1] == '\0';
+        }
+        else
+            break; // Not a prefix: the command itself
+        if (bad)
+        {
+            fprintf(stderr, LIMIT_BAD_VALUE_MESSAGE, *word);
+            return -1;
+        }
+        plan->needs_fork = 1; // posix_spawn cannot set any of them
+    }
+    *args = word;
+    return 0;
+}
+
+// Function to pin stage i of a pipeline to its CPU of $MYSH_PIN_STAGES, unless the stage
+// names CPUs of its own
+void plan_stage_cpu(struct spawn_plan *plan, int stage)
+{
+    if (pin_cpu_count == 0 || plan->limits.has_cpus)
+        return;
+    CPU_ZERO(&plan->limits.cpus);
+    CPU_SET(pin_cpus[stage % pin_cpu_count], &plan->limits.cpus);
+    plan->limits.has_cpus = 1;
+    plan->needs_fork = 1;
+}
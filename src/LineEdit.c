@@ -0,0 +1,688 @@
+/**
+ * @file LineEdit.c
+ * @brief Raw-mode line editor for the interactive prompt.
+ *
+ * line_edit_read() puts the terminal in raw mode for the time it takes to read one line,
+ * then restores the modes the shell had. Keys are handled in batches: everything one
+ * read() returned (a keystroke, or a whole paste) is applied to the line, and then the
+ * terminal is brought up to date with at most one write().
+ *
+ * The editor remembers what the terminal row shows and where its cursor is. A redraw
+ * compares the new row with that copy, moves the cursor to the first column that
+ * differs, writes only the changed tail, clears what is left of the old row and moves
+ * back to the new cursor position. Typing at the end of the line therefore writes one
+ * byte. A line wider than the terminal scrolls sideways inside a single row.
+ *
+ * Keys: the arrows, Home/End and Delete; CTRL+A, CTRL+E, CTRL+B, CTRL+F to move; CTRL+K,
+ * CTRL+U and CTRL+W to delete; CTRL+P and CTRL+N (or Up and Down) to browse the history;
+ * CTRL+R for incremental reverse search (HistorySearch.c); CTRL+L to clear the screen;
+ * CTRL+C to drop the line; CTRL+D to delete, or for end of input on an empty line; Tab to
+ * complete (Completion.c), listing the candidates on a second Tab.
+ *
+ * The editor waits for keys in the event loop (Events.c) rather than in read(), so it
+ * also wakes up for SIGWINCH, redrawing the line for the new width, and for SIGCHLD:
+ * background jobs that finish while it waits are reported above the prompt at once.
+ */
+
+#include <poll.h>
+#include <sys/ioctl.h>
+
+#define LINE_EDIT_INPUT_SIZE 4096
+#define LINE_EDIT_ESCAPE_WAIT_MS 50
+#define LINE_EDIT_MAX_LISTED 500
+
+struct line_editor
+{
+    struct string_builder line;
+    size_t cursor;
+    const char *prompt;
+    struct string_builder row;    // What the terminal row should show: prompt and line
+    size_t row_cursor;            // Where the cursor goes in row
+    struct string_builder screen; // What the terminal row shows now
+    size_t screen_cursor;
+    size_t scroll; // First column of row shown when it is wider than the terminal
+    struct string_builder output; // Bytes for the next write()
+    long history_event;           // Event on the line; one past the newest while typing a new line
+    char *typed_line;             // The new line, kept while browsing the history
+    int searching;
+    int search_failed;
+    long search_event;
+    char *search_original; // The line before CTRL+R, restored when the search is dropped
+    struct history_search search;
+    int tabs; // Consecutive Tab presses
+};
+
+static struct line_editor editor;
+static char line_edit_input[LINE_EDIT_INPUT_SIZE];
+static size_t line_edit_input_start, line_edit_input_end; // Read ahead, for the next line
+static volatile sig_atomic_t terminal_resized = 1;
+static int terminal_columns = 80;
+static int line_edit_watching; // The terminal is in the event loop
+static int line_edit_readable;
+
+static void sigwinch_handler(int sig)
+{
+    (void)sig;
+    terminal_resized = 1;
+}
+
+static void note_resize()
+{
+    terminal_resized = 1;
+}
+
+static void note_input(void *data)
+{
+    (void)data;
+    line_edit_readable = 1;
+}
+
+// Function to tell whether the interactive shell should use the line editor
+int line_edit_enabled()
+{
+    const char *setting = getenv("MYSH_LINE_EDIT");
+    const char *term = getenv("TERM");
+    static int installed;
+
+    if ((setting && strcmp(setting, "0") == 0) || (term && strcmp(term, "dumb") == 0) || !isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO))
+        return 0;
+    if (!installed && events_on_signal(SIGWINCH, note_resize) == 0)
+        installed = 1;
+    if (!installed)
+    { // No event loop: a handler sets the flag, seen on the next key
+        struct sigaction action;
+
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = sigwinch_handler;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        sigaction(SIGWINCH, &action, NULL);
+        installed = 1;
+    }
+    return 1;
+}
+
+static void output_move_left(size_t count)
+{
+    char sequence[32];
+
+    if (count <= 4)
+    {
+        for (size_t i = 0; i < count; i++)
+            builder_append(&editor.output, "\b", 1);
+    }
+    else
+    {
+        builder_append(&editor.output, sequence, snprintf(sequence, sizeof(sequence), "\x1b[%zuD", count));
+    }
+}
+
+// Bring the terminal row up to date with one write(), rewriting only what changed
+static void refresh_line()
+{
+    const char *shown, *visible;
+    size_t width, visible_length, cursor, common = 0;
+
+    if (terminal_resized)
+    {
+        struct winsize size;
+
+        terminal_resized = 0;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0)
+            terminal_columns = size.ws_col;
+    }
+    width = terminal_columns > 10 ? terminal_columns - 1 : 10;
+
+    if (editor.row.length <= width)
+        editor.scroll = 0;
+    else if (editor.row_cursor < editor.scroll)
+        editor.scroll = editor.row_cursor;
+    else if (editor.row_cursor >= editor.scroll + width)
+        editor.scroll = editor.row_cursor - width + 1;
+    if (editor.scroll > editor.row.length)
+        editor.scroll = editor.row.length;
+    visible = editor.row.text + editor.scroll;
+    visible_length = editor.row.length - editor.scroll < width ? editor.row.length - editor.scroll : width;
+    cursor = editor.row_cursor - editor.scroll;
+
+    shown = editor.screen.text ? editor.screen.text : "";
+    while (common < editor.screen.length && common < visible_length && shown[common] == visible[common])
+        common++;
+
+    editor.output.length = 0;
+    if (editor.screen_cursor > common)
+        output_move_left(editor.screen_cursor - common);
+    else if (common - editor.screen_cursor > 8)
+    {
+        char sequence[32];
+
+        builder_append(&editor.output, sequence, snprintf(sequence, sizeof(sequence), "\x1b[%zuC", common - editor.screen_cursor));
+    }
+    else
+        builder_append(&editor.output, visible + editor.screen_cursor, common - editor.screen_cursor);
+    builder_append(&editor.output, visible + common, visible_length - common);
+    if (editor.screen.length > visible_length)
+        builder_append(&editor.output, "\x1b[K", 3);
+    output_move_left(visible_length - cursor);
+
+    if (editor.output.length > 0 && write(STDOUT_FILENO, editor.output.text, editor.output.length) == -1)
+    {
+        // Nothing sensible to do about a terminal that cannot be written
+    }
+    editor.screen.length = 0;
+    builder_append(&editor.screen, visible, visible_length);
+    editor.screen_cursor = cursor;
+}
+
+// Lay out the row for the current state: the prompt and the line, or the search
+static void layout_row()
+{
+    const char *label = editor.search_failed ? "(failed reverse-i-search)`" : "(reverse-i-search)`";
+    const char *match, *found;
+
+    editor.row.length = 0;
+    builder_append(&editor.row, "", 0);
+    if (!editor.searching)
+    {
+        builder_append(&editor.row, editor.prompt, strlen(editor.prompt));
+        editor.row_cursor = editor.row.length + editor.cursor;
+        builder_append(&editor.row, editor.line.text, editor.line.length);
+        return;
+    }
+
+    builder_append(&editor.row, label, strlen(label));
+    builder_append(&editor.row, editor.search.query, editor.search.length);
+    builder_append(&editor.row, "': ", 3);
+    editor.row_cursor = editor.row.length;
+    match = editor.search_event != -1 ? history_lookup(editor.search_event) : NULL;
+    if (match)
+    {
+        found = editor.search.length ? strstr(match, editor.search.query) : NULL;
+        if (found)
+            editor.row_cursor += found - match;
+        builder_append(&editor.row, match, strlen(match));
+    }
+}
+
+// Forget what the terminal shows; the next refresh writes the whole row on a fresh line
+static void reset_screen()
+{
+    editor.screen.length = 0;
+    editor.screen_cursor = 0;
+    editor.scroll = 0;
+}
+
+static void set_line(const char *text)
+{
+    editor.line.length = 0;
+    builder_append(&editor.line, text ? text : "", text ? strlen(text) : 0);
+    editor.cursor = editor.line.length;
+}
+
+static void insert_text(const char *text, size_t length)
+{
+    size_t tail = editor.line.length - editor.cursor;
+
+    if (builder_append(&editor.line, text, length) == -1)
+        return;
+    memmove(editor.line.text + editor.cursor + length, editor.line.text + editor.cursor, tail);
+    memcpy(editor.line.text + editor.cursor, text, length);
+    editor.cursor += length;
+}
+
+static void delete_range(size_t from, size_t to)
+{
+    memmove(editor.line.text + from, editor.line.text + to, editor.line.length - to + 1);
+    editor.line.length -= to - from;
+    if (editor.cursor > to)
+        editor.cursor -= to - from;
+    else if (editor.cursor > from)
+        editor.cursor = from;
+}
+
+static void browse_history(int older)
+{
+    long first = history_first_event(), newest = history_last_event();
+    long event = editor.history_event + (older ? -1 : 1);
+
+    if (event < first || event > newest + 1 || newest < first)
+        return;
+    if (editor.history_event == newest + 1)
+    {
+        free(editor.typed_line);
+        editor.typed_line = strdup(editor.line.text ? editor.line.text : "");
+    }
+    editor.history_event = event;
+    set_line(event == newest + 1 ? editor.typed_line : history_lookup(event));
+}
+
+// Write text on its own lines below the row, then start the row again underneath
+static void print_below(const char *text, size_t length)
+{
+    size_t end;
+
+    layout_row();
+    refresh_line(); // Keys handled since the last refresh are on the row before it is left
+    end = editor.screen.length;
+    editor.output.length = 0;
+    builder_append(&editor.output, editor.screen.text + editor.screen_cursor, end - editor.screen_cursor);
+    builder_append(&editor.output, "\n", 1);
+    builder_append(&editor.output, text, length);
+    if (write(STDOUT_FILENO, editor.output.text, editor.output.length) == -1)
+    {
+        // As in refresh_line()
+    }
+    reset_screen();
+}
+
+// List completion candidates in columns below the row
+static void list_candidates(const struct completion *completion)
+{
+    struct string_builder text = {NULL, 0, 0, 0};
+    size_t widest = 0;
+    int columns, rows;
+
+    if (completion->count > LINE_EDIT_MAX_LISTED)
+    {
+        char summary[64];
+
+        print_below(summary, snprintf(summary, sizeof(summary), "%d possibilities\n", completion->count));
+        return;
+    }
+    for (int i = 0; i < completion->count; i++)
+    {
+        size_t length = strlen(completion->candidates[i]);
+
+        widest = length > widest ? length : widest;
+    }
+    columns = (int)(terminal_columns / (widest + 2));
+    columns = columns > 0 ? columns : 1;
+    rows = (completion->count + columns - 1) / columns;
+    for (int row = 0; row < rows; row++)
+    {
+        for (int column = 0; column < columns; column++)
+        {
+            int i = column * rows + row;
+            size_t length;
+
+            if (i >= completion->count)
+                break;
+            length = strlen(completion->candidates[i]);
+            builder_append(&text, completion->candidates[i], length);
+            if (column + 1 < columns && i + rows < completion->count)
+            {
+                for (size_t pad = length; pad < widest + 2; pad++)
+                    builder_append(&text, " ", 1);
+            }
+        }
+        builder_append(&text, "\n", 1);
+    }
+    if (text.text)
+        print_below(text.text, text.length);
+    free(text.text);
+}
+
+// Complete the word before the cursor: insert what all candidates share, list them on a second Tab
+static void complete_at_cursor()
+{
+    struct completion completion;
+    size_t common;
+
+    if (complete_word(editor.line.text ? editor.line.text : "", editor.cursor, &completion) == -1 || completion.count == 0)
+    {
+        free_completion(&completion);
+        return;
+    }
+
+    common = strlen(completion.candidates[0]);
+    for (int i = 1; i < completion.count; i++)
+    {
+        size_t length = 0;
+
+        while (length < common && completion.candidates[i][length] == completion.candidates[0][length])
+            length++;
+        common = length;
+    }
+    for (size_t i = completion.typed; i < common; i++)
+    {
+        char c = completion.candidates[0][i];
+
+        if (strchr(COMPLETION_ESCAPED_CHARS, c))
+            insert_text("\\", 1);
+        insert_text(&c, 1);
+    }
+    if (completion.count == 1 && completion.candidates[0][common - 1] != '/')
+        insert_text(" ", 1);
+    else if (completion.count > 1 && common == completion.typed && editor.tabs > 1)
+        list_candidates(&completion);
+    free_completion(&completion);
+}
+
+static void search_update(long event)
+{
+    editor.search_failed = event == -1;
+    if (event != -1)
+        editor.search_event = event;
+}
+
+// Leave reverse search, keeping the match on the line
+static void search_accept()
+{
+    const char *match = editor.search_event != -1 ? history_lookup(editor.search_event) : NULL;
+    const char *found = match && editor.search.length ? strstr(match, editor.search.query) : NULL;
+
+    if (match)
+    {
+        set_line(match);
+        if (found)
+            editor.cursor = found - match;
+        editor.history_event = editor.search_event;
+    }
+    editor.searching = 0;
+    history_search_end(&editor.search);
+    free(editor.search_original);
+    editor.search_original = NULL;
+}
+
+// Handle a key during CTRL+R; returns 0 if the key should then be handled as usual
+static int search_key(unsigned char c)
+{
+    if (c == 18) // CTRL+R
+    {
+        if (editor.search_event != -1)
+            search_update(history_search_older(&editor.search) ? history_search_current(&editor.search) : -1);
+        return 1;
+    }
+    if (c == 7 || c == 3) // CTRL+G, CTRL+C
+    {
+        set_line(editor.search_original);
+        editor.searching = 0;
+        history_search_end(&editor.search);
+        free(editor.search_original);
+        editor.search_original = NULL;
+        return 1;
+    }
+    if (c == 127 || c == 8)
+    {
+        history_search_backspace(&editor.search);
+        search_update(history_search_current(&editor.search));
+        return 1;
+    }
+    if (c >= 32)
+    {
+        if (history_search_append(&editor.search, c) == 0)
+            search_update(history_search_current(&editor.search));
+        return 1;
+    }
+    search_accept();
+    return 0;
+}
+
+// Bring the screen up to date with what happened while waiting for a key: report the
+// background jobs that finished above the line, and redraw it after a resize
+static void line_edit_idle()
+{
+    if (finished_jobs_pending())
+    {
+        if (write(STDOUT_FILENO, "\r\x1b[K", 4) == -1)
+        {
+            // As in refresh_line()
+        }
+        notify_finished_jobs();
+        fflush(stdout);
+        reset_screen();
+    }
+    else if (!terminal_resized)
+        return;
+    layout_row();
+    refresh_line();
+}
+
+// Wait until the terminal has input, at most wait_ms milliseconds unless it is -1; 0 on a timeout
+static int wait_for_input(int wait_ms)
+{
+    struct pollfd input = {STDIN_FILENO, POLLIN, 0};
+    int events;
+
+    if (!line_edit_watching)
+        return wait_ms < 0 || poll(&input, 1, wait_ms) > 0;
+    line_edit_readable = 0;
+    while (!line_edit_readable)
+    {
+        events = event_wait(wait_ms);
+        if (events == -1)
+            return 1; // Leave the waiting to read()
+        if (events == 0 && wait_ms >= 0)
+            return 0;
+        if (wait_ms < 0)
+            line_edit_idle();
+    }
+    return 1;
+}
+
+// Read the next input byte, from what was read ahead or from the terminal; -1 at end of input
+static int next_byte(int wait_ms)
+{
+    ssize_t count;
+
+    if (line_edit_input_start == line_edit_input_end)
+    {
+        if (!wait_for_input(wait_ms))
+            return -1;
+        do
+            count = read(STDIN_FILENO, line_edit_input, sizeof(line_edit_input));
+        while (count == -1 && errno == EINTR);
+        if (count <= 0)
+            return -1;
+        line_edit_input_start = 0;
+        line_edit_input_end = count;
+    }
+    return (unsigned char)line_edit_input[line_edit_input_start++];
+}
+
+// Translate an escape sequence (after ESC) into the control key with the same meaning
+static int escape_key()
+{
+    int c = next_byte(LINE_EDIT_ESCAPE_WAIT_MS), final;
+
+    if (c != '[' && c != 'O')
+        return 0;
+    final = next_byte(LINE_EDIT_ESCAPE_WAIT_MS);
+    if (final >= '0' && final <= '9')
+    {
+        int number = final - '0';
+
+        while ((final = next_byte(LINE_EDIT_ESCAPE_WAIT_MS)) >= '0' && final <= '9')
+            number = number * 10 + final - '0';
+        if (final != '~')
+            return 0;
+        return number == 3 ? 4 + 256 : number == 1 || number == 7 ? 1 : number == 4 || number == 8 ? 5 : 0;
+    }
+    switch (final)
+    {
+    case 'A':
+        return 16; // CTRL+P
+    case 'B':
+        return 14; // CTRL+N
+    case 'C':
+        return 6; // CTRL+F
+    case 'D':
+        return 2; // CTRL+B
+    case 'H':
+        return 1; // CTRL+A
+    case 'F':
+        return 5; // CTRL+E
+    default:
+        return 0;
+    }
+}
+
+// Apply one key to the line; returns 1 when the line is finished, 2 when it was dropped,
+// -1 at end of input and 0 otherwise
+static int handle_key(int c)
+{
+    int delete_key = 0;
+
+    if (c == 27)
+    {
+        c = escape_key();
+        delete_key = c == 4 + 256; // Delete, which never means end of input
+        c &= 0xff;
+    }
+    editor.tabs = c == '\t' ? editor.tabs + 1 : 0;
+    if (editor.searching && search_key(c))
+        return 0;
+
+    switch (c)
+    {
+    case '\r':
+    case '\n':
+        return 1;
+    case 1: // CTRL+A
+        editor.cursor = 0;
+        break;
+    case 5: // CTRL+E
+        editor.cursor = editor.line.length;
+        break;
+    case 2: // CTRL+B
+        if (editor.cursor > 0)
+            editor.cursor--;
+        break;
+    case 6: // CTRL+F
+        if (editor.cursor < editor.line.length)
+            editor.cursor++;
+        break;
+    case 4: // CTRL+D
+        if (editor.line.length == 0 && !delete_key)
+            return -1;
+        if (editor.cursor < editor.line.length)
+            delete_range(editor.cursor, editor.cursor + 1);
+        break;
+    case 127:
+    case 8:
+        if (editor.cursor > 0)
+            delete_range(editor.cursor - 1, editor.cursor);
+        break;
+    case 11: // CTRL+K
+        delete_range(editor.cursor, editor.line.length);
+        break;
+    case 21: // CTRL+U
+        delete_range(0, editor.cursor);
+        break;
+    case 23: // CTRL+W
+    {
+        size_t start = editor.cursor;
+
+        while (start > 0 && editor.line.text[start - 1] == ' ')
+            start--;
+        while (start > 0 && editor.line.text[start - 1] != ' ')
+            start--;
+        delete_range(start, editor.cursor);
+        break;
+    }
+    case 16: // CTRL+P
+    case 14: // CTRL+N
+        browse_history(c == 16);
+        break;
+    case 18: // CTRL+R
+        editor.searching = 1;
+        editor.search_failed = 0;
+        editor.search_event = -1;
+        editor.search_original = strdup(editor.line.text ? editor.line.text : "");
+        history_search_begin(&editor.search);
+        break;
+    case 12: // CTRL+L
+        if (write(STDOUT_FILENO, "\x1b[H\x1b[2J", 7) == 7)
+            reset_screen();
+        break;
+    case 3: // CTRL+C
+        editor.cursor = editor.line.length;
+        print_below("", 0);
+        set_line("");
+        return 2;
+    case '\t':
+        complete_at_cursor();
+        break;
+    default:
+        if (c >= 32)
+        {
+            char byte = c;
+
+            insert_text(&byte, 1);
+        }
+        break;
+    }
+    return 0;
+}
+
+// Function to read one line from the terminal with editing; stores it, without its newline,
+// in *line (grown as needed) and returns its length, or -1 at end of input
+ssize_t line_edit_read(const char *prompt, char **line, size_t *capacity)
+{
+    struct termios cooked, raw;
+    int done = 0;
+
+    if (tcgetattr(STDIN_FILENO, &cooked) == -1)
+        return -1;
+    raw = cooked;
+    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &raw);
+
+    line_edit_watching = event_watch_fd(STDIN_FILENO, note_input, NULL) == 0;
+    events_poll_signals(); // A resize while a command ran
+    editor.prompt = prompt;
+    editor.history_event = history_last_event() + 1;
+    editor.searching = 0;
+    editor.tabs = 0;
+    set_line("");
+    reset_screen();
+    layout_row();
+    refresh_line();
+
+    while (!done)
+    {
+        int c = next_byte(-1);
+
+        done = c == -1 ? -1 : handle_key(c);
+        while (!done && line_edit_input_start < line_edit_input_end)
+            done = handle_key(next_byte(-1)); // The rest of a paste, drawn once
+        if (done == 1)
+        {
+            if (editor.searching)
+                search_accept();
+            editor.cursor = editor.line.length;
+        }
+        if (done != 2)
+        {
+            layout_row();
+            refresh_line();
+        }
+    }
+    if (done == 1)
+        print_below("", 0);
+    if (line_edit_watching)
+        event_unwatch_fd(STDIN_FILENO);
+    line_edit_watching = 0;
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &cooked);
+    if (editor.searching)
+        search_accept();
+    free(editor.typed_line);
+    editor.typed_line = NULL;
+
+    if (done == -1)
+        return -1;
+    if (*capacity < editor.line.length + 1)
+    {
+        char *grown = realloc(*line, editor.line.length + 1);
+
+        if (!grown)
+            return -1;
+        *line = grown;
+        *capacity = editor.line.length + 1;
+    }
+    memcpy(*line, editor.line.text ? editor.line.text : "", editor.line.length + 1);
+    return editor.line.length;
+}
@@ -0,0 +1,381 @@
+/**
+ * @file Parallel.c
+ * @brief The 'parallel' builtin: one command run over many inputs by a bounded pool.
+ *
+ * 'parallel [-j N] [-g] [-k] command [args...] ::: input...' runs the command once per
+ * input, replacing every '{}' in its arguments with the input or, when there is none,
+ * appending the input as the last argument. Without ':::' the inputs are the lines of
+ * standard input. At most N commands run at once; N defaults to the number of CPUs the
+ * shell may run on (sched_getaffinity), and -j 0 means no limit.
+ *
+ * Every command is launched like any other, through spawn_command, and is a job in the
+ * job table. When the pool is full the shell sleeps in wait_for_children() (Jobs.c),
+ * which waits in event_wait() for SIGCHLD on the signalfd of Events.c, and each finished
+ * job frees its slot for the next input. No xargs or helper process is involved.
+ *
+ * -g gives every command its own memfd for standard output and one for standard error,
+ * copied out in one go when it finishes, so the output of parallel commands never
+ * interleaves. -k also keeps that output in the order of the inputs, holding finished
+ * results until all the ones before them have been written.
+ *
+ * On a terminal the pool runs in a forked subshell that is the foreground job, so CTRL+C
+ * and CTRL+Z reach every command at once. The status is the number of commands that
+ * failed, capped at 101.
+ */
+
+#include <limits.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#define PARALLEL_MAX_FAILURES 101
+
+struct parallel_result
+{
+    struct job *job; // NULL once the command has finished
+    int out_fd;      // memfds holding the output when grouping, otherwise -1
+    int err_fd;
+    int done;
+};
+
+struct parallel_run
+{
+    char **command; // NULL-terminated, ends before ':::'
+    char **inputs;
+    int input_count;
+    int max_jobs;
+    int group;      // -g
+    int keep_order; // -k
+    struct parallel_result *results;
+    int *running; // Inputs whose command is running, max_jobs of them at most
+    int running_count;
+    int next_input;
+    int next_output; // With -k, the first input whose output has not been written
+    int failures;
+};
+
+// Default for -j: the CPUs this shell may run on
+static int parallel_cpu_count()
+{
+    cpu_set_t cpus;
+
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0 && CPU_COUNT(&cpus) > 0)
+        return CPU_COUNT(&cpus);
+    return 1;
+}
+
+// Build the argument vector for one input; returns a malloc'ed vector whose strings are
+// either the command's own or malloc'ed copies, as recorded in owned
+static char **parallel_arguments(char **command, const char *input, unsigned char **owned)
+{
+    int count = 0, substituted = 0;
+    char **args;
+
+    while (command[count] != NULL)
+        count++;
+    args = calloc(count + 2, sizeof(*args));
+    *owned = calloc(count + 2, 1);
+    if (!args || !*owned)
+    {
+        free(args);
+        free(*owned);
+        return NULL;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        const char *marker = strstr(command[i], "{}");
+        size_t input_length = strlen(input), length = strlen(command[i]);
+        char *word, *dst;
+
+        if (!marker)
+        {
+            args[i] = command[i];
+            continue;
+        }
+        substituted = 1;
+        for (const char *src = marker; (src = strstr(src, "{}")) != NULL; src += 2)
+            length += input_length - 2;
+        word = malloc(length + 1);
+        if (!word)
+            continue; // Leave a NULL in place, which ends the vector early
+        (*owned)[i] = 1;
+        dst = word;
+        for (const char *src = command[i]; *src;)
+        {
+            if (src[0] == '{' && src[1] == '}')
+            {
+                memcpy(dst, input, input_length);
+                dst += input_length;
+                src += 2;
+            }
+            else
+                *dst++ = *src++;
+        }
+        *dst = '\0';
+        args[i] = word;
+    }
+    if (!substituted)
+        args[count] = (char *)input;
+    return args;
+}
+
+static void free_parallel_arguments(char **args, unsigned char *owned)
+{
+    for (int i = 0; args && owned && args[i] != NULL; i++)
+    {
+        if (owned[i])
+            free(args[i]);
+    }
+    free(args);
+    free(owned);
+}
+
+// Copy a grouped result to the shell's output and close its memfds
+static void parallel_write_result(struct parallel_result *result)
+{
+    int fds[2] = {result->out_fd, result->err_fd};
+
+    fflush(stdout);
+    for (int i = 0; i < 2; i++)
+    {
+        if (fds[i] == -1)
+            continue;
+        if (lseek(fds[i], 0, SEEK_SET) == 0 && move_data(fds[i], i == 0 ? STDOUT_FILENO : STDERR_FILENO) == -1 && errno != EPIPE)
+            perror("parallel: output failed");
+        close(fds[i]);
+    }
+    result->out_fd = result->err_fd = -1;
+}
+
+// Start the command for the next input
+static void parallel_launch(struct parallel_run *run)
+{
+    int input = run->next_input++;
+    struct parallel_result *result = &run->results[input];
+    unsigned char *owned = NULL;
+    char **args = parallel_arguments(run->command, run->inputs[input], &owned);
+    struct spawn_plan plan;
+    pid_t pid = -1;
+
+    result->out_fd = result->err_fd = -1;
+    result->done = 1; // Until a process is running
+    if (!args)
+    {
+        perror("parallel: allocation failed");
+        run->failures++;
+        return;
+    }
+
+    spawn_plan_init(&plan);
+    if (run->group)
+    {
+        result->out_fd = memfd_create("parallel-stdout", MFD_CLOEXEC);
+        result->err_fd = memfd_create("parallel-stderr", MFD_CLOEXEC);
+        if (result->out_fd == -1 || result->err_fd == -1)
+            perror("parallel: memfd_create failed");
+        if (result->out_fd != -1)
+            spawn_plan_dup2(&plan, result->out_fd, STDOUT_FILENO);
+        if (result->err_fd != -1)
+            spawn_plan_dup2(&plan, result->err_fd, STDERR_FILENO);
+    }
+
+    result->job = job_create(run->inputs[input], 0);
+    if (result->job)
+    {
+        job_plan_group(result->job, &plan);
+        pid = spawn_command(args, &plan);
+        if (pid != -1 && job_add_process(result->job, pid, args[0]) == 0)
+        {
+            result->done = 0;
+            run->running[run->running_count++] = input;
+        }
+        else
+        {
+            job_free(result->job);
+            result->job = NULL;
+        }
+    }
+    if (result->done)
+        run->failures++;
+    free_parallel_arguments(args, owned);
+}
+
+// Collect the commands that finished since the last look, freeing their slots
+static void parallel_collect(struct parallel_run *run)
+{
+    for (int slot = 0; slot < run->running_count;)
+    {
+        struct parallel_result *result = &run->results[run->running[slot]];
+        struct job *job = result->job;
+
+        if (job->state != JOB_DONE)
+        {
+            slot++;
+            continue;
+        }
+        if (exit_status_of(job->processes[0].status) != 0)
+            run->failures++;
+        job_free(job);
+        result->job = NULL;
+        result->done = 1;
+        if (!run->keep_order)
+            parallel_write_result(result);
+        run->running[slot] = run->running[--run->running_count];
+    }
+
+    while (run->keep_order && run->next_output < run->next_input && run->results[run->next_output].done)
+        parallel_write_result(&run->results[run->next_output++]);
+}
+
+// Run every input through the pool; the body of the subshell on a terminal
+static int run_parallel_pool(void *data)
+{
+    struct parallel_run *run = data;
+
+    while (run->next_input < run->input_count || run->running_count > 0)
+    {
+        while (run->next_input < run->input_count && run->running_count < run->max_jobs)
+            parallel_launch(run);
+        parallel_collect(run);
+        if (run->running_count == run->max_jobs || (run->next_input == run->input_count && run->running_count > 0))
+        {
+            wait_for_children();
+            parallel_collect(run);
+        }
+    }
+    parallel_collect(run); // Write out the results of commands that could not start
+    fflush(stdout);
+    return run->failures < PARALLEL_MAX_FAILURES ? run->failures : PARALLEL_MAX_FAILURES;
+}
+
+// Split the whole of standard input into lines for a run without ':::'
+static char **parallel_read_inputs(struct script_text *text, int *count)
+{
+    char **inputs;
+    int lines = 0;
+
+    if (load_script(STDIN_FILENO, text) == -1)
+    {
+        perror("parallel: reading standard input failed");
+        return NULL;
+    }
+    for (size_t i = 0; i < text->size; i++)
+        lines += text->data[i] == '\n';
+    inputs = malloc((lines + 2) * sizeof(*inputs));
+    if (!inputs)
+        return NULL;
+
+    *count = 0;
+    for (char *line = text->data; *line != '\0';)
+    {
+        char *end = strchr(line, '\n');
+
+        if (end)
+            *end = '\0';
+        inputs[(*count)++] = line;
+        if (!end)
+            break;
+        line = end + 1;
+    }
+    return inputs;
+}
+
+// Function to implement 'parallel [-j N] [-g] [-k] command [args...] [::: inputs...]'
+void builtin_parallel(char **args)
+{
+    struct parallel_run run;
+    struct script_text text = {NULL, 0, 0};
+    char **read_inputs = NULL;
+    int i = 1, separator, usage_error = 0;
+
+    memset(&run, 0, sizeof(run));
+    run.max_jobs = parallel_cpu_count();
+    for (; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; i++)
+    {
+        if (strcmp(args[i], "-g") == 0)
+            run.group = 1;
+        else if (strcmp(args[i], "-k") == 0)
+            run.group = run.keep_order = 1;
+        else if (strncmp(args[i], "-j", 2) == 0 && (args[i][2] != '\0' || args[i + 1] != NULL))
+        {
+            const char *count = args[i][2] != '\0' ? args[i] + 2 : args[++i];
+
+            run.max_jobs = atoi(count);
+            if (*count == '\0' || strspn(count, "0123456789") != strlen(count))
+            {
+                usage_error = 1;
+                break;
+            }
+            if (run.max_jobs == 0)
+                run.max_jobs = INT_MAX;
+        }
+        else
+            break;
+    }
+    separator = i;
+    while (args[separator] != NULL && strcmp(args[separator], ":::") != 0)
+        separator++;
+    if (usage_error || args[i] == NULL || args[i][0] == '-' || separator == i)
+    {
+        message(stderr, PARALLEL_USAGE_MESSAGE);
+        last_status = 2;
+        return;
+    }
+
+    if (args[separator] != NULL)
+    {
+        args[separator] = NULL; // The command ends here; the vector is the builtin's own
+        run.inputs = &args[separator + 1];
+        while (run.inputs[run.input_count] != NULL)
+            run.input_count++;
+    }
+    else
+    {
+        read_inputs = run.inputs = parallel_read_inputs(&text, &run.input_count);
+        if (!read_inputs)
+        {
+            last_status = 1;
+            return;
+        }
+    }
+    run.command = &args[i];
+    if (run.max_jobs > run.input_count)
+        run.max_jobs = run.input_count > 0 ? run.input_count : 1;
+    run.results = calloc(run.input_count + 1, sizeof(*run.results));
+    run.running = malloc(run.max_jobs * sizeof(*run.running));
+
+    if (!run.results || !run.running)
+    {
+        perror("parallel: allocation failed");
+        last_status = 1;
+    }
+    else if (!job_control)
+    {
+        last_status = run_parallel_pool(&run);
+    }
+    else
+    { // One foreground job for the whole pool, so the terminal's signals reach every command
+        struct job *job = job_create(args[0], 0);
+        struct spawn_plan plan;
+        pid_t pid = -1;
+
+        if (job)
+        {
+            spawn_plan_init(&plan);
+            job_plan_group(job, &plan);
+            job_control = 0; // The pool's commands stay in the subshell's group
+            pid = spawn_subshell(&plan, run_parallel_pool, &run);
+            job_control = 1;
+        }
+        if (pid != -1 && job_add_process(job, pid, "parallel") == 0)
+            job_wait_foreground(job);
+        else if (job)
+            job_free(job);
+    }
+
+    free(run.results);
+    free(run.running);
+    free(read_inputs);
+    if (text.data)
+        unload_script(&text);
+}
@@ -0,0 +1,223 @@
+/**
+ * @file ParseCache.c
+ * @brief A cache of parsed command lines, for lines typed or replayed again.
+ *
+ * parse_cached() looks the raw text of a line up before it is tokenized. A line seen
+ * before is not tokenized or parsed again: its cached AST (the pipelines, their commands,
+ * argument vectors and redirections, and the cooked words) is copied into the line's
+ * arena in one walk, and the copy runs as if it had just been parsed. Re-running a line
+ * from the history with Up and Enter or with '!<number>' therefore costs a hash, a string
+ * compare and a copy.
+ *
+ * The cache only holds what the parser produces, which depends on nothing but the text:
+ * '$' words and pathname patterns are kept unexpanded and flagged, exactly as the parser
+ * leaves them, and Expand.c expands the copy each time it runs. A change to a variable
+ * or to a directory can therefore never make an entry stale, and entries are never
+ * invalidated; the command hash resolves each command name when it is launched, as for
+ * any other line.
+ *
+ * The cache is direct-mapped on the hash of the line, with PARSE_CACHE_SIZE entries, so
+ * a new line simply replaces the one in its slot. Lines that fail to parse are not kept.
+ * An AST is stored in a single malloc'ed block laid out like the arena copy, compound
+ * commands and all; Control.c keeps the bodies of functions the same way.
+ */
+
+#define PARSE_CACHE_SIZE 64
+
+struct parse_cache_entry
+{
+    char *text; // The raw line, NULL for an empty slot
+    unsigned long hash;
+    struct pipeline *pipelines; // Inside block
+    int pipeline_count;
+    void *block;
+    size_t size;
+    size_t aligned; // Bytes of block before the flags and strings
+};
+
+static struct parse_cache_entry parse_cache[PARSE_CACHE_SIZE];
+
+// Add the bytes a copy of pipelines takes to *aligned, for the structures and pointer arrays,
+// and to *bytes, for the flag bytes and strings
+static void measure_pipelines(const struct pipeline *pipelines, int count, size_t *aligned, size_t *bytes);
+
+static void measure_command(const struct command *command, size_t *aligned, size_t *bytes)
+{
+    *aligned += (command->arg_count + 1) * sizeof(char *) + command->redirect_count * sizeof(struct redirect);
+    *bytes += command->arg_flags ? command->arg_count : 0;
+    for (int k = 0; k < command->arg_count; k++)
+        *bytes += strlen(command->args[k]) + 1;
+    for (int k = 0; k < command->redirect_count; k++)
+        *bytes += command->redirects[k].target ? strlen(command->redirects[k].target) + 1 : 0;
+
+    for (const struct compound *compound = command->compound; compound; compound = compound->otherwise)
+    {
+        *aligned += sizeof(*compound);
+        *bytes += compound->name ? strlen(compound->name) + 1 : 0;
+        if (compound->kind == COMPOUND_FOR)
+            measure_command(&compound->words, aligned, bytes);
+        measure_pipelines(compound->condition.pipelines, compound->condition.count, aligned, bytes);
+        measure_pipelines(compound->body.pipelines, compound->body.count, aligned, bytes);
+    }
+}
+
+static void measure_pipelines(const struct pipeline *pipelines, int count, size_t *aligned, size_t *bytes)
+{
+    *aligned += count * sizeof(*pipelines);
+    for (int i = 0; i < count; i++)
+    {
+        *aligned += pipelines[i].command_count * sizeof(struct command);
+        for (int j = 0; j < pipelines[i].command_count; j++)
+            measure_command(&pipelines[i].commands[j], aligned, bytes);
+    }
+}
+
+// Bytes needed to copy pipelines with copy_pipelines(); *aligned gets the size of the
+// structures and pointer arrays, which come first, before the flag bytes and strings
+static size_t pipelines_size(const struct pipeline *pipelines, int count, size_t *aligned)
+{
+    size_t bytes = 0;
+
+    *aligned = 0;
+    measure_pipelines(pipelines, count, aligned, &bytes);
+    return *aligned + bytes;
+}
+
+static char *copy_string(char **bytes, const char *text)
+{
+    size_t length = strlen(text) + 1;
+    char *copy = *bytes;
+
+    memcpy(copy, text, length);
+    *bytes += length;
+    return copy;
+}
+
+static struct pipeline *copy_pipeline_list(const struct pipeline *pipelines, int count, char **next, char **bytes);
+
+// Copy what command points to, taking structures from *next and strings from *bytes
+static void copy_command(struct command *copy, const struct command *command, char **next, char **bytes)
+{
+    struct compound **link = &copy->compound;
+
+    *copy = *command;
+    copy->args = (char **)*next;
+    *next += (command->arg_count + 1) * sizeof(char *);
+    copy->redirects = (struct redirect *)*next;
+    *next += command->redirect_count * sizeof(struct redirect);
+    for (int k = 0; k < command->arg_count; k++)
+        copy->args[k] = copy_string(bytes, command->args[k]);
+    copy->args[command->arg_count] = NULL;
+    for (int k = 0; k < command->redirect_count; k++)
+    {
+        copy->redirects[k] = command->redirects[k];
+        if (command->redirects[k].target)
+            copy->redirects[k].target = copy_string(bytes, command->redirects[k].target);
+    }
+    if (command->arg_flags)
+    {
+        copy->arg_flags = (unsigned char *)*bytes;
+        memcpy(*bytes, command->arg_flags, command->arg_count);
+        *bytes += command->arg_count;
+    }
+
+    for (const struct compound *compound = command->compound; compound; compound = compound->otherwise)
+    {
+        struct compound *duplicate = (struct compound *)*next;
+
+        *next += sizeof(*duplicate);
+        *duplicate = *compound;
+        if (compound->name)
+            duplicate->name = copy_string(bytes, compound->name);
+        if (compound->kind == COMPOUND_FOR)
+            copy_command(&duplicate->words, &compound->words, next, bytes);
+        duplicate->condition.pipelines = copy_pipeline_list(compound->condition.pipelines, compound->condition.count, next, bytes);
+        duplicate->body.pipelines = copy_pipeline_list(compound->body.pipelines, compound->body.count, next, bytes);
+        *link = duplicate;
+        link = &duplicate->otherwise;
+    }
+}
+
+static struct pipeline *copy_pipeline_list(const struct pipeline *pipelines, int count, char **next, char **bytes)
+{
+    struct pipeline *copies = (struct pipeline *)*next;
+
+    *next += count * sizeof(*pipelines);
+    for (int i = 0; i < count; i++)
+    {
+        copies[i] = pipelines[i];
+        copies[i].commands = (struct command *)*next;
+        *next += pipelines[i].command_count * sizeof(struct command);
+        for (int j = 0; j < pipelines[i].command_count; j++)
+            copy_command(&copies[i].commands[j], &pipelines[i].commands[j], next, bytes);
+    }
+    return copies;
+}
+
+// Copy pipelines and everything they point to into to, which has the pipelines_size()
+// bytes they need, the first aligned of them for the structures
+static struct pipeline *copy_pipelines(const struct pipeline *pipelines, int count, void *to, size_t aligned)
+{
+    char *next = to, *bytes = (char *)to + aligned;
+
+    return copy_pipeline_list(pipelines, count, &next, &bytes);
+}
+
+// Keep the AST just parsed from text, which the entry takes over, replacing its old one
+static void parse_cache_store(struct parse_cache_entry *entry, char *text, unsigned long hash, const struct parse_context *context)
+{
+    size_t aligned, size = pipelines_size(context->pipelines, context->pipeline_count, &aligned);
+    void *block = malloc(size ? size : 1);
+
+    if (!block)
+    {
+        free(text);
+        return;
+    }
+    free(entry->text);
+    free(entry->block);
+    entry->text = text;
+    entry->hash = hash;
+    entry->block = block;
+    entry->size = size;
+    entry->aligned = aligned;
+    entry->pipelines = copy_pipelines(context->pipelines, context->pipeline_count, block, aligned);
+    entry->pipeline_count = context->pipeline_count;
+}
+
+// Function to parse a line like parse_input(), taking the AST from the cache when the same
+// text was parsed before. The result is the line's own copy in the context's arena either way.
+// On failure input is left as it was.
+int parse_cached(char *input, struct parse_context *context)
+{
+    unsigned long hash = hash_name(input, strlen(input));
+    struct parse_cache_entry *entry = &parse_cache[hash & (PARSE_CACHE_SIZE - 1)];
+    char *line;
+    void *copy;
+
+    if (entry->text && entry->hash == hash && strcmp(entry->text, input) == 0)
+    {
+        memset(&context->tokens, 0, sizeof(context->tokens));
+        context->incomplete = 0;
+        context->pipeline_count = entry->pipeline_count;
+        context->pipelines = NULL;
+        copy = arena_alloc(context->arena, entry->size ? entry->size : 1);
+        if (copy)
+        {
+            context->pipelines = copy_pipelines(entry->pipelines, entry->pipeline_count, copy, entry->aligned);
+            return 0;
+        }
+    }
+
+    line = strdup(input); // Parsing cooks the words of input in place
+    if (parse_input(input, context) == -1)
+    {
+        if (line)
+            strcpy(input, line); // Leave the text as it was, to be parsed again once it is complete
+        free(line);
+        return -1;
+    }
+    if (line)
+        parse_cache_store(entry, line, hash, context);
+    return 0;
+}
@@ -0,0 +1,970 @@
+/**
+ * @file Parser.c
+ * @brief Builds a pipeline AST from the token views produced by Lexer.c.
+ *
+ * A line is a list of pipelines separated by ';', '&', '&&' and '||'. The list is kept
+ * flat: each pipeline records in `connector` how the one after it depends on its status,
+ * and '&' sets is_background on the last pipeline of the and-or list it ends, so
+ * 'a && b &' puts the whole of 'a && b' in the background.
+ *
+ * parse_input() takes everything for a line from the arena of its parse_context: the
+ * tokens first, then argument vectors, redirections and stages, sized from the token
+ * count, which bounds all of them. A line therefore has no limit on its length or on
+ * its number of arguments, and parsing does no malloc once the arena has grown to fit.
+ * The results stay valid until the arena is reset. Since the context is the only state,
+ * nested parses (for example '!<number>' replaying a history entry) each get their own
+ * context and may share the arena.
+ *
+ * parse_script() turns a whole script into one such list before any of it runs, with
+ * the end of each line acting as a ';'. Its arrays are sized the same way but come from the heap, since a
+ * script lives until it has finished running.
+ *
+ * A stage may also be a compound command: 'if', 'while', 'until', 'for', a '{ ... }' group,
+ * a '( ... )' subshell or a function definition 'name() command'. Its parts are lists of
+ * their own, which may span lines, and it may be followed by redirections. Reserved words
+ * are only recognised where a command starts. A nested list is built on a scratch stack
+ * in parse_state and copied out to the arena (the script's own arena for a script) once
+ * it is complete, so that the stages of every pipeline and the pipelines of every list stay
+ * contiguous however deeply compound commands nest. Input that ends inside a compound
+ * command, or after '|', '&&' or '||', is not reported: parse_input() fails with
+ * `incomplete` set, so that the caller can read another line and try again.
+ *
+ * Words point into the input buffer. Their quotes and backslashes are removed in place,
+ * and they are NUL-terminated at the end of their token view. This happens only once
+ * the whole line has been tokenized, so overwriting an adjacent operator byte is harmless.
+ * Words containing '$' or a pathname pattern keep their quotes and are flagged ARG_EXPAND
+ * (and ARG_GLOB) instead; Expand.c expands them and removes the quotes each time the
+ * command runs.
+ *
+ * A here-document's body becomes the target of its redirection the same way, without
+ * quote removal: it is NUL-terminated where its delimiter line starts, '<<-' strips its
+ * leading tabs in place, and one that needs expansion is flagged ARG_EXPAND.
+ */
+
+enum redirect_kind
+{
+    REDIRECT_INPUT,  // [n]< file
+    REDIRECT_OUTPUT, // [n]> file
+    REDIRECT_APPEND, // [n]>> file
+    REDIRECT_DUP,    // [n]<&m or [n]>&m; m may also be a coprocess name or a '$' word
+    REDIRECT_CLOSE,  // [n]<&- or [n]>&-
+    REDIRECT_HERE_DOCUMENT, // [n]<<word or [n]<<-word, with the body in the lines that follow
+    REDIRECT_HERE_STRING    // [n]<<< word, read as the word and a newline
+};
+
+#define ARG_EXPAND 0x1 // Still quoted; expand before use
+#define ARG_GLOB 0x2   // Also a pathname pattern (arguments only)
+
+struct redirect
+{
+    enum redirect_kind kind;
+    int fd;        // Descriptor being redirected
+    char *target;  // File name for INPUT/OUTPUT/APPEND, text read for HERE_DOCUMENT/HERE_STRING
+    int target_fd; // Source descriptor for DUP; -1 when target names it at run time
+    int target_flags;
+    int reads; // The operator was '<&', so a coprocess target means its output
+};
+
+struct compound;
+
+struct command
+{
+    char **args; // NULL-terminated; args[0] is NULL for a redirection-only or compound command
+    unsigned char *arg_flags;
+    int arg_count;
+    struct redirect *redirects;
+    int redirect_count;
+    int needs_expansion;       // Some argument or target has ARG_EXPAND set
+    struct compound *compound; // NULL for a simple command
+};
+
+enum list_connector
+{
+    LIST_SEQUENCE, // ';', '&' or the end of a line: the next pipeline always runs
+    LIST_AND,      // &&: the next pipeline runs if this one succeeded
+    LIST_OR        // ||: the next pipeline runs if this one failed
+};
+
+struct pipeline
+{
+    struct command *commands;
+    int command_count; // 0 for 'time' on its own
+    int is_background; // Set on the last pipeline of an and-or list followed by '&'
+    int is_timed; // Preceded by the 'time' keyword
+    enum list_connector connector;
+    int is_negated; // Preceded by '!', which inverts its status
+};
+
+struct command_list
+{
+    struct pipeline *pipelines;
+    int count;
+};
+
+enum compound_kind
+{
+    COMPOUND_IF,       // if list; then list; [elif list; then list;]... [else list;] fi
+    COMPOUND_WHILE,    // while list; do list; done
+    COMPOUND_UNTIL,    // until list; do list; done
+    COMPOUND_FOR,      // for name [in words...]; do list; done
+    COMPOUND_GROUP,    // { list; }
+    COMPOUND_SUBSHELL, // ( list )
+    COMPOUND_FUNCTION  // name() command
+};
+
+struct compound
+{
+    enum compound_kind kind;
+    struct command_list condition; // IF, WHILE and UNTIL
+    struct command_list body;      // FUNCTION: one pipeline of one compound command
+    struct compound *otherwise;    // IF: the 'elif' part (another IF) or the 'else' part (a GROUP)
+    char *name;                    // FOR: the variable; FUNCTION: the function
+    struct command words;          // FOR: the words after 'in', as arguments are kept
+    int has_words;                 // FOR: 'in' was given; without it the loop runs over "$@"
+};
+
+struct parse_context
+{
+    struct arena *arena; // Holds the tokens and the AST; set by the caller
+    struct token_list tokens;
+    struct pipeline *pipelines;
+    int pipeline_count; // 0 for a blank or comment-only line
+    int incomplete;     // The parse failed only because the input ended too early
+};
+
+// Every command and every pipeline takes at least one token, so these bound a parse of count tokens
+#define PARSE_MAX_WORDS(count) (2 * (count) + 1)
+#define PARSE_MAX_REDIRECTS(count) ((count) / 2 + 1)
+#define PARSE_MAX_COMMANDS(count) ((count) + 1)
+
+struct script
+{
+    struct token_list tokens;
+    char **words;
+    unsigned char *word_flags;
+    struct redirect *redirects;
+    struct command *commands;
+    struct pipeline *pipelines;
+    int pipeline_count;
+    struct arena arena; // The lists of compound commands
+    int error_line;     // Line of the first syntax error, 0 if unknown
+};
+
+// Where parse_command and parse_pipeline carve their results from
+struct parse_state
+{
+    const struct token *tokens;
+    char **words;
+    unsigned char *word_flags;
+    int word_count;
+    struct redirect *redirects;
+    int redirect_count;
+    struct command *commands;
+    int command_count;
+    struct pipeline *pipelines; // Scratch stack for the lists of compound commands, made on first use
+    int pipeline_count;
+    int token_count;
+    struct arena *arena; // Where nested lists and compound commands are copied out to
+    int depth;           // Compound commands around the token being parsed
+    int incomplete;
+};
+
+static const char *const compound_texts[] = {"if ... fi", "while ... done", "until ... done", "for ... done", "{ ... }", "( ... )", "function"};
+
+// Function to return the text that stands for a compound command in job listings
+const char *compound_text(const struct compound *compound)
+{
+    return compound_texts[compound->kind];
+}
+
+// Remove quotes and backslashes from a word token in place and NUL-terminate it
+static char *cook_word(char *input, const struct token *token)
+{
+    char *word = input + token->offset;
+    const char *src = word, *end = word + token->length;
+    char *dst = word;
+
+    if (!(token->flags & WORD_QUOTED))
+    {
+        word[token->length] = '\0';
+        return word;
+    }
+
+    while (src < end)
+    {
+        if (*src == '\\')
+        {
+            src++;
+            if (src < end)
+                *dst++ = *src++;
+        }
+        else if (*src == '\'')
+        {
+            for (src++; *src != '\''; src++)
+                *dst++ = *src;
+            src++;
+        }
+        else if (*src == '"')
+        {
+            for (src++; *src != '"'; src++)
+            {
+                if (*src == '\\' && strchr("\\\"$`", src[1]))
+                    src++;
+                *dst++ = *src;
+            }
+            src++;
+        }
+        else
+        {
+            *dst++ = *src++;
+        }
+    }
+    *dst = '\0';
+    return word;
+}
+
+// Cook a word unless it needs expansion, in which case it is only NUL-terminated
+static char *take_word(char *input, const struct token *token, int *flags)
+{
+    if (token->flags & (WORD_DOLLAR | WORD_GLOB))
+    {
+        input[token->offset + token->length] = '\0';
+        *flags = ARG_EXPAND | (token->flags & WORD_GLOB ? ARG_GLOB : 0);
+        return input + token->offset;
+    }
+    *flags = 0;
+    return cook_word(input, token);
+}
+
+// Report the token a parse stopped at, or only note that the input ended too early
+static void report_unexpected_token(const char *input, struct parse_state *state, const struct token *token)
+{
+    if (token->kind == TOKEN_END)
+        state->incomplete = 1;
+    else if (token->kind == TOKEN_WORD)
+        fprintf(stderr, SYNTAX_ERROR_UNEXPECTED_WORD_MESSAGE, (int)token->length, input + token->offset);
+    else
+        fprintf(stderr, SYNTAX_ERROR_UNEXPECTED_TOKEN_MESSAGE, token_name(token->kind));
+}
+
+static int is_redirect_operator(enum token_kind kind)
+{
+    return kind == TOKEN_LESS || kind == TOKEN_GREAT || kind == TOKEN_DGREAT || kind == TOKEN_LESSAND || kind == TOKEN_GREATAND ||
+           kind == TOKEN_DLESS || kind == TOKEN_DLESSDASH || kind == TOKEN_TLESS;
+}
+
+static int reads_input(enum token_kind op)
+{
+    return op == TOKEN_LESS || op == TOKEN_LESSAND || op == TOKEN_DLESS || op == TOKEN_DLESSDASH || op == TOKEN_TLESS;
+}
+
+// Terminate a here-document's body, removing the leading tabs of its lines for '<<-'
+static char *take_here_document(char *input, const struct token *token, int strip, int *flags)
+{
+    char *body = input + token->offset, *src = body, *dst = body, *end = body + token->length;
+
+    while (strip && src < end)
+    {
+        while (*src == '\t')
+            src++;
+        while (src < end && *src != '\n')
+            *dst++ = *src++;
+        if (src < end)
+            *dst++ = *src++;
+    }
+    *(strip ? dst : end) = '\0';
+    *flags = token->flags & WORD_DOLLAR ? ARG_EXPAND : 0;
+    return body;
+}
+
+// Parse "[n]op target" starting at tokens[i]; returns the number of tokens used or -1
+static int parse_redirect(char *input, const struct token *tokens, int i, struct redirect *redirect)
+{
+    int used = 0;
+    enum token_kind op;
+    char *target;
+
+    redirect->fd = -1;
+    if (tokens[i].kind == TOKEN_IO_NUMBER)
+    {
+        redirect->fd = atoi(cook_word(input, &tokens[i]));
+        used++;
+    }
+    op = tokens[i + used].kind;
+    if (redirect->fd == -1)
+        redirect->fd = reads_input(op) ? STDIN_FILENO : STDOUT_FILENO;
+
+    if (tokens[i + used + 1].kind != TOKEN_WORD)
+    {
+        message(stderr, reads_input(op) ? SYNTAX_ERROR_LESS_THAN_MESSAGE : SYNTAX_ERROR_GREATER_THAN_MESSAGE);
+        return -1;
+    }
+    if (op == TOKEN_DLESS || op == TOKEN_DLESSDASH)
+    { // The delimiter word is followed by the body
+        target = take_here_document(input, &tokens[i + used + 2], op == TOKEN_DLESSDASH, &redirect->target_flags);
+        used++;
+    }
+    else
+    {
+        target = take_word(input, &tokens[i + used + 1], &redirect->target_flags);
+    }
+    used += 2;
+
+    redirect->target = target;
+    redirect->target_fd = -1;
+    redirect->reads = op == TOKEN_LESSAND;
+    if (op == TOKEN_DLESS || op == TOKEN_DLESSDASH)
+        redirect->kind = REDIRECT_HERE_DOCUMENT;
+    else if (op == TOKEN_TLESS)
+        redirect->kind = REDIRECT_HERE_STRING;
+    else if (op == TOKEN_LESS)
+        redirect->kind = REDIRECT_INPUT;
+    else if (op == TOKEN_GREAT)
+        redirect->kind = REDIRECT_OUTPUT;
+    else if (op == TOKEN_DGREAT)
+        redirect->kind = REDIRECT_APPEND;
+    else if (redirect->target_flags & ARG_EXPAND)
+        redirect->kind = REDIRECT_DUP; // Resolved once expanded (redirect_source_fd)
+    else if (strcmp(target, "-") == 0)
+        redirect->kind = REDIRECT_CLOSE;
+    else if (target[0] != '\0' && strspn(target, "0123456789") == strlen(target))
+    {
+        redirect->kind = REDIRECT_DUP;
+        redirect->target_fd = atoi(target);
+    }
+    else if (variable_name_length(target) == strlen(target))
+        redirect->kind = REDIRECT_DUP; // A coprocess, looked up when the command runs
+    else
+    {
+        fprintf(stderr, SYNTAX_ERROR_BAD_FD_MESSAGE, target);
+        return -1;
+    }
+    return used;
+}
+
+// Tell whether a token is the unquoted word `keyword`
+static int is_keyword(const char *input, const struct token *token, const char *keyword)
+{
+    return token->kind == TOKEN_WORD && token->flags == 0 && token->length == strlen(keyword) &&
+           strncmp(input + token->offset, keyword, token->length) == 0;
+}
+
+// Tell whether a token where a command starts begins a compound command other than a function
+static int starts_compound(const char *input, const struct token *token)
+{
+    return token->kind == TOKEN_LPAREN || is_keyword(input, token, "if") || is_keyword(input, token, "while") ||
+           is_keyword(input, token, "until") || is_keyword(input, token, "for") || is_keyword(input, token, "{");
+}
+
+// Tell whether tokens[i] starts 'name()'
+static int is_function_definition(const char *input, const struct token *tokens, int i)
+{
+    return tokens[i].kind == TOKEN_WORD && tokens[i].flags == 0 && tokens[i + 1].kind == TOKEN_LPAREN &&
+           tokens[i + 2].kind == TOKEN_RPAREN && variable_name_length(input + tokens[i].offset) == tokens[i].length;
+}
+
+// Tell whether a token ends a list inside a compound command: ')' or a closing reserved word
+static int ends_compound_list(const char *input, const struct token *token)
+{
+    static const char *const closers[] = {"then", "elif", "else", "fi", "do", "done", "}"};
+
+    if (token->kind == TOKEN_RPAREN)
+        return 1;
+    if (token->kind != TOKEN_WORD || token->flags != 0 || token->length > 4)
+        return 0;
+    for (size_t k = 0; k < sizeof(closers) / sizeof(closers[0]); k++)
+    {
+        if (is_keyword(input, token, closers[k]))
+            return 1;
+    }
+    return 0;
+}
+
+static int parse_command(char *input, struct parse_state *state, int *position, struct command *command);
+static int parse_list(char *input, struct parse_state *state, int *position, struct pipeline *pipelines, int *pipeline_count);
+
+static struct compound *new_compound(struct parse_state *state, enum compound_kind kind)
+{
+    struct compound *compound = arena_alloc(state->arena, sizeof(*compound));
+
+    if (!compound)
+    {
+        perror("Parse allocation failed");
+        return NULL;
+    }
+    memset(compound, 0, sizeof(*compound));
+    compound->kind = kind;
+    return compound;
+}
+
+// Parse the list inside a compound command, up to the reserved word or ')' that ends it and
+// possibly over several lines, and copy it off the scratch stack
+static int parse_compound_list(char *input, struct parse_state *state, int *position, struct command_list *list)
+{
+    const struct token *tokens = state->tokens;
+    int i = *position, base;
+
+    if (!state->pipelines)
+    {
+        state->pipelines = arena_alloc(state->arena, PARSE_MAX_COMMANDS(state->token_count) * sizeof(*state->pipelines));
+        if (!state->pipelines)
+        {
+            perror("Parse allocation failed");
+            return -1;
+        }
+    }
+    base = state->pipeline_count;
+    while (1)
+    {
+        while (tokens[i].kind == TOKEN_NEWLINE)
+            i++;
+        if (tokens[i].kind == TOKEN_END || ends_compound_list(input, &tokens[i]))
+            break;
+        if (parse_list(input, state, &i, state->pipelines, &state->pipeline_count) == -1)
+            return -1;
+        if (tokens[i].kind != TOKEN_NEWLINE && !ends_compound_list(input, &tokens[i]))
+        {
+            report_unexpected_token(input, state, &tokens[i]);
+            return -1;
+        }
+    }
+
+    list->count = state->pipeline_count - base;
+    if (list->count == 0)
+    { // As in 'if then', or the input ended first
+        report_unexpected_token(input, state, &tokens[i]);
+        return -1;
+    }
+    list->pipelines = arena_alloc(state->arena, list->count * sizeof(*list->pipelines));
+    if (!list->pipelines)
+    {
+        perror("Parse allocation failed");
+        return -1;
+    }
+    memcpy(list->pipelines, &state->pipelines[base], list->count * sizeof(*list->pipelines));
+    state->pipeline_count = base;
+    *position = i;
+    return 0;
+}
+
+// Consume the reserved word keyword at tokens[*position], or report what is there instead
+static int expect_keyword(const char *input, struct parse_state *state, int *position, const char *keyword)
+{
+    const struct token *token = &state->tokens[*position];
+
+    if (!is_keyword(input, token, keyword))
+    {
+        report_unexpected_token(input, state, token);
+        return -1;
+    }
+    (*position)++;
+    return 0;
+}
+
+// Parse 'if' or 'elif' at tokens[*position], up to and including the 'fi'
+static int parse_if(char *input, struct parse_state *state, int *position, struct compound *compound)
+{
+    const struct token *tokens = state->tokens;
+    int i = *position + 1;
+
+    if (parse_compound_list(input, state, &i, &compound->condition) == -1 || expect_keyword(input, state, &i, "then") == -1 ||
+        parse_compound_list(input, state, &i, &compound->body) == -1)
+        return -1;
+
+    if (is_keyword(input, &tokens[i], "elif"))
+    { // The 'elif' part takes the 'fi'
+        compound->otherwise = new_compound(state, COMPOUND_IF);
+        if (!compound->otherwise || parse_if(input, state, &i, compound->otherwise) == -1)
+            return -1;
+        *position = i;
+        return 0;
+    }
+    if (is_keyword(input, &tokens[i], "else"))
+    {
+        i++;
+        compound->otherwise = new_compound(state, COMPOUND_GROUP);
+        if (!compound->otherwise || parse_compound_list(input, state, &i, &compound->otherwise->body) == -1)
+            return -1;
+    }
+    if (expect_keyword(input, state, &i, "fi") == -1)
+        return -1;
+    *position = i;
+    return 0;
+}
+
+// Parse 'do list done'
+static int parse_do_group(char *input, struct parse_state *state, int *position, struct command_list *body)
+{
+    int i = *position;
+
+    while (state->tokens[i].kind == TOKEN_NEWLINE)
+        i++;
+    if (expect_keyword(input, state, &i, "do") == -1 || parse_compound_list(input, state, &i, body) == -1 ||
+        expect_keyword(input, state, &i, "done") == -1)
+        return -1;
+    *position = i;
+    return 0;
+}
+
+// Parse 'for name [in words...]' at tokens[*position] and its body
+static int parse_for(char *input, struct parse_state *state, int *position, struct compound *compound)
+{
+    const struct token *tokens = state->tokens;
+    struct command *words = &compound->words;
+    int i = *position + 1;
+
+    if (tokens[i].kind != TOKEN_WORD || tokens[i].flags != 0 || variable_name_length(input + tokens[i].offset) != tokens[i].length)
+    {
+        report_unexpected_token(input, state, &tokens[i]);
+        return -1;
+    }
+    compound->name = cook_word(input, &tokens[i++]);
+    while (tokens[i].kind == TOKEN_NEWLINE)
+        i++;
+
+    words->args = &state->words[state->word_count];
+    words->arg_flags = &state->word_flags[state->word_count];
+    if (is_keyword(input, &tokens[i], "in"))
+    {
+        compound->has_words = 1;
+        for (i++; tokens[i].kind == TOKEN_WORD; i++)
+        {
+            int flags;
+
+            state->words[state->word_count] = take_word(input, &tokens[i], &flags);
+            state->word_flags[state->word_count++] = flags;
+            words->needs_expansion |= flags;
+            words->arg_count++;
+        }
+        if (tokens[i].kind != TOKEN_SEMI && tokens[i].kind != TOKEN_NEWLINE)
+        {
+            report_unexpected_token(input, state, &tokens[i]);
+            return -1;
+        }
+        i++;
+    }
+    else if (tokens[i].kind == TOKEN_SEMI)
+    {
+        i++;
+    }
+    state->word_flags[state->word_count] = 0;
+    state->words[state->word_count++] = NULL;
+
+    if (parse_do_group(input, state, &i, &compound->body) == -1)
+        return -1;
+    *position = i;
+    return 0;
+}
+
+// Parse 'name()' at tokens[*position] and the compound command that is the function's body
+static int parse_function(char *input, struct parse_state *state, int *position, struct compound *compound)
+{
+    const struct token *tokens = state->tokens;
+    struct command *body = &state->commands[state->command_count];
+    struct pipeline *pipeline;
+    int i = *position + 3;
+
+    while (tokens[i].kind == TOKEN_NEWLINE)
+        i++;
+    if (!starts_compound(input, &tokens[i]))
+    {
+        report_unexpected_token(input, state, &tokens[i]);
+        return -1;
+    }
+    compound->name = cook_word(input, &tokens[*position]);
+    state->command_count++;
+    if (parse_command(input, state, &i, body) == -1)
+        return -1;
+
+    // The body is kept as a list of one pipeline of one stage, which is how it is run
+    pipeline = arena_alloc(state->arena, sizeof(*pipeline) + sizeof(*body));
+    if (!pipeline)
+    {
+        perror("Parse allocation failed");
+        return -1;
+    }
+    memset(pipeline, 0, sizeof(*pipeline));
+    pipeline->commands = (struct command *)(pipeline + 1);
+    pipeline->command_count = 1;
+    pipeline->commands[0] = *body;
+    state->command_count--;
+    compound->body.pipelines = pipeline;
+    compound->body.count = 1;
+    *position = i;
+    return 0;
+}
+
+// Parse the compound command starting at tokens[*position] into command; the caller parses
+// the redirections that may follow it
+static int parse_compound(char *input, struct parse_state *state, int *position, struct command *command)
+{
+    const struct token *tokens = state->tokens, *token = &tokens[*position];
+    enum compound_kind kind = COMPOUND_FUNCTION;
+    struct compound *compound;
+    int i = *position, result;
+
+    if (token->kind == TOKEN_LPAREN)
+        kind = COMPOUND_SUBSHELL;
+    else if (is_keyword(input, token, "if"))
+        kind = COMPOUND_IF;
+    else if (is_keyword(input, token, "while"))
+        kind = COMPOUND_WHILE;
+    else if (is_keyword(input, token, "until"))
+        kind = COMPOUND_UNTIL;
+    else if (is_keyword(input, token, "for"))
+        kind = COMPOUND_FOR;
+    else if (is_keyword(input, token, "{"))
+        kind = COMPOUND_GROUP;
+    compound = new_compound(state, kind);
+    if (!compound)
+        return -1;
+
+    state->depth++;
+    if (kind == COMPOUND_IF)
+    {
+        result = parse_if(input, state, &i, compound);
+    }
+    else if (kind == COMPOUND_WHILE || kind == COMPOUND_UNTIL)
+    {
+        i++;
+        result = parse_compound_list(input, state, &i, &compound->condition) == -1 ? -1 : parse_do_group(input, state, &i, &compound->body);
+    }
+    else if (kind == COMPOUND_FOR)
+    {
+        result = parse_for(input, state, &i, compound);
+    }
+    else if (kind == COMPOUND_GROUP)
+    {
+        i++;
+        result = parse_compound_list(input, state, &i, &compound->body) == -1 ? -1 : expect_keyword(input, state, &i, "}");
+    }
+    else if (kind == COMPOUND_SUBSHELL)
+    {
+        i++;
+        result = parse_compound_list(input, state, &i, &compound->body);
+        if (result == 0 && tokens[i].kind != TOKEN_RPAREN)
+        {
+            report_unexpected_token(input, state, &tokens[i]);
+            result = -1;
+        }
+        i++;
+    }
+    else
+    {
+        result = parse_function(input, state, &i, compound);
+    }
+    state->depth--;
+
+    command->compound = compound;
+    *position = i;
+    return result;
+}
+
+// Function to parse a single command (one pipeline stage) into arguments and redirections
+static int parse_command(char *input, struct parse_state *state, int *position, struct command *command)
+{
+    const struct token *tokens = state->tokens;
+    int i = *position;
+
+    command->compound = NULL;
+    if (starts_compound(input, &tokens[i]) || is_function_definition(input, tokens, i))
+    {
+        if (parse_compound(input, state, &i, command) == -1)
+            return -1;
+    }
+    else if (ends_compound_list(input, &tokens[i]))
+    {
+        report_unexpected_token(input, state, &tokens[i]);
+        return -1;
+    }
+
+    command->args = &state->words[state->word_count];
+    command->arg_flags = &state->word_flags[state->word_count];
+    command->arg_count = 0;
+    command->redirects = &state->redirects[state->redirect_count];
+    command->redirect_count = 0;
+    command->needs_expansion = 0;
+
+    while (1)
+    {
+        const struct token *token = &tokens[i];
+
+        if (token->kind == TOKEN_WORD && !command->compound)
+        {
+            int flags;
+
+            state->words[state->word_count] = take_word(input, token, &flags);
+            state->word_flags[state->word_count++] = flags;
+            command->needs_expansion |= flags;
+            command->arg_count++;
+            i++;
+        }
+        else if (token->kind == TOKEN_IO_NUMBER || is_redirect_operator(token->kind))
+        {
+            int used = parse_redirect(input, tokens, i, &state->redirects[state->redirect_count]);
+
+            if (used == -1)
+                return -1;
+            command->needs_expansion |= state->redirects[state->redirect_count].target_flags;
+            state->redirect_count++;
+            command->redirect_count++;
+            i += used;
+        }
+        else
+        {
+            break;
+        }
+    }
+    state->word_flags[state->word_count] = 0;
+    state->words[state->word_count++] = NULL;
+
+    if (command->arg_count == 0 && command->redirect_count == 0 && !command->compound)
+    {
+        report_unexpected_token(input, state, &tokens[i]);
+        return -1;
+    }
+    *position = i;
+    return 0;
+}
+
+// Function to parse an optional 'time' and '!', stages separated by '|', and an optional '&',
+// starting at tokens[*position]
+static int parse_pipeline(char *input, struct parse_state *state, int *position, struct pipeline *pipeline)
+{
+    const struct token *tokens = state->tokens;
+    int i = *position;
+
+    pipeline->commands = &state->commands[state->command_count];
+    pipeline->command_count = 0;
+    pipeline->is_background = 0;
+    pipeline->is_timed = 0;
+    pipeline->connector = LIST_SEQUENCE;
+    pipeline->is_negated = 0;
+
+    if (is_keyword(input, &tokens[i], "time"))
+    {
+        pipeline->is_timed = 1;
+        i++;
+        if (tokens[i].kind == TOKEN_NEWLINE || tokens[i].kind == TOKEN_END)
+        { // 'time' on its own times an empty command
+            *position = i;
+            return 0;
+        }
+    }
+    if (is_keyword(input, &tokens[i], "!"))
+    {
+        pipeline->is_negated = 1;
+        i++;
+    }
+
+    while (1)
+    {
+        // The slot is taken first, so a compound stage nests its own stages above it
+        if (parse_command(input, state, &i, &state->commands[state->command_count++]) == -1)
+            return -1;
+        pipeline->command_count++;
+
+        if (tokens[i].kind != TOKEN_PIPE)
+            break;
+        i++;
+        while (tokens[i].kind == TOKEN_NEWLINE)
+            i++; // A pipeline may continue on the next line
+    }
+
+    if (state->depth > 0)
+    { // Inside a compound command: move the stages off the scratch stack
+        struct command *commands = arena_alloc(state->arena, pipeline->command_count * sizeof(*commands));
+
+        if (!commands)
+        {
+            perror("Parse allocation failed");
+            return -1;
+        }
+        memcpy(commands, pipeline->commands, pipeline->command_count * sizeof(*commands));
+        pipeline->commands = commands;
+        state->command_count -= pipeline->command_count;
+    }
+    *position = i;
+    return 0;
+}
+
+// Function to parse pipelines joined by '&&', '||', ';' and '&' up to the end of the line,
+// appending them to pipelines[*pipeline_count]
+static int parse_list(char *input, struct parse_state *state, int *position, struct pipeline *pipelines, int *pipeline_count)
+{
+    const struct token *tokens = state->tokens;
+    int i = *position;
+
+    while (1)
+    {
+        struct pipeline *pipeline = &pipelines[(*pipeline_count)++];
+
+        if (parse_pipeline(input, state, &i, pipeline) == -1)
+            return -1;
+
+        if (tokens[i].kind == TOKEN_AND_IF || tokens[i].kind == TOKEN_OR_IF)
+        {
+            pipeline->connector = tokens[i].kind == TOKEN_AND_IF ? LIST_AND : LIST_OR;
+            i++;
+            while (tokens[i].kind == TOKEN_NEWLINE)
+                i++; // The list may continue on the next line
+            continue;
+        }
+        if (tokens[i].kind != TOKEN_SEMI && tokens[i].kind != TOKEN_AMP)
+            break;
+        pipeline->is_background = tokens[i].kind == TOKEN_AMP;
+        i++;
+        if (tokens[i].kind == TOKEN_NEWLINE || tokens[i].kind == TOKEN_END || ends_compound_list(input, &tokens[i]))
+            break; // A trailing ';' or '&'
+    }
+    *position = i;
+    return 0;
+}
+
+// Function to parse an input line into a list of pipelines.
+// Returns 0 on success (pipeline_count is 0 for an empty line) or -1 after reporting a syntax error.
+// A line that only ends too early fails without a report, with incomplete set.
+int parse_input(char *input, struct parse_context *context)
+{
+    struct parse_state state = {0};
+    const struct token *tokens;
+    int i = 0, count;
+
+    context->pipelines = NULL;
+    context->pipeline_count = 0;
+    context->incomplete = 0;
+    memset(&context->tokens, 0, sizeof(context->tokens));
+    context->tokens.arena = context->arena;
+    if (tokenize(input, &context->tokens) == -1)
+    {
+        context->incomplete = context->tokens.incomplete;
+        return -1;
+    }
+    tokens = context->tokens.tokens;
+    count = context->tokens.count;
+
+    state.tokens = tokens;
+    state.token_count = count;
+    state.arena = context->arena;
+    state.words = arena_alloc(context->arena, PARSE_MAX_WORDS(count) * sizeof(*state.words));
+    state.word_flags = arena_alloc(context->arena, PARSE_MAX_WORDS(count));
+    state.redirects = arena_alloc(context->arena, PARSE_MAX_REDIRECTS(count) * sizeof(*state.redirects));
+    state.commands = arena_alloc(context->arena, PARSE_MAX_COMMANDS(count) * sizeof(*state.commands));
+    context->pipelines = arena_alloc(context->arena, PARSE_MAX_COMMANDS(count) * sizeof(*context->pipelines));
+    if (!state.words || !state.word_flags || !state.redirects || !state.commands || !context->pipelines)
+    {
+        perror("Parse allocation failed");
+        return -1;
+    }
+
+    while (tokens[i].kind == TOKEN_NEWLINE)
+        i++;
+    if (tokens[i].kind == TOKEN_END)
+        return 0;
+
+    if (parse_list(input, &state, &i, context->pipelines, &context->pipeline_count) == -1)
+    {
+        context->incomplete = state.incomplete;
+        return -1;
+    }
+
+    while (tokens[i].kind == TOKEN_NEWLINE)
+        i++;
+    if (tokens[i].kind != TOKEN_END)
+    {
+        report_unexpected_token(input, &state, &tokens[i]);
+        return -1;
+    }
+    return 0;
+}
+
+// Count the lines before tokens[index], for error reports. The text cannot be used,
+// since cooking a word may have overwritten the newline after it.
+static int line_number(const struct token *tokens, int index)
+{
+    int line = 1;
+
+    for (int i = 0; i < index; i++)
+    {
+        if (tokens[i].kind == TOKEN_NEWLINE)
+            line++;
+        else if (tokens[i].kind == TOKEN_HEREDOC)
+            line += HEREDOC_LINES(&tokens[i]);
+    }
+    return line;
+}
+
+// Function to parse a whole script, one list per line, before anything runs.
+// Returns 0 on success or -1 after reporting a syntax error; error_line is set on error.
+int parse_script(char *text, struct script *script)
+{
+    struct parse_state state = {0};
+    const struct token *tokens;
+    int i = 0, count;
+
+    memset(script, 0, sizeof(*script));
+    if (tokenize(text, &script->tokens) == -1)
+    {
+        if (script->tokens.incomplete)
+            fprintf(stderr, SYNTAX_ERROR_UNEXPECTED_TOKEN_MESSAGE, token_name(TOKEN_END));
+        return -1;
+    }
+    tokens = script->tokens.tokens;
+    count = script->tokens.count;
+
+    script->words = malloc(PARSE_MAX_WORDS(count) * sizeof(*script->words));
+    script->word_flags = malloc(PARSE_MAX_WORDS(count));
+    script->redirects = malloc(PARSE_MAX_REDIRECTS(count) * sizeof(*script->redirects));
+    script->commands = malloc(PARSE_MAX_COMMANDS(count) * sizeof(*script->commands));
+    script->pipelines = malloc(PARSE_MAX_COMMANDS(count) * sizeof(*script->pipelines));
+    if (!script->words || !script->word_flags || !script->redirects || !script->commands || !script->pipelines)
+    {
+        perror("Script allocation failed");
+        return -1;
+    }
+    state.tokens = tokens;
+    state.token_count = count;
+    state.arena = &script->arena;
+    state.words = script->words;
+    state.word_flags = script->word_flags;
+    state.redirects = script->redirects;
+    state.commands = script->commands;
+
+    while (1)
+    {
+        while (tokens[i].kind == TOKEN_NEWLINE)
+            i++;
+        if (tokens[i].kind == TOKEN_END)
+            break;
+
+        int start = i;
+
+        if (parse_list(text, &state, &i, script->pipelines, &script->pipeline_count) == -1)
+        {
+            if (state.incomplete)
+                fprintf(stderr, SYNTAX_ERROR_UNEXPECTED_TOKEN_MESSAGE, token_name(TOKEN_END));
+            script->error_line = line_number(tokens, start);
+            return -1;
+        }
+        if (tokens[i].kind != TOKEN_NEWLINE && tokens[i].kind != TOKEN_END)
+        {
+            report_unexpected_token(text, &state, &tokens[i]);
+            script->error_line = line_number(tokens, i);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Function to release the storage of a parsed script (the text itself belongs to the caller)
+void free_script(struct script *script)
+{
+    free(script->tokens.tokens);
+    free(script->words);
+    free(script->word_flags);
+    free(script->redirects);
+    free(script->commands);
+    free(script->pipelines);
+    arena_free(&script->arena);
+    memset(script, 0, sizeof(*script));
+}
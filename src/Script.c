@@ -0,0 +1,147 @@
+/**
+ * @file Script.c
+ * @brief Non-interactive execution of script files and '-c' strings.
+ *
+ * A script is read in one go rather than line by line through stdio. Regular files
+ * are mmap'ed privately with one byte to spare, which the kernel fills with the NUL
+ * that terminates the text; the parser's in-place quote removal then only dirties the
+ * pages it touches. Pipes and other files are read in blocks of at least
+ * SCRIPT_BLOCK_SIZE. The whole text is parsed into a list of pipelines before the first
+ * one runs, so a syntax error anywhere means that nothing runs.
+ *
+ * With -e, the script stops at the first pipeline that exits with a non-zero status.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SCRIPT_BLOCK_SIZE (256 * 1024)
+
+struct script_text
+{
+    char *data; // NUL-terminated and writable
+    size_t size;
+    int mapped;
+};
+
+int exit_on_error; // Set by -e
+
+// Read every remaining byte of fd into a growing buffer
+static int read_script_blocks(int fd, struct script_text *text)
+{
+    size_t capacity = SCRIPT_BLOCK_SIZE;
+    char *data = malloc(capacity);
+    ssize_t length;
+
+    text->size = 0;
+    while (data)
+    {
+        if (capacity - text->size <= SCRIPT_BLOCK_SIZE / 2)
+        {
+            char *larger = realloc(data, capacity * 2);
+
+            if (!larger)
+                break;
+            data = larger;
+            capacity *= 2;
+        }
+        length = read(fd, data + text->size, capacity - text->size - 1);
+        if (length == -1 && errno == EINTR)
+            continue;
+        if (length <= 0)
+        {
+            if (length == -1)
+                break;
+            data[text->size] = '\0';
+            text->data = data;
+            text->mapped = 0;
+            return 0;
+        }
+        text->size += length;
+    }
+    free(data);
+    return -1;
+}
+
+// Function to load a whole script from fd; returns -1 after setting errno on failure
+int load_script(int fd, struct script_text *text)
+{
+    struct stat st;
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    // The spare byte must fall inside the last mapped page, or touching it raises SIGBUS
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 && st.st_size % page_size != 0)
+    {
+        char *data = mmap(NULL, st.st_size + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+        if (data != MAP_FAILED)
+        {
+            text->data = data;
+            text->size = st.st_size;
+            text->mapped = 1;
+            return 0;
+        }
+    }
+    return read_script_blocks(fd, text);
+}
+
+void unload_script(struct script_text *text)
+{
+    if (text->mapped)
+        munmap(text->data, text->size + 1);
+    else
+        free(text->data);
+    text->data = NULL;
+}
+
+// Function to parse and run a whole script; returns the status the shell should exit with
+int run_script(char *text, const char *name)
+{
+    struct script script;
+    uint64_t started = stats_now();
+    int parsed = parse_script(text, &script);
+
+    stats_record(PHASE_PARSE, started);
+    if (parsed == -1)
+    {
+        if (script.error_line > 0)
+            fprintf(stderr, SCRIPT_SYNTAX_ERROR_LINE_MESSAGE, name, script.error_line);
+        free_script(&script);
+        return 2;
+    }
+
+    for (int i = 0; i < script.pipeline_count;)
+    {
+        int failed;
+
+        arena_reset(&command_arena);
+        notify_finished_jobs();
+        i += run_and_or_list(&script.pipelines[i], script.pipeline_count - i, &failed);
+        if (exit_on_error && failed)
+            break;
+    }
+    free_script(&script);
+    return last_status;
+}
+
+// Function to run the script file at path
+int run_script_file(const char *path)
+{
+    struct script_text text;
+    uint64_t started = stats_now();
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    int status;
+
+    if (fd == -1 || load_script(fd, &text) == -1)
+    {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        if (fd != -1)
+            close(fd);
+        return 127;
+    }
+    close(fd);
+    stats_record(PHASE_READ, started);
+    status = run_script(text.data, path);
+    unload_script(&text);
+    return status;
+}
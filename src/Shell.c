@@ -5,23 +5,66 @@
  * This program implements a basic shell that can execute commands with support for:
  * - Command history
  * - Background execution using '&'
- * - Input redirection using '<'
- * - Output redirection using '>'
- * - Piped commands using '|'
- * - Built-in commands like 'cd', 'exit', and 'history'
+ * - Redirection with '<', '>', '>>', '[n]<&m', '[n]>&m' and '[n]>&-', e.g. '2>' and '2>&1'
+ * - Here-documents ('<<EOF', '<<-EOF') and here-strings ('<<<'), read from a pipe or memfd without temporary files
+ * - Piped commands using '|', with redirections and builtins allowed in every stage
+ * - Lists of pipelines joined by ';', '&', '&&' and '||', run by their exit statuses without a subshell
+ * - 'if', 'while', 'until', 'for', '{ ... }', '( ... )' and functions, interpreted in the shell without forking
+ * - Built-in commands like 'cd', 'exit', 'hash' and 'history'
+ * - In-process 'echo', 'printf', 'test'/'[', 'true', 'false', 'pwd' and 'read', with redirections applied to the shell and undone
+ * - Job control for background jobs: 'jobs', 'fg', 'bg', 'wait' and 'kill %n'
+ * - The 'parallel' builtin, running one command over many inputs with at most N at a time
+ * - Coprocesses: 'coproc [-n NAME] cmd' keeps a command running behind pipes, reached with '>&NAME' and '<&NAME'
  * - Re-execution of commands from history using '!<number>'
+ * - The 'time' keyword for commands and pipelines, and '$?' for the last exit status
+ * - Shell variables: 'NAME=value', '$NAME', '${NAME}', '$$', 'export' and 'unset', and positional parameters ('$1', '$#', '$@')
+ * - '@cpu=', '@nice=' and '@mem=' prefixes that pin and limit a command, and per-stage CPU pinning of pipelines
+ * - Optional cgroup v2 leaves per job (MYSH_CGROUP), reported by 'jobs -l' and throttled with 'cglimit'
+ * - Command substitution with '$(...)' and backquotes, with builtins such as 'echo' captured without a fork
+ * - Pathname expansion of '*', '?' and '[...]', sorted, over cached directory listings
+ * - A raw-mode line editor on terminals, with history, CTRL+R search and Tab completion
+ * - Latency histograms of the shell's own phases: the 'stats' builtin, and a JSON dump via MYSH_STATS
+ * - Non-interactive script files ('mysh file') and command strings ('mysh -c cmd'), with '-e' to stop on failure
  *
  * The shell reads user input, parses it to identify special symbols, and executes the commands accordingly.
  *
  * Functions:
- * - add_to_history: Saves commands in history.
- * - print_history: Displays the command history.
- * - parse_input: Parses the input string into commands, supporting multiple pipes.
- * - parse_command: Parses a single command into arguments, detecting background execution, input, and output redirection.
+ * - add_to_history (History.c): Saves commands in the history ring.
+ * - print_history (History.c): Displays the command history.
+ * - tokenize (Lexer.c): Splits the input into token views in a single pass, honouring quotes and escapes.
+ * - parse_input (Parser.c): Builds a pipeline AST from the tokens, supporting multiple pipes.
+ * - arena_alloc (Arena.c): Hands out the storage of the current command, released all at once by arena_reset.
+ * - parse_command (Parser.c): Parses a single pipeline stage into arguments and redirections.
+ * - parse_cached (ParseCache.c): Copies the AST of a line parsed before instead of parsing it again.
  * - execute_command: Executes a command with optional input/output redirection.
- * - execute_piped_commands: Executes a pipeline of commands.
- * - handle_builtin: Handles built-in shell commands like 'cd', 'exit', and 'history'.
- * - main: The main loop of the shell that reads user input and executes commands.
+ * - execute_piped_commands: Executes a pipeline of commands, applying each stage's redirections.
+ * - run_builtin_in_shell: Runs a builtin in the shell with its redirections applied and then undone.
+ * - execute_list: Runs a list of pipelines, skipping those that '&&' and '||' rule out.
+ * - execute_pipeline: Expands and runs a parsed pipeline, timing it after 'time'.
+ * - execute_compound (Control.c): Walks a compound command's AST, running its lists in the shell.
+ * - call_function (Control.c): Runs a shell function with its arguments as the positional parameters.
+ * - run_pipeline: Runs a pipeline, dispatching builtins.
+ * - expand_pipeline (Expand.c): Expands '$' parameters in the words of a pipeline before it runs.
+ * - capture_output (Substitution.c): Runs the command of a substitution and collects its output.
+ * - glob_expand (Glob.c): Replaces a pattern by the sorted paths it matches.
+ * - variables_envp (Variables.c): Returns the environment for commands, rebuilt only when it changed.
+ * - timing_end (Timing.c): Prints the wall-clock time and rusage of a timed pipeline.
+ * - stats_record (Stats.c): Adds the duration of one shell phase to its histogram.
+ * - reap_jobs (Jobs.c): Collects children reported by SIGCHLD and updates the job table.
+ * - event_wait (Events.c): Sleeps in epoll until the terminal or a signalfd is ready and runs their handlers.
+ * - move_data (Splice.c): Moves data for redirect-only pipeline ends with splice(2) when MYSH_SPLICE=1.
+ * - spawn_command (Spawn.c): Launches a command through posix_spawn, falling back to fork()+exec.
+ * - cgroup_create_leaf (Cgroup.c): Creates the cgroup v2 leaf that a new job's processes start in.
+ * - plan_limit_prefixes (Limits.c): Takes the '@cpu=', '@nice=' and '@mem=' words off a command into its spawn plan.
+ * - handle_builtin: Runs a builtin found by binary search in the sorted builtins table, or '!<number>'.
+ * - builtin_test (Builtins.c): Evaluates 'test' and '[' expressions without forking.
+ * - builtin_parallel (Parallel.c): Runs a bounded pool of jobs, refilled as SIGCHLD reports finished ones.
+ * - builtin_coproc (Coproc.c): Starts a background job whose standard input and output are pipes the shell holds.
+ * - run_script (Script.c): Parses a whole script into pipelines and runs them.
+ * - line_edit_read (LineEdit.c): Reads one line in raw mode, redrawing only what changed.
+ * - complete_word (Completion.c): Finds the command or file names that complete a word.
+ * - run_interactive: Reads commands from stdin line by line, with a prompt on a terminal.
+ * - main: Parses the command-line options and picks the interactive or script mode.
  *
  * Usage:
  * - Compile the program using a C compiler (e.g., gcc).
@@ -32,6 +75,8 @@
  *
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -42,303 +87,915 @@
 
 #include "Message.c"
 #include "Constants.c"
+#include "Stats.c"
+#include "Arena.c"
+#include "Variables.c"
+#include "CommandHash.c"
+#include "Events.c"
+#include "Cgroup.c"
+#include "Spawn.c"
+#include "Limits.c"
+#include "History.c"
+#include "HistorySearch.c"
+#include "Lexer.c"
+#include "Parser.c"
+#include "ParseCache.c"
+#include "Jobs.c"
+#include "Timing.c"
+#include "Glob.c"
+#include "Expand.c"
+#include "Completion.c"
+#include "LineEdit.c"
+#include "Splice.c"
+#include "HereDocument.c"
+#include "Builtins.c"
+
+int handle_builtin(char **args);
+int execute_list(struct pipeline *pipelines, int count);
+int run_and_or_list(struct pipeline *pipelines, int count, int *failed);
+int interrupted();
+void run_builtin_in_shell(struct command *command, int input_fd);
 
-#define MAX_INPUT_SIZE 1024
-#define MAX_ARG_COUNT 64
-#define MAX_HISTORY 100
+int interactive; // Reading commands from a terminal, with a prompt and job control
+struct arena command_arena; // Storage of the command being run, reset before the next one
+int previous_status; // $? as it was before the running builtin started, for 'exit' and 'return'
 
-char history[MAX_HISTORY][MAX_INPUT_SIZE]; // Command history
-int history_count = 0;
+#include "Script.c"
+#include "Parallel.c"
+#include "Coproc.c"
+#include "Control.c"
+#include "Substitution.c"
 
-// Function to save commands in history
-void add_to_history(const char *input)
+// Function to open the file named by an INPUT, OUTPUT or APPEND redirection, or the text of a
+// here-document or here-string, reporting failures
+int open_redirect_target(const struct redirect *redirect)
 {
-    if (history_count < MAX_HISTORY)
+    int flags = O_RDONLY;
+    int fd;
+
+    if (redirect->kind == REDIRECT_HERE_DOCUMENT || redirect->kind == REDIRECT_HERE_STRING)
+        return open_here_document(redirect);
+    if (redirect->kind == REDIRECT_OUTPUT)
+        flags = O_WRONLY | O_CREAT | O_TRUNC;
+    else if (redirect->kind == REDIRECT_APPEND)
+        flags = O_WRONLY | O_CREAT | O_APPEND;
+
+    fd = open(redirect->target, flags | O_CLOEXEC, 0644);
+    if (fd == -1)
+        perror(redirect->kind == REDIRECT_INPUT ? "Error opening input file" : "Error opening output file");
+    return fd;
+}
+
+// Function to add the redirections of a command to a spawn plan, opening file targets.
+// The opened descriptors are stored in fds; returns how many, or -1 after reporting an error.
+int plan_redirects(struct spawn_plan *plan, const struct command *command, int *fds)
+{
+    int fd_count = 0;
+
+    if (plan->action_count + command->redirect_count > MAX_SPAWN_ACTIONS)
     {
-        strcpy(history[history_count], input);
-        history_count++;
+        message(stderr, TOO_MANY_REDIRECTIONS_MESSAGE);
+        return -1;
     }
-    else
+    for (int i = 0; i < command->redirect_count; i++)
     {
-        // Shift commands up when history is full
-        for (int i = 1; i < MAX_HISTORY; i++)
+        const struct redirect *redirect = &command->redirects[i];
+
+        if (redirect->kind == REDIRECT_DUP)
         {
-            strcpy(history[i - 1], history[i]);
+            int source = redirect->target_fd != -1 ? redirect->target_fd : redirect_source_fd(redirect);
+
+            if (source == -1)
+            {
+                while (fd_count-- > 0)
+                    close(fds[fd_count]);
+                return -1;
+            }
+            spawn_plan_dup2(plan, source, redirect->fd);
+            continue;
         }
-        strcpy(history[MAX_HISTORY - 1], input);
+        if (redirect->kind == REDIRECT_CLOSE)
+        {
+            spawn_plan_close(plan, redirect->fd);
+            continue;
+        }
+
+        fds[fd_count] = open_redirect_target(redirect);
+        if (fds[fd_count] == -1)
+        {
+            while (fd_count-- > 0)
+                close(fds[fd_count]);
+            return -1;
+        }
+        spawn_plan_dup2(plan, fds[fd_count], redirect->fd);
+        fd_count++;
     }
+    return fd_count;
 }
 
-// Function to display command history
-void print_history()
+// Function to implement 'exit [n]'
+static void builtin_exit(char **args)
 {
-    for (int i = 0; i < history_count; i++)
-    {
-        printf("[%d] %s\n", i + 1, history[i]);
-    }
+    if (interactive)
+        printf("Exiting shell...\n");
+    exit(args[1] != NULL ? atoi(args[1]) : previous_status);
 }
 
-// Function to parse input into commands, supporting multiple pipes
-void parse_input(char *input, char *commands[], int *command_count)
+// Function to implement 'cd directory'
+static void builtin_cd(char **args)
 {
-    *command_count = 0;
-    char *token = strtok(input, "|");
-
-    while (token != NULL)
+    if (args[1] == NULL)
+    {
+        message(stderr, MISSING_ARGUMENT_MESSAGE);
+        last_status = 1;
+    }
+    else if (chdir(args[1]) != 0)
     {
-        commands[(*command_count)++] = token;
-        token = strtok(NULL, "|");
+        perror("chdir failed");
+        last_status = 1;
     }
-    commands[*command_count] = NULL;
 }
 
-// Function to parse a single command into arguments
-void parse_command(char *command, char **args, int *is_background, char **input_file, char **output_file)
+// Function to implement 'history' and 'history -s text'
+static void builtin_history(char **args)
 {
-    int i = 0;
-    char *token = strtok(command, " ");
-    *is_background = 0;
-    *input_file = *output_file = NULL;
-
-    while (token != NULL)
+    if (args[1] != NULL && strcmp(args[1], "-s") == 0)
     {
-        if (strcmp(token, "&") == 0)
+        if (args[2] == NULL)
         {
-            *is_background = 1;
-            break;
-        }
-        else if (strcmp(token, "<") == 0)
-        {
-            token = strtok(NULL, " ");
-            if (!token)
-            {
-                message(stderr, SYNTAX_ERROR_LESS_THAN_MESSAGE);
-                return;
-            }
-            *input_file = token;
-        }
-        else if (strcmp(token, ">") == 0)
-        {
-            token = strtok(NULL, " ");
-            if (!token)
-            {
-                message(stderr, SYNTAX_ERROR_GREATER_THAN_MESSAGE);
-                return;
-            }
-            *output_file = token;
+            message(stderr, HISTORY_SEARCH_MISSING_ARGUMENT_MESSAGE);
+            last_status = 2;
         }
         else
-        {
-            args[i++] = token;
-        }
-        token = strtok(NULL, " ");
+            print_history_matches(args[2]);
+    }
+    else
+    {
+        print_history();
     }
-    args[i] = NULL;
 }
 
-// Function to execute a command with redirection
-void execute_command(char **args, int is_background, char *input_file, char *output_file)
+struct builtin
 {
-    pid_t pid = fork();
+    const char *name;
+    void (*run)(char **args);
+};
 
-    if (pid == -1)
+// Sorted by strcmp() order for find_builtin
+static const struct builtin builtins[] = {
+    {":", builtin_true}, {"[", builtin_test}, {"bg", builtin_bg}, {"break", builtin_break},
+    {"cd", builtin_cd}, {"cglimit", builtin_cglimit}, {"continue", builtin_break}, {"coproc", builtin_coproc},
+    {"echo", builtin_echo}, {"exit", builtin_exit}, {"export", builtin_export}, {"false", builtin_false},
+    {"fg", builtin_fg}, {"hash", builtin_hash}, {"history", builtin_history}, {"jobs", builtin_jobs},
+    {"kill", builtin_kill}, {"parallel", builtin_parallel}, {"printf", builtin_printf}, {"pwd", builtin_pwd},
+    {"read", builtin_read}, {"return", builtin_return}, {"shift", builtin_shift}, {"stats", builtin_stats},
+    {"test", builtin_test}, {"true", builtin_true}, {"unset", builtin_unset}, {"wait", builtin_wait},
+};
+
+static int compare_builtin(const void *name, const void *builtin)
+{
+    return strcmp(name, ((const struct builtin *)builtin)->name);
+}
+
+// Function to find the builtin called name with a binary search; NULL if there is none
+const struct builtin *find_builtin(const char *name)
+{
+    return bsearch(name, builtins, sizeof(builtins) / sizeof(builtins[0]), sizeof(builtins[0]), compare_builtin);
+}
+
+// Function to return the name of the index-th builtin, or NULL past the last one
+const char *builtin_name(size_t index)
+{
+    return index < sizeof(builtins) / sizeof(builtins[0]) ? builtins[index].name : NULL;
+}
+
+// Function to tell whether handle_builtin implements a command name
+int is_builtin(const char *name)
+{
+    return find_builtin(name) != NULL;
+}
+
+// Function to tell whether a command is run by the shell itself: a builtin, a function or a
+// compound command
+int runs_in_shell(const struct command *command)
+{
+    return command->compound || (command->args[0] != NULL && (is_builtin(command->args[0]) || find_function(command->args[0])));
+}
+
+// Run the builtin, function or compound command data; the body of its subshell in a
+// pipeline or in the background
+static int run_stage_call(void *data)
+{
+    struct command *command = data;
+
+    job_control = 0; // The stage's group belongs to the pipeline; the terminal stays with the shell
+    previous_status = last_status;
+    last_status = 0;
+    if (command->compound)
+        execute_compound(command->compound);
+    else
+        handle_builtin(command->args);
+    return last_status;
+}
+
+// Function to run a builtin, function or compound command inside the shell with its stdin
+// and redirections applied. input_fd becomes its standard input unless it is -1; everything
+// is restored afterwards.
+void run_builtin_in_shell(struct command *command, int input_fd)
+{
+    struct spawn_plan plan;
+    struct saved_fds saved;
+    int fds[MAX_SPAWN_ACTIONS], fd_count;
+
+    spawn_plan_init(&plan);
+    if (input_fd != -1)
+        spawn_plan_dup2(&plan, input_fd, STDIN_FILENO);
+    fd_count = plan_redirects(&plan, command, fds);
+    if (fd_count == -1)
     {
-        perror("Fork failed");
+        last_status = 1;
         return;
     }
-    else if (pid == 0)
-    { // Child process
-        if (input_file)
-        {
-            int fd = open(input_file, O_RDONLY);
-            if (fd == -1)
-            {
-                perror("Error opening input file");
-                exit(EXIT_FAILURE);
-            }
-            dup2(fd, STDIN_FILENO);
-            close(fd);
-        }
-        if (output_file)
-        {
-            int fd = open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-            if (fd == -1)
-            {
-                perror("Error opening output file");
-                exit(EXIT_FAILURE);
-            }
-            dup2(fd, STDOUT_FILENO);
-            close(fd);
-        }
-        if (execvp(args[0], args) == -1)
+
+    previous_status = last_status;
+    last_status = 0;
+    if (apply_plan_to_shell(&plan, &saved) == 0)
+    {
+        uint64_t started = stats_now();
+
+        if (command->compound)
+            execute_compound(command->compound);
+        else if (!call_function(command->args))
         {
-            fprintf(stderr, "Command execution failed: %s\n", args[0]);
-            perror("Error");
-            exit(EXIT_FAILURE);
+            handle_builtin(command->args);
+            stats_record(PHASE_BUILTIN, started);
         }
     }
     else
     {
-        if (!is_background)
+        perror("Redirection failed");
+        last_status = 1;
+    }
+    restore_shell_fds(&saved);
+
+    for (int i = 0; i < fd_count; i++)
+        close(fds[i]);
+}
+
+// Function to execute a command with redirection
+void execute_command(struct command *command, int is_background)
+{
+    struct spawn_plan plan;
+    int fds[MAX_SPAWN_ACTIONS], fd_count;
+    struct job *job = NULL;
+    char **args = command->args;
+    pid_t pid = -1;
+
+    spawn_plan_init(&plan);
+    fd_count = plan_limit_prefixes(&plan, &args) == -1 ? -1 : plan_redirects(&plan, command, fds);
+    last_status = fd_count == -1;
+    if (fd_count == -1)
+        return;
+
+    if (args[0] != NULL)
+    {
+        struct pipeline single = {command, 1, is_background, 0, LIST_SEQUENCE, 0};
+
+        job = job_create_for_pipeline(&single);
+        if (job)
+            job_plan_group(job, &plan);
+        pid = spawn_command(args, &plan);
+        if (pid != -1 && job)
+            job_add_process(job, pid, args[0]);
+    }
+
+    // The child holds its own copies now
+    for (int i = 0; i < fd_count; i++)
+        close(fds[i]);
+
+    if (job == NULL)
+    {
+        uint64_t started = stats_now();
+        int status;
+
+        if (pid != -1 && !is_background && waitpid(pid, &status, 0) == pid)
         {
-            waitpid(pid, NULL, 0);
+            last_status = exit_status_of(status);
+            stats_record(PHASE_WAIT, started);
         }
     }
+    else if (job->process_count == 0)
+    {
+        job_free(job);
+        last_status = 127;
+    }
+    else if (is_background)
+    {
+        job_announce_background(job);
+        last_status = 0;
+    }
+    else
+    {
+        uint64_t started = stats_now();
+
+        job_wait_foreground(job);
+        stats_record(PHASE_WAIT, started);
+    }
 }
 
-// Function to execute a pipeline of commands
-void execute_piped_commands(char *commands[], int command_count)
+// Function to execute a pipeline of commands as one job.
+// Every stage gets its own redirections; builtin stages run in a forked subshell, except
+// the last stage of a foreground pipeline, which runs inside the shell. Redirect-only
+// end stages are served by Splice.c helper threads when MYSH_SPLICE=1.
+void execute_piped_commands(struct pipeline *pipeline)
 {
     int pipe_fd[2], prev_fd = 0;
-    pid_t pid;
+    int command_count = pipeline->command_count;
+    struct job *job = job_create_for_pipeline(pipeline);
+    struct command *in_shell = NULL;
+    const struct redirect *source = bare_endpoint(&pipeline->commands[0], STDIN_FILENO);
+    const struct redirect *sink = bare_endpoint(&pipeline->commands[command_count - 1], STDOUT_FILENO);
+    int source_fd = -1, sink_fd = -1;
+    int first = 0, last = command_count; // Stages [first, last) get a process
+    pthread_t movers[2];
+    int mover_count = 0, finished = 1;
+    int final_status = -1; // Status of a last stage that did not become a job process
+
+    if (!job)
+    {
+        perror("Job allocation failed");
+        return;
+    }
 
-    for (int i = 0; i < command_count; i++)
+    if (source)
     {
-        char *args[MAX_ARG_COUNT], *input_file = NULL, *output_file = NULL;
-        int is_background = 0;
+        source_fd = open_redirect_target(source);
+        first = 1;
+    }
+    if (sink)
+    {
+        sink_fd = open_redirect_target(sink);
+        last = command_count - 1;
+    }
 
-        parse_command(commands[i], args, &is_background, &input_file, &output_file);
+    if (source && first == last)
+    { // '< in | > out' needs no pipe at all
+        if (source_fd != -1 && sink_fd != -1)
+        {
+            struct data_mover copy = {source_fd, sink_fd};
+            struct spawn_plan plan;
+            pid_t pid;
 
-        if (pipe(pipe_fd) == -1)
+            spawn_plan_init(&plan);
+            job_plan_group(job, &plan);
+            pid = spawn_subshell(&plan, run_data_mover_process, &copy);
+            if (pid != -1)
+                job_add_process(job, pid, "(copy)");
+        }
+        if (source_fd != -1)
+            close(source_fd);
+        if (sink_fd != -1)
+            close(sink_fd);
+        sink = NULL;
+        sink_fd = -1;
+    }
+    else if (source)
+    {
+        if (pipe2(pipe_fd, O_CLOEXEC) == -1)
         {
             perror("Pipe failed");
+            close(source_fd);
+            close(sink_fd);
+            job_free(job);
             return;
         }
+        set_pipe_size(pipe_fd[1]);
+        prev_fd = pipe_fd[0];
+        if (source_fd == -1)
+            close(pipe_fd[1]); // Still give the next stage an end of file
+        else if (start_data_mover(source_fd, pipe_fd[1], &movers[mover_count]) == 0)
+            mover_count++;
+    }
+
+    for (int i = first; i < last; i++)
+    {
+        struct command *command = &pipeline->commands[i];
+        char **args = command->args;
+        struct spawn_plan plan;
+        int fds[MAX_SPAWN_ACTIONS], fd_count;
+        int has_next = i < command_count - 1;
+        int subshell = runs_in_shell(command);
 
-        pid = fork();
-        if (pid == -1)
+        if (!has_next && !pipeline->is_background && subshell)
+        { // Runs below, once the rest of the pipeline has started
+            in_shell = command;
+            break;
+        }
+
+        // Only stages with a successor get a pipe. Its ends are close-on-exec, so a
+        // command keeps just the copies on 0 and 1 and never holds another stage's end.
+        if (has_next && pipe2(pipe_fd, O_CLOEXEC) == -1)
         {
-            perror("Fork failed");
-            return;
+            perror("Pipe failed");
+            break;
         }
-        else if (pid == 0)
-        { // Child process
+        if (has_next)
+            set_pipe_size(pipe_fd[1]);
+
+        spawn_plan_init(&plan);
+        job_plan_group(job, &plan);
+        if (i > 0) // Not the first command
+            spawn_plan_dup2(&plan, prev_fd, STDIN_FILENO);
+        if (has_next)
+            spawn_plan_dup2(&plan, pipe_fd[1], STDOUT_FILENO);
+        if (subshell)
+        { // A builtin's or compound command's subshell does not exec, so the originals must be closed by hand
             if (i > 0)
-            { // Not the first command
-                dup2(prev_fd, STDIN_FILENO);
-                close(prev_fd);
-            }
-            if (i < command_count - 1)
-            { // Not the last command
-                dup2(pipe_fd[1], STDOUT_FILENO);
-                close(pipe_fd[1]);
+                spawn_plan_close(&plan, prev_fd);
+            if (has_next)
+            {
+                spawn_plan_close(&plan, pipe_fd[1]);
+                spawn_plan_close(&plan, pipe_fd[0]);
             }
+        }
 
-            close(pipe_fd[0]);
+        // Stage redirections come after the pipe, so 'cmd 2>&1 | ...' sends stderr down it
+        if (!subshell && plan_limit_prefixes(&plan, &args) == -1)
+            fd_count = -1;
+        else
+            fd_count = plan_redirects(&plan, command, fds);
+        plan_stage_cpu(&plan, i);
+        final_status = fd_count == -1 ? 1 : !subshell && args[0] == NULL ? 0 : -1;
+        if (fd_count != -1 && (subshell || args[0] != NULL))
+        {
+            pid_t pid;
 
-            if (execvp(args[0], args) == -1)
-            {
-                perror("Command execution failed");
-                exit(EXIT_FAILURE);
-            }
+            if (subshell)
+                pid = spawn_subshell(&plan, run_stage_call, command);
+            else
+                pid = spawn_command(args, &plan);
+            if (pid != -1)
+                job_add_process(job, pid, args[0] ? args[0] : compound_text(command->compound));
+            else
+                final_status = 127;
         }
+        for (int j = 0; j < fd_count; j++)
+            close(fds[j]); // The child holds its own copies now
 
-        close(pipe_fd[1]); // Close write end in parent
+        if (has_next)
+            close(pipe_fd[1]); // Close write end in parent
         if (i > 0)
         {
             close(prev_fd); // Close previous read end
         }
-        prev_fd = pipe_fd[0]; // Save read end for next iteration
+        prev_fd = has_next ? pipe_fd[0] : 0; // Save read end for next iteration
+    }
+
+    if (in_shell)
+    {
+        run_builtin_in_shell(in_shell, prev_fd);
+        final_status = last_status;
+    }
+
+    if (sink && prev_fd != 0)
+    {
+        if (sink_fd != -1)
+        { // The thread owns the read end from here on
+            if (start_data_mover(prev_fd, sink_fd, &movers[mover_count]) == 0)
+                mover_count++;
+            prev_fd = 0;
+        }
+    }
+    else if (sink_fd != -1)
+    {
+        close(sink_fd);
     }
 
-    close(prev_fd); // Close last read end
+    if (prev_fd != 0)
+        close(prev_fd); // Close last read end
 
-    for (int i = 0; i < command_count; i++)
+    if (job->process_count == 0)
     {
-        wait(NULL);
+        job_free(job);
+        last_status = 0;
+    }
+    else if (pipeline->is_background)
+    {
+        job_announce_background(job);
+    }
+    else
+    {
+        uint64_t started = stats_now();
+
+        finished = job_wait_foreground(job) == 0; // Waits only on this pipeline's pids
+        stats_record(PHASE_WAIT, started);
+    }
+    if (pipeline->is_background)
+        last_status = 0;
+    else if (final_status != -1)
+        last_status = final_status;
+
+    // A stopped or background job may still be feeding its helper threads
+    for (int i = 0; i < mover_count; i++)
+    {
+        if (finished && !pipeline->is_background)
+            pthread_join(movers[i], NULL);
+        else
+            pthread_detach(movers[i]);
     }
 }
 
 // Function to execute built-in commands
-int handle_builtin(char *input, char **args)
+int handle_builtin(char **args)
 {
-    if (strcmp(args[0], "exit") == 0)
+    const struct builtin *builtin;
+
+    if (args[0] == NULL)
+        return 0;
+    if (call_function(args))
+        return 1;
+    builtin = find_builtin(args[0]);
+    if (builtin)
     {
-        printf("Exiting shell...\n");
-        exit(0);
+        builtin->run(args);
+        return 1;
     }
-    else if (strcmp(args[0], "cd") == 0)
-    {
-        if (args[1] == NULL)
+    if (args[0][0] == '!')
+    { // Re-execute a command from history
+        const char *command = history_lookup(atol(args[0] + 1));
+        if (command == NULL)
         {
-            message(stderr, MISSING_ARGUMENT_MESSAGE);
+            message(stderr, No_COMMAND_FOUND_MESSAGE);
+            last_status = 1;
         }
-        else if (chdir(args[1]) != 0)
+        else
         {
-            perror("chdir failed");
+            printf("Executing: %s\n", command);
+            // The replayed line shares the arena of the line that named it
+            char *text = arena_strdup(&command_arena, command);
+            struct parse_context *context = arena_alloc(&command_arena, sizeof(*context));
+            if (text && context)
+            {
+                context->arena = &command_arena;
+                if (parse_cached(text, context) == 0)
+                    execute_list(context->pipelines, context->pipeline_count);
+                else if (context->incomplete)
+                    fprintf(stderr, SYNTAX_ERROR_UNEXPECTED_TOKEN_MESSAGE, token_name(TOKEN_END));
+            }
         }
         return 1;
     }
-    else if (strcmp(args[0], "history") == 0)
+    return 0;
+}
+
+// Set the variables of a command made only of 'NAME=value' words; returns 0 if it is not one
+static int run_assignments(const struct command *command)
+{
+    if (command->args[0] == NULL)
+        return 0;
+    for (int i = 0; command->args[i] != NULL; i++)
     {
-        print_history();
-        return 1;
+        if (assignment_name_length(command->args[i]) == 0)
+            return 0;
     }
-    else if (args[0][0] == '!')
-    { // Re-execute a command from history
-        int index = atoi(args[0] + 1);
-        if (index < 1 || index > history_count)
+
+    last_status = substitution_status == -1 ? 0 : substitution_status; // 'x=$(false)' fails
+    for (int i = 0; command->args[i] != NULL; i++)
+    {
+        size_t length = assignment_name_length(command->args[i]);
+
+        if (set_variable(command->args[i], length, command->args[i] + length + 1, 0) == -1)
         {
-            message(stderr, No_COMMAND_FOUND_MESSAGE);
+            perror("Assignment failed");
+            last_status = 1;
         }
-        else
+    }
+    return 1;
+}
+
+// Start job as a background subshell running body(data); its only process is called name
+static void run_in_background(struct job *job, int (*body)(void *), void *data, const char *name)
+{
+    int saved_job_control = job_control;
+    struct spawn_plan plan;
+    pid_t pid;
+
+    last_status = 0;
+    if (!job)
+    {
+        perror("Job allocation failed");
+        return;
+    }
+    spawn_plan_init(&plan);
+    job_plan_group(job, &plan);
+    job_control = 0; // The subshell must not take the terminal
+    pid = spawn_subshell(&plan, body, data);
+    job_control = saved_job_control;
+    if (pid == -1)
+    {
+        job_free(job);
+        return;
+    }
+    job_add_process(job, pid, name);
+    job_announce_background(job);
+}
+
+// Function to run a parsed pipeline without the 'time' keyword
+void run_pipeline(struct pipeline *pipeline)
+{
+    if (pipeline->command_count == 0)
+        return;
+
+    if (pipeline->command_count > 1)
+    {
+        execute_piped_commands(pipeline);
+    }
+    else
+    {
+        struct command *command = &pipeline->commands[0];
+
+        if (run_assignments(command))
+            return;
+        if (pipeline->is_background && (command->compound || (command->args[0] != NULL && find_function(command->args[0]))))
+        { // Only this waits for the commands inside, so it must not hold up the shell
+            run_in_background(job_create_for_pipeline(pipeline), run_stage_call, command,
+                              command->compound ? compound_text(command->compound) : command->args[0]);
+            return;
+        }
+        if (runs_in_shell(command))
         {
-            printf("Executing: %s\n", history[index - 1]);
-            char temp_input[MAX_INPUT_SIZE];
-            strcpy(temp_input, history[index - 1]);
-            temp_input[strcspn(temp_input, "\n")] = '\0'; // Remove newline
-            strcpy(input, temp_input);                    // Replace input with history command
-            char *new_args[MAX_ARG_COUNT];
-            int new_is_background;
-            char *new_input_file, *new_output_file;
-            parse_command(input, new_args, &new_is_background, &new_input_file, &new_output_file);
-            if (handle_builtin(input, new_args))
-                return 1;
-            execute_command(new_args, new_is_background, new_input_file, new_output_file);
-            return 1;
-            return 0;
+            run_builtin_in_shell(command, -1);
+            return;
         }
+        if (handle_builtin(command->args))
+            return; // '!<number>'
+
+        execute_command(command, pipeline->is_background);
+    }
+}
+
+// Time the pipeline data in the foreground; the body of the subshell for 'time ... &'
+static int run_timed_pipeline(void *data)
+{
+    struct pipeline foreground = *(struct pipeline *)data;
+    struct pipeline_timing timing;
+
+    foreground.is_background = 0;
+    timing_begin(&timing);
+    run_pipeline(&foreground);
+    timing_end(&timing);
+    return last_status;
+}
+
+// Function to run a parsed pipeline: builtins in the shell, everything else through spawn_command
+void execute_pipeline(struct pipeline *parsed)
+{
+    struct expansion expansion;
+    struct pipeline *pipeline = expand_pipeline(parsed, &expansion);
+
+    if (!pipeline)
+        return;
+    if (!pipeline->is_timed)
+    {
+        run_pipeline(pipeline);
+    }
+    else if (!pipeline->is_background)
+    {
+        run_timed_pipeline(pipeline);
+    }
+    else
+    { // The subshell waits for the pipeline, so it alone is the background job
+        run_in_background(job_create_for_pipeline(pipeline), run_timed_pipeline, pipeline, "time");
+    }
+    if (pipeline->is_negated && !pipeline->is_background)
+        last_status = last_status == 0;
+    free_expansion(&expansion);
+}
+
+// Function to tell whether the last foreground job was stopped by CTRL+C at the terminal,
+// which ends the whole line as if the shell had been interrupted itself
+int interrupted()
+{
+    return job_control && last_status == 128 + SIGINT;
+}
+
+struct pipeline_list
+{
+    struct pipeline *pipelines;
+    int count;
+};
+
+// Run an and-or list in the foreground; the body of the subshell for 'a && b &'
+static int run_list_in_subshell(void *data)
+{
+    struct pipeline_list *list = data;
+    int failed;
+
+    list->pipelines[list->count - 1].is_background = 0; // This copy of the shell is the job
+    run_and_or_list(list->pipelines, list->count, &failed);
+    return last_status;
+}
+
+// Function to run the and-or list at the start of pipelines and return its length. A pipeline
+// after '&&' or '||' runs or is skipped by the status of the last one that ran. *failed is
+// set when the last pipeline ran and failed, which is what '-e' stops on.
+int run_and_or_list(struct pipeline *pipelines, int count, int *failed)
+{
+    int length = 1, ran = 0;
+
+    while (length < count && pipelines[length - 1].connector != LIST_SEQUENCE)
+        length++;
+    *failed = 0;
+
+    if (length > 1 && pipelines[length - 1].is_background)
+    {
+        struct pipeline_list list = {pipelines, length};
+
+        run_in_background(job_create_for_list(pipelines, length), run_list_in_subshell, &list, "(list)");
+        return length;
+    }
+
+    for (int i = 0; i < length; i++)
+    {
+        ran = i > 0 && (pipelines[i - 1].connector == LIST_AND) != (last_status == 0) ? 0 : 1;
+        if (ran)
+            execute_pipeline(&pipelines[i]);
+        if (ran && (interrupted() || pending_control != CONTROL_NONE))
+            break;
+    }
+    *failed = ran && last_status != 0;
+    return length;
+}
+
+// Function to run a parsed list of pipelines in order; returns -1 if '-e' stopped it early
+int execute_list(struct pipeline *pipelines, int count)
+{
+    for (int i = 0; i < count;)
+    {
+        int failed;
+
+        i += run_and_or_list(&pipelines[i], count - i, &failed);
+        if (exit_on_error && failed)
+            return -1;
+        if (interrupted() || pending_control != CONTROL_NONE)
+            break; // CTRL+C, or 'break', 'continue' or 'return' leaving the list
     }
     return 0;
 }
 
-int main()
+// Append a line to the unfinished command in *pending, after a newline; -1 when memory runs out
+static int continue_command(char **pending, size_t *pending_length, const char *line, size_t length)
 {
-    char input[MAX_INPUT_SIZE], *commands[MAX_ARG_COUNT];
-    int command_count;
+    char *grown = realloc(*pending, *pending_length + length + 2);
+
+    if (!grown)
+    {
+        perror("Line allocation failed");
+        return -1;
+    }
+    grown[(*pending_length)++] = '\n';
+    memcpy(grown + *pending_length, line, length + 1);
+    *pending_length += length;
+    *pending = grown;
+    return 0;
+}
+
+// Function to read commands from stdin one line at a time, as typed at the prompt.
+// Lines may be of any length; the buffer grows to fit the longest one. A command that does
+// not end on its line, such as a loop or 'a &&', gets the lines that follow until it is
+// complete, read with the '> ' prompt.
+int run_interactive()
+{
+    struct parse_context context = {.arena = &command_arena};
+    char *input = NULL, *pending = NULL, *text;
+    size_t input_capacity = 0, pending_length = 0;
+    ssize_t length;
+    uint64_t started;
+    int parsed, editing = interactive && line_edit_enabled();
 
     while (1)
     {
-        printf("mysh> ");
-        if (!fgets(input, MAX_INPUT_SIZE, stdin))
+        const char *prompt = pending ? "> " : "mysh> ";
+
+        arena_reset(&command_arena);
+        if (!pending)
+            notify_finished_jobs();
+        if (interactive && !editing)
+            printf("%s", prompt);
+        fflush(stdout); // The prompt, and output still buffered before the editor draws
+        started = stats_now();
+        length = editing ? line_edit_read(prompt, &input, &input_capacity) : getline(&input, &input_capacity, stdin);
+        if (length == -1)
         {
-            perror("fgets failed");
-            exit(EXIT_FAILURE);
+            if (!editing && ferror(stdin))
+                perror("getline failed");
+            else if (interactive)
+                printf("\n"); // Leave the prompt line after CTRL+D
+            if (pending)
+            {
+                fprintf(stderr, SYNTAX_ERROR_UNEXPECTED_TOKEN_MESSAGE, token_name(TOKEN_END));
+                last_status = 2;
+            }
+            break;
+        }
+        stats_record(PHASE_READ, started);
+
+        if (length > 0 && input[length - 1] == '\n')
+            input[--length] = '\0'; // Remove newline
+        if (length == 0 && !pending)
+            continue;
+
+        if (interactive && length > 0)
+        {
+            started = stats_now();
+            add_to_history(input);
+            stats_record(PHASE_HISTORY, started);
         }
 
-        input[strcspn(input, "\n")] = '\0'; // Remove newline
-        if (strlen(input) == 0)
+        text = input;
+        if (pending)
+        {
+            if (continue_command(&pending, &pending_length, input, length) == -1)
+                break;
+            text = pending;
+        }
+        started = stats_now();
+        parsed = parse_cached(text, &context);
+        stats_record(PHASE_PARSE, started);
+        if (parsed == -1 && context.incomplete)
+        {
+            if (!pending)
+            {
+                pending = strdup(input);
+                pending_length = length;
+                if (!pending)
+                    perror("Line allocation failed");
+            }
             continue;
+        }
 
-        add_to_history(input);
+        interrupt_pending = 0; // A CTRL+C at the prompt does not stop the next loop
+        if (parsed == -1)
+            last_status = 2;
+        else if (execute_list(context.pipelines, context.pipeline_count) == -1)
+            break;
+        free(pending); // The parsed words may point into it until the command has run
+        pending = NULL;
+    }
+    free(pending);
+    free(input);
+    return last_status;
+}
 
-        parse_input(input, commands, &command_count);
+int main(int argc, char **argv)
+{
+    const char *command = NULL, *script = NULL;
+    int option;
 
-        if (command_count > 1)
+    while ((option = getopt(argc, argv, "+ec:")) != -1)
+    {
+        if (option == 'e')
         {
-            execute_piped_commands(commands, command_count);
+            exit_on_error = 1;
+        }
+        else if (option == 'c')
+        {
+            command = optarg;
         }
         else
         {
-            char *args[MAX_ARG_COUNT];
-            int is_background;
-            char *input_file, *output_file;
+            message(stderr, USAGE_MESSAGE);
+            return 2;
+        }
+    }
+    interactive = command == NULL && optind == argc && isatty(STDIN_FILENO);
 
-            parse_command(commands[0], args, &is_background, &input_file, &output_file);
-            if (handle_builtin(input, args))
-                continue;
+    variables_init();
+    events_init();
+    stats_init();
+    spawn_init();
+    cgroup_init();
+    limits_init();
+    splice_init();
+    history_init();
+    jobs_init(interactive);
 
-            execute_command(args, is_background, input_file, output_file);
-        }
+    if (command == NULL && optind < argc)
+        shell_name = script = argv[optind++]; // Its arguments follow
+    else if (optind < argc)
+        shell_name = argv[optind++]; // 'mysh -c command name args...', as in other shells
+    positional_parameters = argv + optind;
+    positional_count = argc - optind;
+
+    if (command != NULL)
+    {
+        char *text = strdup(command);
+        int status = text ? run_script(text, "-c") : EXIT_FAILURE;
+
+        free(text);
+        return status;
     }
+    if (script != NULL)
+        return run_script_file(script);
+    return run_interactive();
 }
@@ -0,0 +1,482 @@
+/**
+ * @file Spawn.c
+ * @brief Process launch backend shared by execute_command and execute_piped_commands.
+ *
+ * A launch is described by a spawn_plan: the file-descriptor actions the child needs
+ * between fork and exec. Redirection targets are opened by the shell itself, so a plan
+ * only ever contains dup2/close actions and can be handed to posix_spawn as file actions.
+ * glibc implements posix_spawn with a CLONE_VFORK child, which means the shell's page
+ * tables are not copied for every command.
+ *
+ * The program is located through the command hash (CommandHash.c) and exec'ed by
+ * absolute path, so the child never walks $PATH. Its environment is the array of
+ * exported variables kept by Variables.c.
+ *
+ * Job control is also expressed through the plan. It can put the child in a process
+ * group, hand it the terminal, and reset the signals the interactive shell ignores
+ * (spawn_default_signals) as well as the mask of those it reads from a signalfd
+ * (events_command_mask). posix_spawn supports all of these as attributes.
+ *
+ * The same plan can run a builtin. spawn_subshell() forks a child that applies the plan
+ * and calls a function instead of exec. apply_plan_to_shell() applies the dup2/close
+ * actions to the shell's own descriptors, saving the originals so that
+ * restore_shell_fds() can put them back once an in-process builtin has finished.
+ *
+ * A plan can also carry resource limits for the child (spawn_limits, filled in by
+ * Limits.c): a CPU affinity mask, a nice value and an address-space limit. posix_spawn
+ * has no attribute for any of them, so a plan with limits sets needs_fork, and the child
+ * applies them with sched_setaffinity(), setpriority() and setrlimit() before exec.
+ * The same goes for a plan that starts the child in a job's cgroup (Cgroup.c): the fork
+ * path then clones it straight into the cgroup with clone3(), and also writes the
+ * cpu.max and memory.max limits of '@cpu.max=' and '@memory.max='.
+ *
+ * The classic fork()+exec path is kept as a fallback. It is used when a plan cannot be
+ * expressed with posix_spawn (needs_fork is set) or when MYSH_SPAWN=fork is exported.
+ */
+
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/resource.h>
+
+#define MAX_SPAWN_ACTIONS 16
+#define SCRIPT_SHELL "/bin/sh" // Runs executable files that have no '#!' line
+
+enum spawn_backend
+{
+    SPAWN_BACKEND_POSIX,
+    SPAWN_BACKEND_FORK
+};
+
+enum spawn_action_kind
+{
+    SPAWN_ACTION_DUP2,
+    SPAWN_ACTION_CLOSE
+};
+
+struct spawn_action
+{
+    enum spawn_action_kind kind;
+    int fd;
+    int new_fd;
+};
+
+struct spawn_limits
+{
+    int has_cpus;
+    cpu_set_t cpus; // The CPUs the child may run on, when has_cpus is set
+    int has_nice;
+    int nice;
+    rlim_t memory; // RLIMIT_AS of the child in bytes, 0 for none
+    const char *cpu_max;    // Written to the job cgroup's cpu.max when not NULL
+    const char *memory_max; // Written to its memory.max when not NULL
+};
+
+struct spawn_plan
+{
+    struct spawn_action actions[MAX_SPAWN_ACTIONS];
+    int action_count;
+    int needs_fork; // Set when the child needs more than dup2/close before exec
+    pid_t pgid;      // -1 keeps the shell's group, 0 starts a new one, otherwise joins pgid
+    int terminal_fd; // When not -1, the child's group takes over this terminal
+    int cgroup_fd;   // When not -1, the child starts in this cgroup v2 directory
+    struct spawn_limits limits;
+};
+
+enum spawn_backend spawn_backend = SPAWN_BACKEND_POSIX;
+sigset_t spawn_default_signals; // Signals the shell ignores but children must not
+
+// Function to select the launch backend from the environment
+void spawn_init()
+{
+    const char *backend = getenv("MYSH_SPAWN");
+
+    sigemptyset(&spawn_default_signals);
+    if (backend && strcmp(backend, "fork") == 0)
+    {
+        spawn_backend = SPAWN_BACKEND_FORK;
+    }
+}
+
+void spawn_plan_init(struct spawn_plan *plan)
+{
+    plan->action_count = 0;
+    plan->needs_fork = 0;
+    plan->pgid = -1;
+    plan->terminal_fd = -1;
+    plan->cgroup_fd = -1;
+    plan->limits.has_cpus = 0;
+    plan->limits.has_nice = 0;
+    plan->limits.memory = 0;
+    plan->limits.cpu_max = NULL;
+    plan->limits.memory_max = NULL;
+}
+
+// Function to place the child in a process group, optionally giving it the terminal
+void spawn_plan_set_group(struct spawn_plan *plan, pid_t pgid, int terminal_fd)
+{
+    plan->pgid = pgid;
+    plan->terminal_fd = terminal_fd;
+#if !__GLIBC_PREREQ(2, 35)
+    if (terminal_fd != -1)
+        plan->needs_fork = 1; // No posix_spawn_file_actions_addtcsetpgrp_np()
+#endif
+}
+
+// Function to start the child in the cgroup v2 directory cgroup_fd
+void spawn_plan_set_cgroup(struct spawn_plan *plan, int cgroup_fd)
+{
+    plan->cgroup_fd = cgroup_fd;
+    plan->needs_fork = 1; // No posix_spawn attribute for it
+}
+
+static int spawn_plan_add(struct spawn_plan *plan, enum spawn_action_kind kind, int fd, int new_fd)
+{
+    if (plan->action_count == MAX_SPAWN_ACTIONS)
+    {
+        errno = E2BIG;
+        return -1;
+    }
+    plan->actions[plan->action_count].kind = kind;
+    plan->actions[plan->action_count].fd = fd;
+    plan->actions[plan->action_count].new_fd = new_fd;
+    plan->action_count++;
+    return 0;
+}
+
+// Function to make new_fd a copy of fd in the child
+int spawn_plan_dup2(struct spawn_plan *plan, int fd, int new_fd)
+{
+    return spawn_plan_add(plan, SPAWN_ACTION_DUP2, fd, new_fd);
+}
+
+// Function to close fd in the child
+int spawn_plan_close(struct spawn_plan *plan, int fd)
+{
+    return spawn_plan_add(plan, SPAWN_ACTION_CLOSE, fd, -1);
+}
+
+// Function to report a failed exec in the same format for every backend
+void report_exec_failure(const char *command, int error)
+{
+    fprintf(stderr, "Command execution failed: %s\n", command);
+    fprintf(stderr, "Error: %s\n", strerror(error));
+}
+
+static int count_args(char **args)
+{
+    int count = 0;
+
+    while (args[count] != NULL)
+        count++;
+    return count;
+}
+
+// Fill shell_args, which has room for count_args(args) + 2 entries, with the arguments that
+// run the file at path with SCRIPT_SHELL, as execvp() does when exec fails with ENOEXEC
+static void script_arguments(const char *path, char **args, char **shell_args)
+{
+    int i;
+
+    shell_args[0] = SCRIPT_SHELL;
+    shell_args[1] = (char *)path;
+    for (i = 1; args[i] != NULL; i++)
+        shell_args[i + 1] = args[i];
+    shell_args[i + 1] = NULL;
+}
+
+static pid_t spawn_with_posix_spawn(const char *path, char **args, char **envp, const struct spawn_plan *plan)
+{
+    posix_spawn_file_actions_t file_actions;
+    posix_spawnattr_t attributes;
+    short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+    pid_t pid;
+    int error;
+
+    if ((error = posix_spawn_file_actions_init(&file_actions)) != 0)
+    {
+        errno = error;
+        return -1;
+    }
+    if ((error = posix_spawnattr_init(&attributes)) != 0)
+    {
+        posix_spawn_file_actions_destroy(&file_actions);
+        errno = error;
+        return -1;
+    }
+    if (plan->pgid != -1)
+    {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attributes, plan->pgid);
+    }
+    posix_spawnattr_setsigdefault(&attributes, &spawn_default_signals);
+    posix_spawnattr_setsigmask(&attributes, &events_command_mask);
+    posix_spawnattr_setflags(&attributes, flags);
+#if __GLIBC_PREREQ(2, 35)
+    if (plan->terminal_fd != -1)
+        error = posix_spawn_file_actions_addtcsetpgrp_np(&file_actions, plan->terminal_fd);
+#endif
+
+    for (int i = 0; i < plan->action_count && error == 0; i++)
+    {
+        const struct spawn_action *action = &plan->actions[i];
+
+        if (action->kind == SPAWN_ACTION_DUP2)
+            error = posix_spawn_file_actions_adddup2(&file_actions, action->fd, action->new_fd);
+        else
+            error = posix_spawn_file_actions_addclose(&file_actions, action->fd);
+    }
+    if (error == 0)
+    {
+        error = posix_spawn(&pid, path, &file_actions, &attributes, args, envp);
+        if (error == ENOEXEC)
+        { // An executable without '#!'
+            char *shell_args[count_args(args) + 2];
+
+            script_arguments(path, args, shell_args);
+            error = posix_spawn(&pid, SCRIPT_SHELL, &file_actions, &attributes, shell_args, envp);
+        }
+    }
+    posix_spawn_file_actions_destroy(&file_actions);
+    posix_spawnattr_destroy(&attributes);
+
+    if (error != 0)
+    {
+        errno = error;
+        return -1;
+    }
+    return pid;
+}
+
+// Apply the limits of a plan to the forked child itself, which exits when one fails
+static void apply_limits_in_child(const struct spawn_plan *plan)
+{
+    const struct spawn_limits *limits = &plan->limits;
+    const char *failed = NULL;
+
+    if (limits->has_cpus && sched_setaffinity(0, sizeof(limits->cpus), &limits->cpus) == -1)
+        failed = "@cpu";
+    else if (limits->has_nice && setpriority(PRIO_PROCESS, 0, limits->nice) == -1)
+        failed = "@nice";
+    else if (limits->memory)
+    {
+        struct rlimit limit = {limits->memory, limits->memory};
+
+        if (setrlimit(RLIMIT_AS, &limit) == -1)
+            failed = "@mem";
+    }
+    if (failed)
+    {
+        perror(failed);
+        _exit(EXIT_FAILURE);
+    }
+    if (plan->cgroup_fd != -1 && limits->cpu_max && cgroup_set_limit(plan->cgroup_fd, "cpu.max", limits->cpu_max) == -1)
+        _exit(EXIT_FAILURE);
+    if (plan->cgroup_fd != -1 && limits->memory_max && cgroup_set_limit(plan->cgroup_fd, "memory.max", limits->memory_max) == -1)
+        _exit(EXIT_FAILURE);
+}
+
+// Apply the job-control settings, descriptor actions and limits of a plan in a forked child
+static void apply_plan_in_child(const struct spawn_plan *plan)
+{
+    if (plan->pgid != -1)
+        setpgid(0, plan->pgid);
+    if (plan->terminal_fd != -1)
+        tcsetpgrp(plan->terminal_fd, getpgrp()); // SIGTTOU is still ignored here
+    for (int sig = 1; sig < NSIG; sig++)
+    {
+        if (sigismember(&spawn_default_signals, sig) == 1)
+            signal(sig, SIG_DFL);
+    }
+    for (int i = 0; i < plan->action_count; i++)
+    {
+        const struct spawn_action *action = &plan->actions[i];
+
+        if (action->kind == SPAWN_ACTION_DUP2)
+            dup2(action->fd, action->new_fd);
+        else
+            close(action->fd);
+    }
+    apply_limits_in_child(plan);
+}
+
+static pid_t spawn_with_fork(const char *path, char **args, char **envp, const struct spawn_plan *plan)
+{
+    pid_t pid = plan->cgroup_fd != -1 ? cgroup_clone_into(plan->cgroup_fd) : -1;
+    int in_cgroup = pid != -1; // The child already starts in the plan's cgroup
+
+    if (!in_cgroup)
+        pid = fork();
+    if (pid == -1)
+    {
+        return -1;
+    }
+    else if (pid == 0)
+    { // Child process
+        if (plan->cgroup_fd != -1 && !in_cgroup)
+            cgroup_join(plan->cgroup_fd);
+        apply_plan_in_child(plan);
+        sigprocmask(SIG_SETMASK, &events_command_mask, NULL);
+        execve(path, args, envp);
+        if (errno == ENOEXEC)
+        { // An executable without '#!'
+            char *shell_args[count_args(args) + 2];
+
+            script_arguments(path, args, shell_args);
+            execve(SCRIPT_SHELL, shell_args, envp);
+            errno = ENOEXEC;
+        }
+        report_exec_failure(args[0], errno);
+        _exit(EXIT_FAILURE);
+    }
+    if (plan->pgid != -1)
+        setpgid(pid, plan->pgid ? plan->pgid : pid); // Avoid racing the child
+    return pid;
+}
+
+// Function to fork a child that applies plan and exits with the value returned by body
+pid_t spawn_subshell(const struct spawn_plan *plan, int (*body)(void *), void *data)
+{
+    uint64_t started = stats_now();
+    pid_t pid;
+
+    fflush(stdout); // Do not let the child flush the shell's pending output again
+    pid = fork();
+    if (pid == -1)
+    {
+        perror("Fork failed");
+        return -1;
+    }
+    else if (pid == 0)
+    { // Child process
+        int status;
+
+        events_after_fork();
+        if (plan->cgroup_fd != -1)
+            cgroup_join(plan->cgroup_fd);
+        cgroup_after_fork();
+        apply_plan_in_child(plan);
+        status = body(data);
+        fflush(stdout);
+        _exit(status);
+    }
+    if (plan->pgid != -1)
+        setpgid(pid, plan->pgid ? plan->pgid : pid);
+    stats_record(PHASE_SPAWN, started);
+    return pid;
+}
+
+struct saved_fds
+{
+    int fd[MAX_SPAWN_ACTIONS];
+    int copy[MAX_SPAWN_ACTIONS]; // -1 when fd was not open before
+    int count;
+};
+
+// Remember the current state of fd unless it is already saved
+static void save_shell_fd(struct saved_fds *saved, int fd)
+{
+    for (int i = 0; i < saved->count; i++)
+    {
+        if (saved->fd[i] == fd)
+            return;
+    }
+    saved->fd[saved->count] = fd;
+    saved->copy[saved->count] = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+    saved->count++;
+}
+
+// Function to apply the descriptor actions of a plan to the shell itself
+int apply_plan_to_shell(const struct spawn_plan *plan, struct saved_fds *saved)
+{
+    saved->count = 0;
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = 0; i < plan->action_count; i++)
+    {
+        const struct spawn_action *action = &plan->actions[i];
+
+        if (action->kind == SPAWN_ACTION_DUP2)
+        {
+            save_shell_fd(saved, action->new_fd);
+            if (dup2(action->fd, action->new_fd) == -1)
+                return -1;
+        }
+        else
+        {
+            save_shell_fd(saved, action->fd);
+            close(action->fd);
+        }
+    }
+    return 0;
+}
+
+// Function to undo apply_plan_to_shell
+void restore_shell_fds(struct saved_fds *saved)
+{
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = saved->count - 1; i >= 0; i--)
+    {
+        if (saved->copy[i] == -1)
+        {
+            close(saved->fd[i]);
+        }
+        else
+        {
+            dup2(saved->copy[i], saved->fd[i]);
+            close(saved->copy[i]);
+        }
+    }
+    saved->count = 0;
+}
+
+// Function to start args[0] with the file-descriptor actions in plan applied
+pid_t spawn_command(char **args, const struct spawn_plan *plan)
+{
+    int use_posix_spawn = spawn_backend == SPAWN_BACKEND_POSIX && !plan->needs_fork;
+    uint64_t started = stats_now();
+    const char *path = lookup_command_path(args[0]);
+    char **envp = variables_envp();
+    pid_t pid;
+
+    stats_record(PHASE_LOOKUP, started);
+
+    if (!path)
+    {
+        report_exec_failure(args[0], ENOENT);
+        errno = ENOENT;
+        return -1;
+    }
+
+    if (!use_posix_spawn && path != args[0] && access(path, X_OK) != 0 && forget_command_path(args[0]))
+    { // The fork child cannot report back, so check a remembered path before forking
+        path = lookup_command_path(args[0]);
+        if (!path)
+        {
+            report_exec_failure(args[0], ENOENT);
+            errno = ENOENT;
+            return -1;
+        }
+    }
+
+    started = stats_now();
+    pid = use_posix_spawn ? spawn_with_posix_spawn(path, args, envp, plan) : spawn_with_fork(path, args, envp, plan);
+    stats_record(PHASE_SPAWN, started);
+    if (pid == -1 && use_posix_spawn && errno == ENOENT && forget_command_path(args[0]))
+    { // The remembered file is gone; search $PATH again
+        path = lookup_command_path(args[0]);
+        if (path)
+            pid = spawn_with_posix_spawn(path, args, envp, plan);
+    }
+
+    if (pid == -1)
+    {
+        if (use_posix_spawn)
+            report_exec_failure(args[0], errno);
+        else
+            perror("Fork failed");
+    }
+    return pid;
+}
@@ -0,0 +1,159 @@
+/**
+ * @file Splice.c
+ * @brief In-shell data movers for redirect-only pipeline endpoints.
+ *
+ * When MYSH_SPLICE=1 is exported, some end stages of a pipeline do not get a process
+ * at all. That applies to a first stage that only reads a file ('< file', or 'cat < file'
+ * with no operands) and to a last stage that only writes one ('> file', '>> file' or
+ * 'cat > file'). The shell opens the file itself, and a helper thread moves the data
+ * between the file and the neighbouring pipe with splice(2), so the bytes never pass
+ * through user space. In '< in | > out' there is no pipe at all, and the data is copied
+ * with copy_file_range(). That copy runs in a forked child rather than a thread, because
+ * it is the whole job and must still stop on CTRL+Z and die on CTRL+C. Both calls fall
+ * back to read/write when the descriptors do not support them, for example on a terminal.
+ *
+ * Helper threads block every signal. A write to a closed pipe then fails with EPIPE
+ * instead of killing the shell, and SIGCHLD is still delivered to the main thread. Each
+ * thread owns its two descriptors and closes them when it is done.
+ *
+ * MYSH_PIPE_SIZE sets the capacity of every pipeline pipe in bytes, through F_SETPIPE_SZ.
+ * Larger pipes mean fewer context switches between stages on big inputs.
+ */
+
+#include <pthread.h>
+
+#define SPLICE_CHUNK_SIZE (1 << 20)
+#define COPY_BUFFER_SIZE 65536
+
+struct data_mover
+{
+    int in_fd;
+    int out_fd;
+};
+
+int splice_enabled;
+static int pipe_size; // 0 leaves the kernel default
+
+// Function to read the accelerator settings from the environment
+void splice_init()
+{
+    const char *enabled = getenv("MYSH_SPLICE");
+    const char *size = getenv("MYSH_PIPE_SIZE");
+
+    splice_enabled = enabled && strcmp(enabled, "1") == 0;
+    pipe_size = size ? atoi(size) : 0;
+    if (pipe_size < 0)
+        pipe_size = 0;
+}
+
+// Function to apply $MYSH_PIPE_SIZE to a newly created pipe
+void set_pipe_size(int fd)
+{
+    if (pipe_size > 0 && fcntl(fd, F_SETPIPE_SZ, pipe_size) == -1)
+        perror("F_SETPIPE_SZ failed");
+}
+
+// Function to return the single file redirection of fd if command does nothing else,
+// so the shell can move its data. NULL when the accelerator is off or the stage needs a process.
+const struct redirect *bare_endpoint(const struct command *command, int fd)
+{
+    const struct redirect *redirect = &command->redirects[0];
+    char **args = command->args;
+
+    if (!splice_enabled || command->redirect_count != 1 || redirect->fd != fd)
+        return NULL;
+    if (args[0] != NULL && (strcmp(args[0], "cat") != 0 || args[1] != NULL))
+        return NULL;
+    if (fd == STDIN_FILENO)
+        return redirect->kind == REDIRECT_INPUT ? redirect : NULL;
+    return redirect->kind == REDIRECT_OUTPUT || redirect->kind == REDIRECT_APPEND ? redirect : NULL;
+}
+
+// Copy through a user-space buffer; the last resort
+static int copy_with_buffer(int in_fd, int out_fd)
+{
+    char buffer[COPY_BUFFER_SIZE];
+    ssize_t length;
+
+    while ((length = read(in_fd, buffer, sizeof(buffer))) > 0)
+    {
+        for (ssize_t done = 0, written; done < length; done += written)
+        {
+            written = write(out_fd, buffer + done, length - done);
+            if (written == -1)
+                return -1;
+        }
+    }
+    return length == -1 ? -1 : 0;
+}
+
+// Function to move everything from in_fd to out_fd, in the kernel where possible
+int move_data(int in_fd, int out_fd)
+{
+    ssize_t length;
+
+    while ((length = splice(in_fd, NULL, out_fd, NULL, SPLICE_CHUNK_SIZE, SPLICE_F_MOVE | SPLICE_F_MORE)) > 0)
+        ;
+    if (length == 0)
+        return 0;
+    if (errno != EINVAL)
+        return -1;
+
+    // Neither side is a pipe, or the file does not support splicing
+    while ((length = copy_file_range(in_fd, NULL, out_fd, NULL, SPLICE_CHUNK_SIZE, 0)) > 0)
+        ;
+    if (length == 0)
+        return 0;
+    if (errno != EINVAL && errno != EXDEV && errno != EBADF && errno != EOPNOTSUPP && errno != ENOSYS)
+        return -1;
+    return copy_with_buffer(in_fd, out_fd);
+}
+
+// Function to run a data mover as the body of spawn_subshell()
+int run_data_mover_process(void *data)
+{
+    struct data_mover *mover = data;
+
+    return move_data(mover->in_fd, mover->out_fd) == -1 && errno != EPIPE ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static void *run_data_mover(void *data)
+{
+    struct data_mover *mover = data;
+
+    if (move_data(mover->in_fd, mover->out_fd) == -1 && errno != EPIPE)
+        perror("Data transfer failed");
+    close(mover->in_fd);
+    close(mover->out_fd);
+    free(mover);
+    return NULL;
+}
+
+// Function to start a helper thread that moves in_fd to out_fd and then closes both.
+// The descriptors are closed right away if the thread cannot be started.
+int start_data_mover(int in_fd, int out_fd, pthread_t *thread)
+{
+    struct data_mover *mover = malloc(sizeof(*mover));
+    sigset_t all, previous;
+    int error = ENOMEM;
+
+    if (mover)
+    {
+        mover->in_fd = in_fd;
+        mover->out_fd = out_fd;
+        sigfillset(&all);
+        pthread_sigmask(SIG_SETMASK, &all, &previous); // Inherited by the new thread
+        error = pthread_create(thread, NULL, run_data_mover, mover);
+        pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    }
+    if (error != 0)
+    {
+        errno = error;
+        perror("Data transfer thread failed");
+        free(mover);
+        close(in_fd);
+        close(out_fd);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,202 @@
+/**
+ * @file Stats.c
+ * @brief Latency histograms for the shell's own phases, and the 'stats' builtin.
+ *
+ * Every phase of running a command (reading it, saving it to the history, parsing,
+ * running a builtin, looking up the program, spawning it and waiting for it) is timed
+ * with CLOCK_MONOTONIC, which the vDSO answers without a system call. Each sample goes
+ * into a log-linear histogram in the style of HdrHistogram: values below 16 ns get a
+ * bucket each, and every power of two above that is split into 16 buckets, so a
+ * reported percentile is within 1/16 of the real value. Recording is a shift, an
+ * add and an increment into a static block; nothing is allocated.
+ *
+ * 'stats' prints the count, p50, p99 and max of every phase, and 'stats -r' clears them.
+ * When $MYSH_STATS names a file ('-' for stderr), the same data, including the non-empty
+ * buckets, is written there as JSON when the shell exits.
+ *
+ * The read phase includes the time spent waiting for the next line, which is only
+ * meaningful when commands come from a pipe or a script. Spawning with posix_spawn()
+ * returns once the child has exec'ed, so the spawn phase covers exec as well.
+ */
+
+#include <stdint.h>
+#include <time.h>
+
+#define STATS_SUB_BITS 4
+#define STATS_SUB_BUCKETS (1 << STATS_SUB_BITS)
+#define STATS_BUCKETS ((64 - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS)
+
+enum stats_phase
+{
+    PHASE_READ,
+    PHASE_HISTORY,
+    PHASE_PARSE,
+    PHASE_BUILTIN,
+    PHASE_LOOKUP,
+    PHASE_SPAWN,
+    PHASE_WAIT,
+    PHASE_COUNT
+};
+
+static const char *const phase_names[PHASE_COUNT] = {"read", "history", "parse", "builtin", "lookup", "spawn", "wait"};
+
+struct phase_histogram
+{
+    uint64_t count;
+    uint64_t total;
+    uint64_t max;
+    uint32_t buckets[STATS_BUCKETS];
+};
+
+static struct phase_histogram phase_stats[PHASE_COUNT];
+static const char *stats_dump_path;
+static pid_t stats_owner; // Subshells that call exit() must not overwrite the dump
+
+// Function to read the monotonic clock in nanoseconds
+uint64_t stats_now()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static int stats_bucket(uint64_t value)
+{
+    int shift;
+
+    if (value < STATS_SUB_BUCKETS)
+        return (int)value;
+    shift = 63 - __builtin_clzll(value) - STATS_SUB_BITS;
+    return (shift + 1) * STATS_SUB_BUCKETS + (int)((value >> shift) - STATS_SUB_BUCKETS);
+}
+
+// Largest value that falls into a bucket
+static uint64_t stats_bucket_limit(int bucket)
+{
+    int shift = bucket / STATS_SUB_BUCKETS - 1;
+
+    if (shift < 0)
+        return bucket;
+    return ((uint64_t)(STATS_SUB_BUCKETS + bucket % STATS_SUB_BUCKETS + 1) << shift) - 1;
+}
+
+// Function to record the time since `started` (from stats_now()) for a phase
+void stats_record(enum stats_phase phase, uint64_t started)
+{
+    struct phase_histogram *histogram = &phase_stats[phase];
+    uint64_t elapsed = stats_now() - started;
+
+    histogram->count++;
+    histogram->total += elapsed;
+    if (elapsed > histogram->max)
+        histogram->max = elapsed;
+    histogram->buckets[stats_bucket(elapsed)]++;
+}
+
+// Smallest bucket limit below which `percent` of the samples fall, capped at the exact maximum
+static uint64_t stats_percentile(const struct phase_histogram *histogram, double percent)
+{
+    uint64_t wanted = (uint64_t)(histogram->count * percent / 100.0 + 0.5), seen = 0;
+
+    if (wanted == 0)
+        wanted = 1;
+    for (int i = 0; i < STATS_BUCKETS; i++)
+    {
+        seen += histogram->buckets[i];
+        if (seen >= wanted)
+            return stats_bucket_limit(i) < histogram->max ? stats_bucket_limit(i) : histogram->max;
+    }
+    return histogram->max;
+}
+
+static void stats_write_json(FILE *out)
+{
+    fprintf(out, "{\"pid\": %d, \"phases\": {", (int)getpid());
+    for (int phase = 0; phase < PHASE_COUNT; phase++)
+    {
+        const struct phase_histogram *histogram = &phase_stats[phase];
+        int first = 1;
+
+        fprintf(out, "%s\n  \"%s\": {\"count\": %llu, \"total_ns\": %llu, \"p50_ns\": %llu, \"p90_ns\": %llu, "
+                     "\"p99_ns\": %llu, \"max_ns\": %llu, \"buckets\": [",
+                phase ? "," : "", phase_names[phase], (unsigned long long)histogram->count,
+                (unsigned long long)histogram->total, (unsigned long long)stats_percentile(histogram, 50),
+                (unsigned long long)stats_percentile(histogram, 90), (unsigned long long)stats_percentile(histogram, 99),
+                (unsigned long long)histogram->max);
+        for (int i = 0; i < STATS_BUCKETS; i++)
+        {
+            if (histogram->buckets[i] == 0)
+                continue;
+            fprintf(out, "%s[%llu, %u]", first ? "" : ", ", (unsigned long long)stats_bucket_limit(i), histogram->buckets[i]);
+            first = 0;
+        }
+        fprintf(out, "]}");
+    }
+    fprintf(out, "\n}}\n");
+}
+
+static void stats_dump_at_exit()
+{
+    FILE *out;
+
+    if (getpid() != stats_owner)
+        return;
+    if (strcmp(stats_dump_path, "-") == 0)
+    {
+        stats_write_json(stderr);
+        return;
+    }
+    out = fopen(stats_dump_path, "w");
+    if (!out)
+    {
+        perror(stats_dump_path);
+        return;
+    }
+    stats_write_json(out);
+    fclose(out);
+}
+
+// Function to arrange for the JSON dump when $MYSH_STATS is set
+void stats_init()
+{
+    stats_dump_path = getenv("MYSH_STATS");
+    stats_owner = getpid();
+    if (stats_dump_path && stats_dump_path[0] != '\0')
+        atexit(stats_dump_at_exit);
+}
+
+static void print_nanoseconds(uint64_t value)
+{
+    if (value < 10000)
+        printf(" %9llu ns", (unsigned long long)value);
+    else if (value < 10000000)
+        printf(" %9.1f us", value / 1e3);
+    else
+        printf(" %9.1f ms", value / 1e6);
+}
+
+// Function to implement 'stats [-r]'
+void builtin_stats(char **args)
+{
+    if (args[1] != NULL && strcmp(args[1], "-r") == 0)
+    {
+        memset(phase_stats, 0, sizeof(phase_stats));
+        return;
+    }
+
+    printf("%-8s %10s %12s %12s %12s\n", "phase", "count", "p50", "p99", "max");
+    for (int phase = 0; phase < PHASE_COUNT; phase++)
+    {
+        const struct phase_histogram *histogram = &phase_stats[phase];
+
+        printf("%-8s %10llu", phase_names[phase], (unsigned long long)histogram->count);
+        if (histogram->count > 0)
+        {
+            print_nanoseconds(stats_percentile(histogram, 50));
+            print_nanoseconds(stats_percentile(histogram, 99));
+            print_nanoseconds(histogram->max);
+        }
+        printf("\n");
+    }
+}
@@ -0,0 +1,218 @@
+/**
+ * @file Substitution.c
+ * @brief Command substitution: running the command of a '$(...)' or '`...`' for its output.
+ *
+ * capture_output() parses the command with parse_cached(), so a substitution run again
+ * and again in a loop is parsed once, and appends what it writes to a string builder.
+ * The output is read with read() calls of at least SUBSTITUTION_READ_SIZE bytes straight
+ * into the free end of that buffer, which doubles as it fills; Expand.c then uses the
+ * buffer itself as the argument, or splits it in place, rather than copying it again.
+ *
+ * A command is run in a forked copy of the shell (a job of its own, like '( ... )'), with
+ * its standard output on a pipe the shell reads until the end. When the whole
+ * substitution is a single call of a builtin that only prints, such as 'echo', 'printf'
+ * or 'pwd', nothing is forked: the builtin runs in the shell with its standard output on
+ * a memfd, which is then read back and emptied for the next one. A file rather than a
+ * pipe means a large output cannot fill a buffer that nobody reads yet. Any other command
+ * forks, so that the assignments and 'cd' of a substitution do not leak into the shell.
+ *
+ * The parsed commands live in substitution_arena, which is reset once the outermost
+ * substitution has finished, so a loop running substitutions does not grow the arena of
+ * its line. The status of a substitution becomes $?; a command made only of assignments
+ * keeps it (substitution_status).
+ */
+
+#include <sys/mman.h>
+
+#define SUBSTITUTION_READ_SIZE 65536
+
+static struct arena substitution_arena;
+static int substitution_depth; // Substitutions running, nested within one another
+static int capture_fd = -1;    // The memfd in-shell builtins write their output to
+
+// Builtins that only write to standard output, with no effect on the shell
+static const char *const capture_builtins[] = {":", "[", "echo", "false", "printf", "pwd", "test", "true"};
+
+// Tell whether the parsed substitution is one call of a capture_builtins builtin
+static int captures_in_shell(const struct parse_context *context)
+{
+    const struct pipeline *pipeline = &context->pipelines[0];
+    const struct command *command = &pipeline->commands[0];
+
+    if (context->pipeline_count != 1 || pipeline->command_count != 1 || pipeline->is_background || pipeline->is_timed)
+        return 0;
+    if (pipeline->is_negated || command->compound || command->args[0] == NULL)
+        return 0;
+    if ((command->arg_flags && command->arg_flags[0] & ARG_EXPAND) || find_function(command->args[0]))
+        return 0; // The name is only known once expanded, or a function hides the builtin
+    for (size_t i = 0; i < sizeof(capture_builtins) / sizeof(capture_builtins[0]); i++)
+    {
+        if (strcmp(command->args[0], capture_builtins[i]) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+// Read fd to its end straight into output; -1 after reporting a failure
+static int read_output(int fd, struct string_builder *output)
+{
+    while (1)
+    {
+        ssize_t got;
+
+        if (builder_reserve(output, SUBSTITUTION_READ_SIZE) == -1)
+        {
+            perror("Command substitution failed");
+            return -1;
+        }
+        got = read(fd, output->text + output->length, output->capacity - output->length - 1);
+        if (got == 0)
+            break;
+        if (got == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("Command substitution failed");
+            return -1;
+        }
+        output->length += got;
+    }
+    output->text[output->length] = '\0';
+    return 0;
+}
+
+// Run a builtin in the shell with its output on capture_fd, then move the output to
+// output; -1 when there is no memfd, so that the caller forks instead
+static int capture_in_shell(struct pipeline *pipeline, struct string_builder *output)
+{
+    struct expansion expansion;
+    struct pipeline *expanded;
+    struct spawn_plan plan;
+    struct saved_fds saved;
+    off_t size;
+
+    if (capture_fd == -1 && (capture_fd = memfd_create("substitution", MFD_CLOEXEC)) == -1)
+        return -1;
+    expanded = expand_pipeline(pipeline, &expansion); // Before the output moves, for nested substitutions
+    if (!expanded)
+        return 0; // No output
+    spawn_plan_init(&plan);
+    spawn_plan_dup2(&plan, capture_fd, STDOUT_FILENO);
+    if (apply_plan_to_shell(&plan, &saved) == 0)
+    {
+        run_builtin_in_shell(&expanded->commands[0], -1);
+    }
+    else
+    {
+        perror("Redirection failed");
+        last_status = 1;
+    }
+    restore_shell_fds(&saved);
+    free_expansion(&expansion);
+
+    size = lseek(capture_fd, 0, SEEK_CUR);
+    if (size > 0 && builder_reserve(output, size) == 0 && pread(capture_fd, output->text + output->length, size, 0) == size)
+    {
+        output->length += size;
+        output->text[output->length] = '\0';
+    }
+    if (ftruncate(capture_fd, 0) == -1 || lseek(capture_fd, 0, SEEK_SET) == -1)
+    { // Start over with a new one next time
+        close(capture_fd);
+        capture_fd = -1;
+    }
+    return 0;
+}
+
+// Run the commands of a substitution in the foreground; the body of its subshell
+static int run_captured_list(void *data)
+{
+    const struct parse_context *context = data;
+
+    job_control = 0; // The subshell's group has the terminal; its commands stay in it
+    execute_list(context->pipelines, context->pipeline_count);
+    return last_status;
+}
+
+// Run the commands in a forked subshell whose output is read from a pipe
+static void capture_in_subshell(const char *text, struct parse_context *context, struct string_builder *output)
+{
+    struct spawn_plan plan;
+    struct job *job;
+    uint64_t started;
+    pid_t pid = -1;
+    int fds[2];
+
+    if (pipe2(fds, O_CLOEXEC) == -1)
+    {
+        perror("Command substitution failed");
+        last_status = 1;
+        return;
+    }
+    job = job_create(text, 0);
+    if (job)
+    {
+        spawn_plan_init(&plan);
+        spawn_plan_dup2(&plan, fds[1], STDOUT_FILENO);
+        job_plan_group(job, &plan);
+        pid = spawn_subshell(&plan, run_captured_list, context);
+    }
+    close(fds[1]);
+    if (pid == -1 || job_add_process(job, pid, "(substitution)") == -1)
+    {
+        if (!job)
+            perror("Job allocation failed");
+        else
+            job_free(job);
+        close(fds[0]);
+        last_status = 1;
+        return;
+    }
+    read_output(fds[0], output);
+    close(fds[0]);
+    started = stats_now();
+    job_wait_foreground(job);
+    stats_record(PHASE_WAIT, started);
+}
+
+// Function to run the command text (length bytes) of a substitution and append its
+// output, without the trailing newlines, to output. $? becomes the command's status.
+void capture_output(const char *text, size_t length, struct string_builder *output)
+{
+    struct parse_context context = {.arena = &substitution_arena};
+    char *command = arena_alloc(&substitution_arena, length + 1);
+    char *job_text = arena_alloc(&substitution_arena, length + 1);
+    size_t start = output->length;
+
+    if (!command || !job_text)
+    {
+        perror("Command substitution failed");
+        last_status = 1;
+        return;
+    }
+    memcpy(command, text, length);
+    command[length] = '\0';
+    memcpy(job_text, command, length + 1); // Parsing cooks command in place
+
+    substitution_depth++;
+    if (parse_cached(command, &context) == -1)
+    {
+        if (context.incomplete)
+            fprintf(stderr, SYNTAX_ERROR_UNEXPECTED_TOKEN_MESSAGE, token_name(TOKEN_END));
+        last_status = 2;
+    }
+    else if (context.pipeline_count == 0)
+    {
+        last_status = 0;
+    }
+    else if (!captures_in_shell(&context) || capture_in_shell(&context.pipelines[0], output) == -1)
+    {
+        capture_in_subshell(job_text, &context, output);
+    }
+    if (--substitution_depth == 0)
+        arena_reset(&substitution_arena);
+
+    while (output->length > start && output->text[output->length - 1] == '\n')
+        output->text[--output->length] = '\0';
+    substitution_status = last_status;
+}
@@ -0,0 +1,159 @@
+/**
+ * @file Timing.c
+ * @brief The 'time' keyword: wall-clock time and resource usage of a pipeline.
+ *
+ * A timed pipeline notes the monotonic clock and the shell's own getrusage() when it
+ * starts. Its processes are reaped with wait4(), which returns the rusage of each one,
+ * and Jobs.c keeps that in the job_process. When a foreground job finishes,
+ * timing_record_job() copies the usage of its processes into the active timing just
+ * before the job is freed. Once the pipeline is done, the report goes to stderr: the
+ * totals first, then one row per process if there was more than one. User and system
+ * time include the shell's own share, which covers in-shell builtins and the splice
+ * helper threads.
+ *
+ * A background pipeline is timed inside a subshell, so its report appears when it ends.
+ */
+
+#include <time.h>
+#include <sys/time.h>
+
+struct process_usage
+{
+    pid_t pid;
+    char name[16];
+    int status;
+    struct rusage usage;
+};
+
+struct pipeline_timing
+{
+    struct timespec started;
+    struct rusage shell_started;
+    struct process_usage *processes;
+    int process_count;
+    int process_capacity;
+    struct pipeline_timing *outer; // Timing that was active before this one
+};
+
+static struct pipeline_timing *active_timing;
+
+// Function to start timing a pipeline
+void timing_begin(struct pipeline_timing *timing)
+{
+    memset(timing, 0, sizeof(*timing));
+    timing->outer = active_timing;
+    active_timing = timing;
+    getrusage(RUSAGE_SELF, &timing->shell_started);
+    clock_gettime(CLOCK_MONOTONIC, &timing->started);
+}
+
+// Function to add the processes of a finished job to the active timing, if any
+void timing_record_job(const struct job *job)
+{
+    struct pipeline_timing *timing = active_timing;
+
+    if (!timing)
+        return;
+    for (int i = 0; i < job->process_count; i++)
+    {
+        const struct job_process *process = &job->processes[i];
+        struct process_usage *entry;
+
+        if (timing->process_count == timing->process_capacity)
+        {
+            int capacity = timing->process_capacity ? timing->process_capacity * 2 : 8;
+            struct process_usage *processes = realloc(timing->processes, capacity * sizeof(*processes));
+
+            if (!processes)
+                return;
+            timing->processes = processes;
+            timing->process_capacity = capacity;
+        }
+        entry = &timing->processes[timing->process_count++];
+        entry->pid = process->pid;
+        memcpy(entry->name, process->name, sizeof(entry->name));
+        entry->status = process->status;
+        entry->usage = process->usage;
+    }
+}
+
+static double timeval_seconds(struct timeval tv)
+{
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void print_duration(const char *label, double seconds)
+{
+    int minutes = (int)(seconds / 60);
+
+    fprintf(stderr, "%s\t%dm%.3fs\n", label, minutes, seconds - minutes * 60);
+}
+
+static void print_usage_row(const char *pid, const char *name, double user, double sys, const struct rusage *usage, const char *status)
+{
+    fprintf(stderr, "%7s  %-15s %8.3fs %8.3fs %10ld %7ld %7ld  %s\n", pid, name, user, sys,
+            usage->ru_maxrss, usage->ru_nvcsw, usage->ru_nivcsw, status);
+}
+
+// Function to stop timing and print the report for the pipeline that just finished
+void timing_end(struct pipeline_timing *timing)
+{
+    struct timespec now;
+    struct rusage shell_now, shell;
+    double real, user, sys;
+    long max_rss = 0, voluntary, involuntary;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    getrusage(RUSAGE_SELF, &shell_now);
+    active_timing = timing->outer;
+
+    memset(&shell, 0, sizeof(shell));
+    timersub(&shell_now.ru_utime, &timing->shell_started.ru_utime, &shell.ru_utime);
+    timersub(&shell_now.ru_stime, &timing->shell_started.ru_stime, &shell.ru_stime);
+    shell.ru_maxrss = shell_now.ru_maxrss;
+    shell.ru_nvcsw = shell_now.ru_nvcsw - timing->shell_started.ru_nvcsw;
+    shell.ru_nivcsw = shell_now.ru_nivcsw - timing->shell_started.ru_nivcsw;
+
+    real = (now.tv_sec - timing->started.tv_sec) + (now.tv_nsec - timing->started.tv_nsec) / 1e9;
+    user = timeval_seconds(shell.ru_utime);
+    sys = timeval_seconds(shell.ru_stime);
+    voluntary = shell.ru_nvcsw;
+    involuntary = shell.ru_nivcsw;
+    for (int i = 0; i < timing->process_count; i++)
+    {
+        const struct rusage *usage = &timing->processes[i].usage;
+
+        user += timeval_seconds(usage->ru_utime);
+        sys += timeval_seconds(usage->ru_stime);
+        voluntary += usage->ru_nvcsw;
+        involuntary += usage->ru_nivcsw;
+        if (usage->ru_maxrss > max_rss)
+            max_rss = usage->ru_maxrss;
+    }
+
+    fprintf(stderr, "\n");
+    print_duration("real", real);
+    print_duration("user", user);
+    print_duration("sys", sys);
+    if (timing->process_count > 0)
+        fprintf(stderr, "maxrss\t%ld KiB\n", max_rss);
+    fprintf(stderr, "ctxsw\t%ld voluntary, %ld involuntary\n", voluntary, involuntary);
+
+    if (timing->process_count > 1)
+    {
+        fprintf(stderr, "%7s  %-15s %9s %9s %10s %7s %7s  %s\n", "pid", "command", "user", "sys", "maxrss KiB", "vcsw", "ivcsw", "status");
+        for (int i = 0; i < timing->process_count; i++)
+        {
+            const struct process_usage *process = &timing->processes[i];
+            char pid[16], status[16];
+
+            snprintf(pid, sizeof(pid), "%d", (int)process->pid);
+            snprintf(status, sizeof(status), "%d", exit_status_of(process->status));
+            print_usage_row(pid, process->name, timeval_seconds(process->usage.ru_utime),
+                            timeval_seconds(process->usage.ru_stime), &process->usage, status);
+        }
+        print_usage_row("-", "(shell)", timeval_seconds(shell.ru_utime), timeval_seconds(shell.ru_stime), &shell, "");
+    }
+    free(timing->processes);
+    timing->processes = NULL;
+}
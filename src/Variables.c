@@ -0,0 +1,339 @@
+/**
+ * @file Variables.c
+ * @brief The shell's variables, the environment passed to commands, 'export' and 'unset'.
+ *
+ * Variables live in a chained hash table owned by the shell. The process environment is
+ * copied into it at startup and never consulted again: get_variable() looks names up in
+ * the table, and assignments, 'export' and 'unset' change it without touching environ.
+ *
+ * Each variable is stored as one "NAME=value" string, so the environment of a command is
+ * just an array of pointers to the exported ones. variables_envp() builds that array
+ * only when a variable it contains has been set, exported or unset since it was last
+ * built; otherwise every launch reuses it as it is. The per-launch cost therefore does not
+ * grow with the number of assignments a script makes.
+ *
+ * The positional parameters $1, $2, ... are not variables: they are the arguments of the
+ * running function, or of the script, and are only ever replaced as a whole (Control.c).
+ */
+
+#include <ctype.h>
+
+#define VARIABLE_MIN_BUCKETS 64
+
+extern char **environ;
+
+struct variable
+{
+    char *text; // "NAME=value"
+    size_t name_length;
+    unsigned long hash;
+    int exported;
+    struct variable *next;
+};
+
+static struct variable **variable_table;
+static size_t variable_bucket_count;
+static size_t variable_count;
+
+static char **variable_envp; // Exported variables, NULL-terminated
+static size_t variable_envp_capacity;
+static int variable_envp_dirty = 1; // An exported variable changed since envp was built
+
+int last_status; // Exit status of the last foreground command, as in $?
+pid_t shell_pid; // Expanded by $$; subshells keep the value of the shell that started them
+const char *shell_name = "mysh"; // $0: the script's path, when running one
+char **positional_parameters;    // $1, $2, ...; not owned, they stay valid while they are in use
+int positional_count;
+
+void unset_function(const char *name);
+
+static unsigned long hash_name(const char *name, size_t length)
+{
+    unsigned long hash = 2166136261UL;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+// Function to tell how long the name at the start of text is, 0 if it does not start with one
+size_t variable_name_length(const char *text)
+{
+    size_t length = 0;
+
+    if (!(isalpha((unsigned char)text[0]) || text[0] == '_'))
+        return 0;
+    while (isalnum((unsigned char)text[length]) || text[length] == '_')
+        length++;
+    return length;
+}
+
+// Function to tell whether word is an assignment 'NAME=value'; returns the name's length or 0
+size_t assignment_name_length(const char *word)
+{
+    size_t length = variable_name_length(word);
+
+    return length > 0 && word[length] == '=' ? length : 0;
+}
+
+static struct variable **find_slot(const char *name, size_t length, unsigned long hash)
+{
+    struct variable **slot;
+
+    if (!variable_table)
+        return NULL;
+    slot = &variable_table[hash & (variable_bucket_count - 1)];
+    while (*slot && !((*slot)->hash == hash && (*slot)->name_length == length && memcmp((*slot)->text, name, length) == 0))
+        slot = &(*slot)->next;
+    return slot;
+}
+
+// Function to look up a variable by a name that need not be NUL-terminated; NULL when unset
+const char *find_variable(const char *name, size_t length)
+{
+    struct variable **slot = find_slot(name, length, hash_name(name, length));
+
+    return slot && *slot ? (*slot)->text + length + 1 : NULL;
+}
+
+// Function to look up a variable; NULL when unset
+const char *get_variable(const char *name)
+{
+    return find_variable(name, strlen(name));
+}
+
+static int grow_variable_table()
+{
+    size_t bucket_count = variable_bucket_count ? variable_bucket_count * 2 : VARIABLE_MIN_BUCKETS;
+    struct variable **table = calloc(bucket_count, sizeof(*table));
+
+    if (!table)
+        return -1;
+    for (size_t i = 0; i < variable_bucket_count; i++)
+    {
+        struct variable *variable = variable_table[i];
+
+        while (variable)
+        {
+            struct variable *next = variable->next;
+            struct variable **bucket = &table[variable->hash & (bucket_count - 1)];
+
+            variable->next = *bucket;
+            *bucket = variable;
+            variable = next;
+        }
+    }
+    free(variable_table);
+    variable_table = table;
+    variable_bucket_count = bucket_count;
+    return 0;
+}
+
+// Function to set a variable from a name of length bytes; value NULL keeps the current one
+// (creating an empty variable only if exported is set). exported 1 exports it, 0 leaves its
+// export flag as it is. Returns -1 when memory runs out.
+int set_variable(const char *name, size_t length, const char *value, int exported)
+{
+    unsigned long hash = hash_name(name, length);
+    struct variable **slot = find_slot(name, length, hash);
+    struct variable *variable = slot ? *slot : NULL;
+    char *text;
+
+    if (!variable && variable_count >= variable_bucket_count)
+    {
+        if (grow_variable_table() == -1)
+            return -1;
+        slot = find_slot(name, length, hash);
+    }
+    if (value || !variable)
+    {
+        size_t value_length = value ? strlen(value) : 0;
+
+        text = malloc(length + value_length + 2);
+        if (!text)
+            return -1;
+        memcpy(text, name, length);
+        text[length] = '=';
+        memcpy(text + length + 1, value ? value : "", value_length + 1);
+        if (!variable)
+        {
+            variable = calloc(1, sizeof(*variable));
+            if (!variable)
+            {
+                free(text);
+                return -1;
+            }
+            variable->name_length = length;
+            variable->hash = hash;
+            *slot = variable;
+            variable_count++;
+        }
+        free(variable->text);
+        variable->text = text;
+        if (variable->exported)
+            variable_envp_dirty = 1;
+    }
+    if (exported && !variable->exported)
+    {
+        variable->exported = 1;
+        variable_envp_dirty = 1;
+    }
+    return 0;
+}
+
+// Function to remove a variable; nothing happens when it is not set
+void unset_variable(const char *name)
+{
+    size_t length = strlen(name);
+    struct variable **slot = find_slot(name, length, hash_name(name, length));
+    struct variable *variable = slot ? *slot : NULL;
+
+    if (!variable)
+        return;
+    *slot = variable->next;
+    if (variable->exported)
+        variable_envp_dirty = 1;
+    free(variable->text);
+    free(variable);
+    variable_count--;
+}
+
+// Function to return the environment for the next command, rebuilt only if it went stale
+char **variables_envp()
+{
+    size_t count = 0;
+
+    if (!variable_envp_dirty)
+        return variable_envp;
+    if (variable_envp_capacity < variable_count + 1)
+    {
+        char **grown = realloc(variable_envp, (variable_count + 1) * sizeof(*grown));
+
+        if (!grown)
+            return environ; // The environment the shell started with, out of date but valid
+        variable_envp = grown;
+        variable_envp_capacity = variable_count + 1;
+    }
+    for (size_t i = 0; i < variable_bucket_count; i++)
+    {
+        for (const struct variable *variable = variable_table[i]; variable; variable = variable->next)
+        {
+            if (variable->exported)
+                variable_envp[count++] = variable->text;
+        }
+    }
+    variable_envp[count] = NULL;
+    variable_envp_dirty = 0;
+    return variable_envp;
+}
+
+// Function to copy the process environment into the variable table
+void variables_init()
+{
+    shell_pid = getpid();
+    for (char **entry = environ; *entry; entry++)
+    {
+        const char *equals = strchr(*entry, '=');
+
+        if (equals && equals > *entry)
+            set_variable(*entry, equals - *entry, equals + 1, 1);
+    }
+}
+
+static int compare_variable_texts(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Print the exported variables, sorted, in a form the shell can read back
+static void print_exported_variables()
+{
+    char **envp = variables_envp();
+    size_t count = 0;
+    char **sorted;
+
+    while (envp[count])
+        count++;
+    sorted = malloc((count + 1) * sizeof(*sorted));
+    if (!sorted)
+    {
+        perror("export: allocation failed");
+        last_status = 1;
+        return;
+    }
+    memcpy(sorted, envp, count * sizeof(*sorted));
+    qsort(sorted, count, sizeof(*sorted), compare_variable_texts);
+    for (size_t i = 0; i < count; i++)
+    {
+        const char *equals = strchr(sorted[i], '=');
+
+        printf("export %.*s='", (int)(equals - sorted[i]), sorted[i]);
+        for (const char *c = equals + 1; *c; c++)
+        {
+            if (*c == '\'')
+                fputs("'\\''", stdout);
+            else
+                putchar(*c);
+        }
+        printf("'\n");
+    }
+    free(sorted);
+}
+
+// Function to implement 'export [-p] [name[=value]...]'
+void builtin_export(char **args)
+{
+    int i = 1;
+
+    if (args[i] && strcmp(args[i], "-p") == 0)
+        i++;
+    if (!args[i])
+    {
+        print_exported_variables();
+        return;
+    }
+    for (; args[i]; i++)
+    {
+        size_t length = variable_name_length(args[i]);
+
+        if (length == 0 || (args[i][length] != '\0' && args[i][length] != '='))
+        {
+            fprintf(stderr, EXPORT_INVALID_NAME_MESSAGE, args[i]);
+            last_status = 1;
+            continue;
+        }
+        if (set_variable(args[i], length, args[i][length] == '=' ? args[i] + length + 1 : NULL, 1) == -1)
+        {
+            perror("export failed");
+            last_status = 1;
+        }
+    }
+}
+
+// Function to implement 'unset [-v|-f] name...'
+void builtin_unset(char **args)
+{
+    int functions = 0;
+
+    for (int i = 1; args[i]; i++)
+    {
+        if (strcmp(args[i], "-v") == 0 || strcmp(args[i], "-f") == 0)
+        {
+            functions = args[i][1] == 'f';
+            continue;
+        }
+        if (variable_name_length(args[i]) != strlen(args[i]))
+        {
+            fprintf(stderr, UNSET_INVALID_NAME_MESSAGE, args[i]);
+            last_status = 1;
+            continue;
+        }
+        if (functions)
+            unset_function(args[i]);
+        else
+            unset_variable(args[i]);
+    }
+}
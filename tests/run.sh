@@ -0,0 +1,56 @@
+#!/bin/sh
+# Regression tests: each case runs a command string under mysh and compares what it
+# prints (standard output and standard error together) with the expected text.
+#
+# Usage: tests/run.sh [path-to-mysh]   (default ./Shell)
+
+MYSH=${1:-./Shell}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+failures=0
+limit=
+
+# check <label> <command> <expected>: run <command> with 'mysh -c', under $limit if set
+check() {
+    actual=$(HISTFILE= $limit "$MYSH" -c "$2" 2>&1 </dev/null)
+    if [ "$actual" = "$3" ]; then
+        printf 'ok    %s\n' "$1"
+    else
+        printf 'FAIL  %s\n  expected: %s\n  actual:   %s\n' "$1" "$3" "$actual"
+        failures=$((failures + 1))
+    fi
+}
+
+check 'here-document on the first line' 'cat <<E
+hi
+E' 'hi'
+
+check 'pattern that matches nothing' 'echo /nonexistent/*.none' '/nonexistent/*.none'
+
+check '$? is not a pattern' 'false; echo $?' '1'
+mkdir "$WORK/dollar" && : > "$WORK/dollar/\$a"
+check '\$* is a pattern' "cd $WORK/dollar; echo \\\$*" '$a'
+
+check 'wait %n returns the status of the job' 'sh -c "exit 5" & wait %1; echo $?' '5'
+check 'wait %n after the job finished' 'sh -c "exit 6" & sleep 0.2; wait %1; echo $?' '6'
+check 'finished jobs kept without wait are bounded' 'for i in $(seq 300); do /bin/true & done
+sleep 0.5; /bin/true; jobs > '"$WORK/jobs"'; test $(wc -l < '"$WORK/jobs"') -le 128 && echo bounded' 'bounded'
+
+printf 'echo ran with "$@"\n' > "$WORK/no-shebang"
+chmod +x "$WORK/no-shebang"
+check 'executable without #! runs with /bin/sh' "$WORK/no-shebang a b" 'ran with a b'
+
+# An 80 MB word cannot be built within 40 MB of address space (skipped where the shell
+# itself needs more, as under AddressSanitizer)
+limit='prlimit --as=40000000'
+if [ "$($limit "$MYSH" -c 'echo ok' 2>/dev/null || :)" = ok ]; then
+    check 'failed expansion runs nothing' 'x=$(head -c 4000000 /dev/zero | tr "\0" a)
+echo ran "$x$x$x$x$x$x$x$x$x$x$x$x$x$x$x$x$x$x$x$x" > '"$WORK/out"'
+echo $?
+test -e '"$WORK/out"' || echo nothing ran' 'Expansion failed: Cannot allocate memory
+1
+nothing ran'
+fi
+limit=
+
+[ "$failures" -eq 0 ]